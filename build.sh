@@ -8,7 +8,30 @@ gcc -ggdb -m32 -Iinclude -c "src/vfs.c" -o "bin/vfs.o" -Wall
 gcc -ggdb -m32 -Iinclude -c "src/util.c" -o "bin/util.o" -Wall
 gcc -ggdb -m32 -Iinclude -c "src/cli.c" -o "bin/cli.o" -Wall
 gcc -ggdb -m32 -Iinclude -c "src/tests.c" -o "bin/tests.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/lz.c" -o "bin/lz.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/dedup.c" -o "bin/dedup.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/pack.c" -o "bin/pack.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/btree.c" -o "bin/btree.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/crc32c.c" -o "bin/crc32c.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/log.c" -o "bin/log.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/trace.c" -o "bin/trace.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/stats.c" -o "bin/stats.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/heatmap.c" -o "bin/heatmap.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/export.c" -o "bin/export.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/fsck.c" -o "bin/fsck.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/fslock.c" -o "bin/fslock.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/nameidx.c" -o "bin/nameidx.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/dcache.c" -o "bin/dcache.o" -Wall -pthread
+gcc -ggdb -m32 -Iinclude -c "src/fsck_main.c" -o "bin/fsck_main.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/bench.c" -o "bin/bench.o" -Wall
+gcc -ggdb -m32 -Iinclude -c "src/bench_main.c" -o "bin/bench_main.o" -Wall
 
-gcc -ggdb -m32 -o "bin/voy_fs" "bin/main.o" "bin/ata.o" "bin/fs.o" "bin/util.o" "bin/cli.o" "bin/vfs.o" "bin/tests.o" -Wall
+gcc -ggdb -m32 -o "bin/voy_fs" "bin/main.o" "bin/ata.o" "bin/fs.o" "bin/util.o" "bin/cli.o" "bin/vfs.o" "bin/export.o" "bin/tests.o" "bin/lz.o" "bin/dedup.o" "bin/pack.o" "bin/btree.o" "bin/crc32c.o" "bin/log.o" "bin/stats.o" "bin/heatmap.o" "bin/trace.o" "bin/fsck.o" "bin/fslock.o" "bin/nameidx.o" "bin/dcache.o" -Wall -pthread
+gcc -ggdb -m32 -o "bin/voy_fsck" "bin/fsck_main.o" "bin/ata.o" "bin/fs.o" "bin/util.o" "bin/lz.o" "bin/dedup.o" "bin/pack.o" "bin/btree.o" "bin/crc32c.o" "bin/log.o" "bin/stats.o" "bin/heatmap.o" "bin/fsck.o" "bin/fslock.o" "bin/nameidx.o" "bin/dcache.o" -Wall -pthread
+gcc -ggdb -m32 -o "bin/voy_bench" "bin/bench_main.o" "bin/bench.o" "bin/ata.o" "bin/fs.o" "bin/vfs.o" "bin/util.o" "bin/lz.o" "bin/dedup.o" "bin/pack.o" "bin/btree.o" "bin/crc32c.o" "bin/log.o" "bin/stats.o" "bin/heatmap.o" "bin/trace.o" "bin/fsck.o" "bin/fslock.o" "bin/nameidx.o" "bin/dcache.o" -Wall -pthread
+
+# ./build.sh bench runs the benchmarks instead of the test script, ./build.sh scale the occupancy scaling stress
+if [ "$1" = "bench" ]; then ./bin/voy_bench -n 1000 -o "bin/bench.json"; exit $?; fi
+if [ "$1" = "scale" ]; then ./bin/voy_bench -s -n 500 -o "bin/scale.json"; exit $?; fi
 
 ./bin/voy_fs testscript
\ No newline at end of file
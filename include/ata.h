@@ -3,20 +3,136 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "util.h"
 
 #define ATA_SECTOR_SIZE 512
 
+// where sectors live - memory after ata_load_file or ata_create, the host file after ata_open_file, delta and base for overlays
+#define ATA_BACKEND_MEMORY  0
+#define ATA_BACKEND_SYNC    1
+#define ATA_BACKEND_URING   2
+#define ATA_BACKEND_OVERLAY 3
+
+// requests kept in flight by bulk copies, and sectors per request
+#define ATA_QUEUE_DEPTH 32
+#define ATA_COPY_CHUNK  128
+
+// sectors per allocation of saved snapshot contents
+#define ATA_SNAP_CHUNK 256
+
+typedef struct
+{
+    uint64_t tag;
+    int32_t  result;
+} ata_completion_t;
+
+typedef struct
+{
+    uint64_t sector;
+    uint32_t count;
+    uint8_t* buffer;
+    uint64_t tag;
+    bool_t   write;
+    bool_t   active;
+} ata_request_t;
+
+// submission queue, ring_fd is -1 when requests complete on submission
+typedef struct
+{
+    int               ring_fd;
+    uint32_t          depth;
+    uint32_t          inflight;
+    ata_request_t*    requests;
+    ata_completion_t* done;
+    uint32_t          done_count;
+
+    void*     sq_ptr;
+    void*     cq_ptr;
+    size_t    sq_len;
+    size_t    cq_len;
+    size_t    sqe_len;
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    void*     sqes;
+    void*     cqes;
+} ata_queue_t;
+
+// delta file of an overlay image, "VOYO"
+#define ATA_OVERLAY_MAGIC    0x4F594F56
+#define ATA_OVERLAY_VERSION  1
+#define ATA_OVERLAY_PATH_MAX 256
+
+// first sector of delta, presence bits start at bitmap_offset and the contents of sector n are at data_offset + n * sector size
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint64_t bitmap_offset;
+    uint64_t data_offset;
+    char     base[ATA_OVERLAY_PATH_MAX];
+} ata_overlay_header_t;
+
+// sectors changed since a snapshot, keys are sector + 1 with 0 for empty slots and slots index the saved contents
+typedef struct
+{
+    uint64_t* keys;
+    uint32_t* slots;
+    uint32_t  capacity;
+    uint32_t  count;
+    uint8_t** chunks;
+    uint32_t  chunk_count;
+    time_t    taken;
+} ata_snapshot_t;
+
+extern volatile bool_t ata_snap_active;
+
+// called before every sector range is written
+#define ATA_SNAPSHOT_SAVE(sector, count) do { if (ata_snap_active) { ata_snapshot_save(sector, count); } } while (0)
+
 void ata_init();
 void ata_load_file(const char* filename);
+bool_t ata_open_file(const char* filename, uint8_t backend);
 void ata_save_file(const char* filename);
 void ata_create(uint64_t size);
+bool_t ata_resize(uint64_t size);
 void ata_unload();
 
 void ata_read(uint64_t sector, uint32_t count, uint8_t* buffer);
 void ata_write(uint64_t sector, uint32_t count, uint8_t* buffer);
 void ata_fill(uint64_t sector, uint32_t count, uint8_t value);
 void ata_filldata(uint64_t sector, uint32_t count, uint8_t* data);
+bool_t ata_copy_in(uint64_t sector, uint64_t bytes, int fd, uint64_t offset);
+bool_t ata_copy_out(uint64_t sector, uint64_t bytes, int fd, uint64_t offset);
 
 uint32_t ata_get_disk_size();
 uint8_t* ata_get_data();
+bool_t   ata_loaded();
+uint8_t  ata_get_backend();
+
+bool_t   ata_overlay_create(const char* filename, const char* base);
+bool_t   ata_overlay_attach(int fd, ata_overlay_header_t* header, int* base_fd, uint8_t** bitmap);
+void     ata_overlay_close();
+uint64_t ata_overlay_count();
+bool_t   ata_overlay_commit();
+void     ata_overlay_print();
+
+bool_t ata_snapshot_take();
+bool_t ata_snapshot_rollback();
+bool_t ata_snapshot_drop();
+void   ata_snapshot_discard();
+void   ata_snapshot_save(uint64_t sector, uint32_t count);
+void   ata_snapshot_print();
+
+ata_queue_t* ata_queue_create(uint32_t depth);
+void         ata_queue_destroy(ata_queue_t* queue);
+bool_t       ata_submit_read(ata_queue_t* queue, uint64_t sector, uint32_t count, uint8_t* buffer, uint64_t tag);
+bool_t       ata_submit_write(ata_queue_t* queue, uint64_t sector, uint32_t count, uint8_t* buffer, uint64_t tag);
+uint32_t     ata_poll(ata_queue_t* queue, ata_completion_t* completions, uint32_t max, bool_t wait);
+uint32_t     ata_pending(ata_queue_t* queue);
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+#define BENCH_RESULTS_MAX 64
+#define BENCH_DISK_SIZE   (128 * 1024 * 1024)
+
+// files per directory while filling tables, and largest file written by the scaling mix
+#define BENCH_SCALE_PER_DIR 128
+#define BENCH_SCALE_SECTORS 4
+
+typedef struct
+{
+    char     name[32];
+    char     param[32];
+    uint32_t ops;
+    uint64_t total_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    double   mb_per_sec;
+} bench_result_t;
+
+// latency samples of one measurement
+typedef struct
+{
+    uint64_t* samples;
+    uint32_t  count;
+    uint32_t  max;
+    uint64_t  started;
+    uint64_t  bytes;
+} bench_timer_t;
+
+uint64_t bench_now();
+void     bench_timer_init(bench_timer_t* timer, uint32_t max);
+void     bench_begin(bench_timer_t* timer);
+void     bench_end(bench_timer_t* timer, uint64_t bytes);
+void     bench_record(const char* name, const char* param, bench_timer_t* timer);
+
+void     bench_disk();
+void     bench_attach();
+void     bench_run_all(uint32_t iterations, uint8_t backend);
+void     bench_lookup(uint32_t iterations);
+void     bench_create(uint32_t iterations);
+void     bench_alloc(uint32_t iterations);
+void     bench_sequential(uint32_t iterations);
+void     bench_list(uint32_t iterations);
+void     bench_mount(uint32_t iterations);
+bool_t   bench_run_scaling(uint32_t iterations, uint8_t backend);
+bool_t   bench_scaling(uint32_t iterations);
+void     bench_plot(const char* prefix);
+
+bool_t   bench_write_json(const char* path, uint8_t backend);
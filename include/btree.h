@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "fs.h"
+
+// on-disk index of the file table keyed by parent, name and type, kept in one block on formats with FSFLAG_BTREE
+// the block starts with a header sector followed by nodes of BTREE_NODE_SECTORS sectors each
+#define BTREE_MAGIC        0x45455254
+#define BTREE_NODE_SECTORS 8
+#define BTREE_NONE         UINT32_MAX
+
+// entries per node, (4096 - 8) / 56 - nodes other than the root stay at least half full
+// bulk loaded nodes are filled to BTREE_NODE_FILL so early inserts do not split them
+#define BTREE_NODE_MAX     73
+#define BTREE_NODE_MIN     36
+#define BTREE_NODE_FILL    54
+#define BTREE_DEPTH_MAX    8
+
+// nodes on top of a full tree of half full nodes, written before the nodes they replace are freed
+#define BTREE_SPARE        64
+
+// used node bitmap kept in the header sector, which limits the node count
+#define BTREE_MAP_BYTES    492
+#define BTREE_NODES_MAX    (BTREE_MAP_BYTES * 8)
+
+// index in leaves is the file table index of the entry, in inner nodes it is the node holding the entries from this key on
+typedef struct
+{
+    uint32_t parent;
+    char     name[FS_NAME_MAX];
+    uint8_t  type;
+    uint8_t  padding;
+    uint32_t index;
+} PACKED btree_entry_t;
+
+typedef struct
+{
+    uint16_t      count;
+    uint8_t       leaf;
+    uint8_t       padding[5];
+    btree_entry_t entries[BTREE_NODE_MAX];
+} PACKED btree_node_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t root;
+    uint32_t nodes;
+    uint32_t count;
+    uint8_t  used[BTREE_MAP_BYTES];
+    uint32_t checksum;
+} PACKED btree_header_t;
+
+// position in an ordered walk, the leaf being walked is buffered and inner nodes above it keep their child nodes
+typedef struct
+{
+    uint32_t     next;
+    bool_t       done;
+    uint32_t     depth;
+    uint32_t     counts[BTREE_DEPTH_MAX];
+    uint32_t     pos[BTREE_DEPTH_MAX];
+    uint32_t     children[BTREE_DEPTH_MAX][BTREE_NODE_MAX];
+    btree_node_t leaf;
+} btree_cursor_t;
+
+uint32_t btree_sectors(uint32_t entries);
+bool_t   btree_attach();
+bool_t   btree_open();
+void     btree_stop();
+bool_t   btree_ready();
+bool_t   btree_build(const btree_entry_t* entries, uint32_t count);
+bool_t   btree_insert(const btree_entry_t* entry);
+bool_t   btree_remove(const btree_entry_t* entry);
+void     btree_release();
+
+int      btree_compare(const btree_entry_t* a, const btree_entry_t* b);
+int      btree_find(uint32_t parent, const char* name, uint32_t len, uint8_t type);
+void     btree_cursor_seek(btree_cursor_t* cursor, uint32_t parent);
+const btree_entry_t* btree_cursor_next(btree_cursor_t* cursor);
+uint32_t btree_verify();
+void     btree_print();
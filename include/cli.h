@@ -35,12 +35,31 @@ void CMD_METHOD_FORMAT(char* input, char** argv, int argc);
 void CMD_METHOD_NEWIMG(char* input, char** argv, int argc);
 void CMD_METHOD_SAVEIMG(char* input, char** argv, int argc);
 void CMD_METHOD_LOADIMG(char* input, char** argv, int argc);
+void CMD_METHOD_OPENIMG(char* input, char** argv, int argc);
 void CMD_METHOD_UNLOADIMG(char* input, char** argv, int argc);
+void CMD_METHOD_RESIZE(char* input, char** argv, int argc);
+void CMD_METHOD_SNAPSHOT(char* input, char** argv, int argc);
+void CMD_METHOD_ROLLBACK(char* input, char** argv, int argc);
+void CMD_METHOD_OVERLAY(char* input, char** argv, int argc);
+void CMD_METHOD_FLATTEN(char* input, char** argv, int argc);
+void CMD_METHOD_DEFRAG(char* input, char** argv, int argc);
+void CMD_METHOD_COMPRESS(char* input, char** argv, int argc);
+void CMD_METHOD_DEDUP(char* input, char** argv, int argc);
+void CMD_METHOD_PACK(char* input, char** argv, int argc);
+void CMD_METHOD_INDEX(char* input, char** argv, int argc);
+void CMD_METHOD_CHECK(char* input, char** argv, int argc);
+void CMD_METHOD_LOG(char* input, char** argv, int argc);
+void CMD_METHOD_TRACE(char* input, char** argv, int argc);
+void CMD_METHOD_REPLAY(char* input, char** argv, int argc);
+void CMD_METHOD_STATS(char* input, char** argv, int argc);
+void CMD_METHOD_HEATMAP(char* input, char** argv, int argc);
 
 void CMD_METHOD_EXISTS(char* input, char** argv, int argc);
 void CMD_METHOD_MKDIR(char* input, char** argv, int argc);
 void CMD_METHOD_INFILE(char* input, char** argv, int argc);
 void CMD_METHOD_INDIR(char* input, char** argv, int argc);
+void CMD_METHOD_OUTFILE(char* input, char** argv, int argc);
+void CMD_METHOD_OUTDIR(char* input, char** argv, int argc);
 void CMD_METHOD_RM(char* input, char** argv, int argc);
 void CMD_METHOD_RMDIR(char* input, char** argv, int argc);
 void CMD_METHOD_REN(char* input, char** argv, int argc);
@@ -59,16 +78,35 @@ static const cli_cmd_t CMD_ENTRIES      = { "ENTRIES", "Show list of file/direct
 static const cli_cmd_t CMD_LS           = { "LS", "Show contents of specified directory", "dir [path]", CMD_METHOD_LS };
 static const cli_cmd_t CMD_SCRIPT       = { "SCRIPT", "Execute script file", "script [path]", CMD_METHOD_SCRIPT };
 
-static const cli_cmd_t CMD_FORMAT       = { "FORMAT", "Formatted current disk image", "format [-q : quick]", CMD_METHOD_FORMAT };
+static const cli_cmd_t CMD_FORMAT       = { "FORMAT", "Formatted current disk image", "format [-q : quick] [-b : indexed file table]", CMD_METHOD_FORMAT };
 static const cli_cmd_t CMD_NEWIMG       = { "NEWIMG", "Create a new disk image of specified size", "newimg [bytes]", CMD_METHOD_NEWIMG };
 static const cli_cmd_t CMD_SAVEIMG      = { "SAVEIMG", "Save the current disk image to specified path", "saveimg [path]", CMD_METHOD_SAVEIMG };
 static const cli_cmd_t CMD_LOADIMG      = { "LOADIMG", "Load disk image from specified path", "loadimg [path]", CMD_METHOD_LOADIMG };
+static const cli_cmd_t CMD_OPENIMG      = { "OPENIMG", "Open disk image in place without loading it", "openimg [path] [-u : io_uring]", CMD_METHOD_OPENIMG };
 static const cli_cmd_t CMD_UNLOADIMG    = { "UNLOADIMG", "Unload the current disk image", "unloadimg", CMD_METHOD_UNLOADIMG };
+static const cli_cmd_t CMD_RESIZE       = { "RESIZE", "Grow or shrink the current disk image in place", "resize [bytes]", CMD_METHOD_RESIZE };
+static const cli_cmd_t CMD_SNAPSHOT     = { "SNAPSHOT", "Take, drop or show copy-on-write snapshot of disk image", "snapshot [take/drop]", CMD_METHOD_SNAPSHOT };
+static const cli_cmd_t CMD_ROLLBACK     = { "ROLLBACK", "Discard every change since the snapshot was taken", "rollback", CMD_METHOD_ROLLBACK };
+static const cli_cmd_t CMD_OVERLAY      = { "OVERLAY", "Open new delta image over a read only base, or show the current one", "overlay [delta_path] [base_path]", CMD_METHOD_OVERLAY };
+static const cli_cmd_t CMD_FLATTEN      = { "FLATTEN", "Merge overlay into a standalone image or into its base", "flatten [path/-b : into base]", CMD_METHOD_FLATTEN };
+static const cli_cmd_t CMD_DEFRAG       = { "DEFRAG", "Compact used blocks and merge free space", "defrag [-a : analyze only]", CMD_METHOD_DEFRAG };
+static const cli_cmd_t CMD_COMPRESS     = { "COMPRESS", "Toggle compression of newly written files", "compress [on/off]", CMD_METHOD_COMPRESS };
+static const cli_cmd_t CMD_DEDUP        = { "DEDUP", "Toggle sharing of identical file contents", "dedup [on/off]", CMD_METHOD_DEDUP };
+static const cli_cmd_t CMD_PACK         = { "PACK", "Show usage of extents shared by small files", "pack", CMD_METHOD_PACK };
+static const cli_cmd_t CMD_INDEX        = { "INDEX", "Show usage of the on-disk name index", "index", CMD_METHOD_INDEX };
+static const cli_cmd_t CMD_CHECK        = { "CHECK", "Check file system consistency", "check [-r : repair] [-t threads]", CMD_METHOD_CHECK };
+static const cli_cmd_t CMD_LOG          = { "LOG", "Set level and categories of file system messages", "log [error/warn/info/debug/trace] [alloc,table,path,io/all]", CMD_METHOD_LOG };
+static const cli_cmd_t CMD_TRACE        = { "TRACE", "Record file system operations to a binary trace", "trace [start path/stop]", CMD_METHOD_TRACE };
+static const cli_cmd_t CMD_REPLAY       = { "REPLAY", "Replay a recorded trace and show operation latencies", "replay [path] [-p : original pacing]", CMD_METHOD_REPLAY };
+static const cli_cmd_t CMD_STATS        = { "STATS", "Show operation counters and latency histograms", "stats [reset/json path] [-x : write json on exit]", CMD_METHOD_STATS };
+static const cli_cmd_t CMD_HEATMAP      = { "HEATMAP", "Show sector access counts by region and category", "heatmap [start/stop/reset]", CMD_METHOD_HEATMAP };
 
 static const cli_cmd_t CMD_EXISTS       = { "EXISTS", "Check if file or directory exists", "exists [path]", CMD_METHOD_EXISTS };
 static const cli_cmd_t CMD_MKDIR        = { "MKDIR", "Create a new directory", "mkdir [path]", CMD_METHOD_MKDIR };
 static const cli_cmd_t CMD_INFILE       = { "INFILE", "Copy file from host to specified path", "infile [dest_path] [src_path]", CMD_METHOD_INFILE };
 static const cli_cmd_t CMD_INDIR        = { "INDIR", "Copy directory and contents to specified path", "infile [dest_path] [src_path]", CMD_METHOD_INDIR };
+static const cli_cmd_t CMD_OUTFILE      = { "OUTFILE", "Copy file from disk to specified host path", "outfile [host_path] [src_path]", CMD_METHOD_OUTFILE };
+static const cli_cmd_t CMD_OUTDIR       = { "OUTDIR", "Copy directory tree from disk to specified host path", "outdir [host_path] [src_path] [-t threads]", CMD_METHOD_OUTDIR };
 static const cli_cmd_t CMD_RM           = { "RM", "Remove specified file", "rm [path]", CMD_METHOD_RM };
 static const cli_cmd_t CMD_RMDIR        = { "RMDIR", "Remove a specified directory", "rmdir [path]", CMD_METHOD_RMDIR };
 static const cli_cmd_t CMD_REN          = { "REN", "Rename a specified file", "ren [path] [name]", CMD_METHOD_REN };
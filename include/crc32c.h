@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+// castagnoli polynomial, reflected
+#define CRC32C_POLY 0x82F63B78
+
+void     crc32c_init();
+bool_t   crc32c_hardware();
+uint32_t crc32c(uint32_t crc, const uint8_t* data, uint32_t len);
+uint32_t crc32c_zeros(uint32_t crc, uint32_t len);
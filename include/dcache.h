@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "fs.h"
+
+// slots of the cache, lock stripes and longest path kept - longer paths are always walked
+#define DCACHE_SLOTS    2048
+#define DCACHE_STRIPES  64
+#define DCACHE_PATH_MAX 192
+
+// result of resolving a path as type, components are joined by '/' without a leading one and index is -1 for a missing path
+typedef struct
+{
+    uint32_t hash;
+    int32_t  index;
+    uint8_t  type;
+    bool_t   used;
+    uint16_t len;
+    char     path[DCACHE_PATH_MAX];
+} dcache_entry_t;
+
+uint32_t dcache_generation();
+bool_t   dcache_lookup(const fs_path_t* path, uint32_t depth, uint8_t type, int* index);
+void     dcache_insert(const fs_path_t* path, uint32_t depth, uint8_t type, int index, uint32_t generation);
+void     dcache_invalidate(fs_directory_t entry);
+void     dcache_clear();
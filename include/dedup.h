@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+// content index over used block entries, chained by block index
+#define DEDUP_BUCKETS 8192
+
+void     dedup_set_enabled(bool_t enabled);
+bool_t   dedup_get_enabled();
+void     dedup_clear();
+void     dedup_build();
+uint64_t dedup_hash(const uint8_t* data, uint32_t len, uint32_t sectors);
+int      dedup_find(uint64_t hash, const uint8_t* data, uint32_t len, uint32_t sectors);
+void     dedup_insert(uint64_t hash, int index);
+void     dedup_remove(int index);
+void     dedup_print();
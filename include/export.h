@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+#define EXPORT_THREADS_MAX 64
+
+typedef struct
+{
+    char*    host;
+    char*    path;
+    uint8_t  type;
+    uint32_t depth;
+} export_job_t;
+
+// jobs are taken in order by all workers, directories of one depth form a batch so parents exist before children
+typedef struct
+{
+    export_job_t* jobs;
+    uint32_t      start;
+    uint32_t      end;
+    uint32_t      next;
+    uint32_t      failed;
+    uint64_t      bytes;
+} export_batch_t;
+
+bool_t export_file(const char* host, const char* path, uint64_t* bytes);
+bool_t export_dir(const char* host, const char* path, int threads);
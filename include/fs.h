@@ -8,12 +8,40 @@
 #define FS_SECTOR_INFO  1
 #define FS_SECTOR_BLKS  4
 
+#define FS_COPY_CHUNK   128
+
+#define FS_BLK_COUNT_MAX  16384
+#define FS_FILE_COUNT_MAX 32768
+
+#define FSFLAG_CHECKSUMS 0x01
+#define FSFLAG_BTREE     0x02
+
 #define FSSTATE_FREE 0
 #define FSSTATE_USED 1
+#define FSSTATE_PACK 2
+#define FSSTATE_INDEX 3
+
+#define FSSTATUS_COMPRESSED 0x01
+#define FSSTATUS_INLINE     0x02
+#define FSSTATUS_PACKED     0x04
+
+#define FS_COMPRESS_MIN     1024
+
+#define FS_NAME_MAX 46
+
+// deepest path that can be resolved
+#define FS_PATH_DEPTH_MAX 64
 
 #define FSTYPE_NULL 0
 #define FSTYPE_DIR  1
 #define FSTYPE_FILE 2
+#define FSTYPE_EXT  3
+
+// largest file kept in the file table instead of a block, its contents fill one extension record
+#define FS_INLINE_MAX 58
+
+// largest file stored as a tail in a pack extent shared with other small files, see pack.h
+#define FS_PACK_MAX   2048
 
 typedef struct
 {
@@ -30,6 +58,10 @@ typedef struct
     uint32_t file_table_count;
     uint32_t file_table_count_max;
     uint32_t file_table_sector_count;
+    uint32_t flags;
+    uint32_t crc_start;
+    uint32_t crc_sector_count;
+    uint32_t checksum;
 } PACKED fs_info_t;
 
 typedef struct
@@ -37,12 +69,13 @@ typedef struct
     uint32_t start;
     uint32_t count;
     uint16_t state;
-    uint8_t  padding[6];
+    uint16_t refs;
+    uint32_t crc;
 } PACKED fs_blkentry_t;
 
 typedef struct
 {
-    char     name[46];
+    char     name[FS_NAME_MAX];
     uint32_t parent_index;
     uint8_t  status;
     uint8_t  type;
@@ -51,7 +84,7 @@ typedef struct
 
 typedef struct
 {
-    char     name[46];
+    char     name[FS_NAME_MAX];
     uint32_t parent_index;
     uint8_t  status;
     uint8_t  type;
@@ -60,14 +93,61 @@ typedef struct
     uint8_t* data;
 } PACKED fs_file_t;
 
+// extension record holding the contents of an inline file, referenced by the file's blk_index
+// contents are split around parent and type so table scans see it like any other entry, parent is always UINT32_MAX
+typedef struct
+{
+    uint8_t  data[FS_NAME_MAX];
+    uint32_t parent_index;
+    uint8_t  status;
+    uint8_t  type;
+    uint8_t  tail[FS_INLINE_MAX - FS_NAME_MAX];
+} PACKED fs_inline_t;
+
+typedef struct
+{
+    uint32_t used_extents;
+    uint32_t used_sectors;
+    uint32_t free_extents;
+    uint32_t free_sectors;
+    uint32_t largest_free;
+    uint32_t mass_sectors;
+} fs_fraginfo_t;
+
+// component of a path, points into the string it was parsed from and is not terminated
+typedef struct
+{
+    const char* str;
+    uint32_t    len;
+} fs_span_t;
+
+// path split once into its components without copying, root has none
+typedef struct
+{
+    const char* str;
+    uint32_t    count;
+    fs_span_t   parts[FS_PATH_DEPTH_MAX];
+} fs_path_t;
+
 void fs_mount();
-void fs_format(uint32_t size, bool_t wipe);
+void fs_format(uint32_t size, bool_t wipe, uint32_t flags);
 void fs_wipe(uint32_t size);
+bool_t fs_resize(uint32_t size);
+bool_t fs_resize_exclusive(uint32_t size);
+bool_t fs_defrag(bool_t analyze);
+bool_t fs_defrag_exclusive(bool_t analyze);
 
 void fs_info_create(uint32_t size);
 void fs_info_read();
 void fs_info_write();
+bool_t fs_verify();
+void fs_crc_rebuild();
+uint32_t fs_crc_blk(fs_blkentry_t blk);
+void fs_table_read(uint32_t sector, uint32_t count, uint8_t* data);
+void fs_table_write(uint32_t sector, uint32_t count, uint8_t* data);
+void fs_table_checksum(uint32_t sector, uint32_t count, uint8_t* data);
 fs_info_t fs_get_info();
+void fs_set_info(fs_info_t info);
 
 // block table
 void            fs_blktable_print();
@@ -79,6 +159,7 @@ fs_blkentry_t   fs_blktable_allocate(uint32_t sectors);
 bool_t          fs_blktable_free(fs_blkentry_t entry);
 fs_blkentry_t   fs_blktable_nearest(fs_blkentry_t entry);
 void            fs_blktable_merge_free();
+uint32_t        fs_blktable_chunk(fs_blkentry_t blk, uint32_t chunk);
 bool_t          fs_blktable_copy(fs_blkentry_t dest, fs_blkentry_t src);
 fs_blkentry_t   fs_blktable_create_entry(uint32_t start, uint32_t count, uint8_t state);
 bool_t          fs_blktable_delete_entry(fs_blkentry_t entry);
@@ -87,10 +168,18 @@ fs_blkentry_t   fs_blktable_at_index(int index);
 bool_t          fs_blktable_validate_sector(uint32_t sector);
 int             fs_blktable_get_index(fs_blkentry_t entry);
 int             fs_blktable_freeindex();
+fs_blkentry_t*  fs_blktable_load();
+fs_blkentry_t*  fs_blktable_compact(fs_blkentry_t* table, uint32_t* moved);
+void            fs_blktable_store(fs_blkentry_t* table);
+void            fs_blktable_addref(int index);
+bool_t          fs_blktable_release(int index);
+void            fs_blktable_relocate(fs_blkentry_t* table, int index, uint32_t start);
+fs_fraginfo_t   fs_blktable_fraginfo(fs_blkentry_t* table);
+void            fs_fraginfo_print(const char* label, fs_fraginfo_t info);
 
 uint32_t        fs_bytes_to_sectors(uint32_t bytes);
 
-// file table
+// file table - lookups go through the name index and take no lock, changes need the path lock, see fslock.h
 bool_t          fs_root_create(const char* label);
 void            fs_filetable_print();
 uint32_t        fs_filetable_sector_from_index(int index);
@@ -99,14 +188,25 @@ fs_directory_t  fs_filetable_read_dir(int index);
 fs_file_t       fs_filetable_read_file(int index);
 void            fs_filetable_write_dir(int index, fs_directory_t dir);
 void            fs_filetable_write_file(int index, fs_file_t file);
+void            fs_filetable_reindex(int index, fs_directory_t old, fs_directory_t entry);
 fs_directory_t  fs_filetable_create_dir(fs_directory_t dir);
 fs_file_t       fs_filetable_create_file(fs_file_t file);
 bool_t          fs_filetable_delete_dir(fs_directory_t dir);
 bool_t          fs_filetable_delete_file(fs_file_t file);
 bool_t          fs_filetable_validate_sector(uint32_t sector);
 int             fs_filetable_freeindex();
+int             fs_filetable_create_inline(const uint8_t* data, uint32_t len);
+bool_t          fs_filetable_read_inline(int index, uint8_t* data, uint32_t len);
+void            fs_filetable_write_inline(int index, const uint8_t* data, uint32_t len);
+bool_t          fs_filetable_delete_inline(int index);
 bool_t          fs_dir_equals(fs_directory_t a, fs_directory_t b);
 bool_t          fs_file_equals(fs_file_t a, fs_file_t b);
+bool_t          fs_path_parse(const char* path, fs_path_t* out);
+void            fs_path_name(const fs_path_t* path, char* name);
+char*           fs_path_dirname(const fs_path_t* path);
+fs_directory_t  fs_path_parent(const fs_path_t* path, int* index);
+fs_file_t       fs_path_file(const fs_path_t* path, int* index);
+fs_directory_t  fs_path_dir(const fs_path_t* path, int* index);
 fs_directory_t  fs_parent_from_path(const char* path);
 fs_file_t       fs_get_file_byname(const char* path);
 fs_directory_t  fs_get_dir_byname(const char* path);
@@ -114,6 +214,18 @@ int             fs_get_file_index(fs_file_t file);
 int             fs_get_dir_index(fs_directory_t dir);
 char*           fs_get_name_from_path(const char* path);
 char*           fs_get_parent_path_from_path(const char* path);
+fs_file_t       fs_file_create_entry(const fs_path_t* path, uint32_t size, int blk_index, uint8_t status);
+fs_file_t       fs_file_create_blk(const fs_path_t* path, uint32_t size, uint32_t sectors, uint8_t status);
+fs_file_t       fs_file_create_inline(const fs_path_t* path, const uint8_t* data, uint32_t len);
+fs_file_t       fs_file_create_packed(const fs_path_t* path, const uint8_t* data, uint32_t len);
 fs_file_t       fs_file_create(const char* path, uint32_t size);
+bool_t          fs_file_release(fs_file_t file);
+void            fs_set_compression(bool_t enabled);
+bool_t          fs_get_compression();
+uint8_t*        fs_file_compress(uint8_t* data, uint32_t len, uint32_t* out_len);
+void            fs_file_write_blk(int index, uint8_t* data, uint32_t len, int fd);
 fs_file_t       fs_file_read(const char* path);
-bool_t          fs_file_write(const char* path, uint8_t* data, uint32_t len);
\ No newline at end of file
+bool_t          fs_file_write(const char* path, uint8_t* data, uint32_t len);
+bool_t          fs_file_write_fd(const char* path, uint8_t* data, uint32_t len, int fd);
+bool_t          fs_file_import(const char* path, int fd);
+bool_t          fs_file_export(const char* path, int fd);
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+#define FSCK_THREADS_MAX 64
+
+typedef struct
+{
+    uint32_t bad_extents;
+    uint32_t overlaps;
+    uint32_t dangling_blk;
+    uint32_t dangling_parent;
+    uint32_t orphans;
+    uint32_t leaked_blocks;
+    uint32_t bad_refs;
+    uint32_t bad_counts;
+    uint32_t bad_table_crc;
+    uint32_t bad_data_crc;
+    uint32_t bad_index;
+} fsck_result_t;
+
+uint32_t fsck_errors(fsck_result_t result);
+void     fsck_print(fsck_result_t result);
+fsck_result_t fsck_run(bool_t repair, int threads);
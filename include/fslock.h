@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+// number of lock stripes for table sectors and file names
+#define FSLOCK_STRIPES 64
+
+// atomic updates of shared counters
+#define FSLOCK_INC(x) __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define FSLOCK_DEC(x) __atomic_sub_fetch(&(x), 1, __ATOMIC_RELAXED)
+
+// lock order: path -> file -> alloc -> sector -> meta
+
+void fslock_path_read();
+void fslock_path_write();
+void fslock_path_unlock();
+
+void     fslock_file_read(uint32_t key);
+void     fslock_file_write(uint32_t key);
+void     fslock_file_unlock(uint32_t key);
+uint32_t fslock_file_key(const char* path);
+void     fslock_file_write_all();
+void     fslock_file_unlock_all();
+
+void fslock_alloc();
+void fslock_alloc_unlock();
+
+void fslock_sector_read(uint32_t sector);
+void fslock_sector_write(uint32_t sector);
+void fslock_sector_unlock(uint32_t sector);
+
+void fslock_meta();
+void fslock_meta_unlock();
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "fs.h"
+
+// sector categories of the disk layout
+#define HEATMAP_CAT_INFO      0
+#define HEATMAP_CAT_BLKTABLE  1
+#define HEATMAP_CAT_CRC       2
+#define HEATMAP_CAT_FILETABLE 3
+#define HEATMAP_CAT_DATA      4
+#define HEATMAP_CAT_COUNT     5
+
+// columns of the printed map and hottest sectors listed
+#define HEATMAP_COLUMNS 64
+#define HEATMAP_TOP     10
+
+// accesses of one category in one direction, an access continuing where the previous one ended is sequential
+typedef struct
+{
+    uint64_t accesses;
+    uint64_t sectors;
+    uint64_t sequential;
+} heatmap_cat_t;
+
+extern volatile bool_t heatmap_active;
+
+// called for every sector range read or written while the tracer runs
+#define HEATMAP(write, sector, count) do { if (heatmap_active) { heatmap_record(write, sector, count); } } while (0)
+
+bool_t heatmap_start(fs_info_t info);
+void   heatmap_stop();
+void   heatmap_reset();
+void   heatmap_record(bool_t write, uint64_t sector, uint32_t count);
+void   heatmap_print();
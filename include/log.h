@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+// levels
+#define LOG_ERROR 0
+#define LOG_WARN  1
+#define LOG_INFO  2
+#define LOG_DEBUG 3
+#define LOG_TRACE 4
+
+// categories
+#define LOGCAT_ALLOC 0x01
+#define LOGCAT_TABLE 0x02
+#define LOGCAT_PATH  0x04
+#define LOGCAT_IO    0x08
+#define LOGCAT_ALL   0x0F
+
+// messages above this level are removed at compile time, build with -DLOG_LEVEL_MAX=LOG_INFO to strip per operation output
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_TRACE
+#endif
+
+extern uint8_t  log_level;
+extern uint32_t log_categories;
+
+// arguments are only evaluated and formatted when the message is enabled
+#define LOG(level, cat, ...) do { if ((level) <= LOG_LEVEL_MAX && (level) <= log_level && (log_categories & (cat))) { log_write(level, cat, __VA_ARGS__); } } while (0)
+
+void        log_write(uint8_t level, uint32_t cat, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+void        log_set_level(uint8_t level);
+void        log_set_categories(uint32_t categories);
+int         log_parse_level(const char* str);
+int         log_parse_categories(const char* str);
+const char* log_level_name(uint8_t level);
+void        log_print();
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+// byte oriented LZ77 codec - sequences of [token][literal length][literals][offset][match length]
+#define LZ_MIN_MATCH   4
+#define LZ_HASH_BITS   12
+#define LZ_MAX_OFFSET  65535
+
+uint32_t lz_bound(uint32_t len);
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap);
+uint32_t lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t out_len);
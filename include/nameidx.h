@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "fs.h"
+#include "btree.h"
+
+// reader counters are striped so concurrent lookups do not share a cache line
+#define NAMEIDX_STRIPES 16
+
+// entries per tree node, a directory with up to NAMEIDX_NODE_MAX children is a single leaf
+// nodes below NAMEIDX_NODE_MIN are merged with a neighbour and bulk loaded leaves are filled to NAMEIDX_NODE_FILL
+#define NAMEIDX_NODE_MAX  64
+#define NAMEIDX_NODE_MIN  16
+#define NAMEIDX_NODE_FILL 48
+#define NAMEIDX_DEPTH_MAX 16
+
+typedef struct
+{
+    char     name[FS_NAME_MAX];
+    uint8_t  type;
+    uint32_t index;
+} nameidx_entry_t;
+
+// immutable node of a directory's B+tree, entries are sorted by name and type
+// leaves hold the children, inner nodes hold the lowest entry below each of their nodes
+typedef struct nameidx_node
+{
+    bool_t                leaf;
+    uint32_t              count;
+    uint32_t              total;
+    struct nameidx_node** children;
+    nameidx_entry_t       entries[];
+} nameidx_node_t;
+
+// tree root of every directory, slots of non-directories are NULL
+typedef struct
+{
+    uint32_t         count;
+    nameidx_node_t** roots;
+} nameidx_table_t;
+
+// position in a sorted walk over a directory's children, walks the on-disk index when it is in use
+typedef struct
+{
+    uint32_t              depth;
+    const nameidx_node_t* nodes[NAMEIDX_DEPTH_MAX];
+    uint32_t              pos[NAMEIDX_DEPTH_MAX];
+    bool_t                disk;
+    uint32_t              dir;
+    nameidx_entry_t       entry;
+    btree_cursor_t        btree;
+} nameidx_cursor_t;
+
+void     nameidx_build();
+void     nameidx_open();
+void     nameidx_clear();
+bool_t   nameidx_ready();
+void     nameidx_update(uint32_t index, fs_directory_t old, fs_directory_t entry);
+
+uint32_t nameidx_read_begin();
+void     nameidx_read_end(uint32_t epoch);
+void     nameidx_synchronize();
+
+void     nameidx_cursor_begin(nameidx_cursor_t* cursor, uint32_t dir);
+const nameidx_entry_t* nameidx_cursor_next(nameidx_cursor_t* cursor);
+int      nameidx_find(uint32_t parent, const char* name, uint8_t type);
+int      nameidx_resolve(const char* path, uint8_t type);
+int      nameidx_resolve_parent(const char* path);
+int      nameidx_resolve_path(const fs_path_t* path, uint8_t type);
+int      nameidx_resolve_path_parent(const fs_path_t* path);
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+// sectors of a shared pack extent and the unit tails inside it are allocated in
+#define PACK_SECTORS 16
+#define PACK_UNIT    32
+
+// blk_index of a packed file, block index of the pack extent below and byte offset of the tail above
+#define PACK_REF(index, offset) (((uint32_t)(offset) << 16) | (uint32_t)(index))
+#define PACK_INDEX(ref)         ((ref) & 0xFFFF)
+#define PACK_OFFSET(ref)        ((ref) >> 16)
+
+void   pack_clear();
+void   pack_build();
+int    pack_store(const uint8_t* data, uint32_t len);
+bool_t pack_load(uint32_t ref, uint32_t len, uint8_t* data);
+bool_t pack_release(uint32_t ref, uint32_t len);
+void   pack_print();
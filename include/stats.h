@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+// counters
+#define STAT_BYTES_READ       0
+#define STAT_BYTES_WRITTEN    1
+#define STAT_SECTORS_READ     2
+#define STAT_SECTORS_WRITTEN  3
+#define STAT_TABLE_SCANNED    4
+#define STAT_INDEX_HITS       5
+#define STAT_INDEX_MISSES     6
+#define STAT_ALLOCS           7
+#define STAT_ALLOC_SECTORS    8
+#define STAT_FREES            9
+#define STAT_DCACHE_HITS      10
+#define STAT_DCACHE_MISSES    11
+#define STAT_COUNT            12
+
+// timed operations
+#define STATS_OP_DIR_EXISTS   0
+#define STATS_OP_FILE_EXISTS  1
+#define STATS_OP_DIR_INFO     2
+#define STATS_OP_FILE_INFO    3
+#define STATS_OP_COUNT_DIRS   4
+#define STATS_OP_COUNT_FILES  5
+#define STATS_OP_GET_DIRS     6
+#define STATS_OP_GET_FILES    7
+#define STATS_OP_READ         8
+#define STATS_OP_WRITE        9
+#define STATS_OP_CREATE_DIR   10
+#define STATS_OP_RENAME_DIR   11
+#define STATS_OP_RENAME_FILE  12
+#define STATS_OP_DELETE_DIR   13
+#define STATS_OP_DELETE_FILE  14
+#define STATS_OP_COPY_DIR     15
+#define STATS_OP_COPY_FILE    16
+#define STATS_OP_FS_READ      17
+#define STATS_OP_FS_WRITE     18
+#define STATS_OP_FS_ALLOC     19
+#define STATS_OP_FS_FREE      20
+#define STATS_OP_ATA_READ     21
+#define STATS_OP_ATA_WRITE    22
+#define STATS_OP_COUNT        23
+
+// latency buckets are powers of two in nanoseconds, the last one collects everything slower
+#define STATS_BUCKETS 40
+
+// build with -DSTATS_ENABLED=0 to remove all counting
+#ifndef STATS_ENABLED
+#define STATS_ENABLED 1
+#endif
+
+typedef struct
+{
+    uint8_t  op;
+    uint64_t started;
+} stats_scope_t;
+
+#if STATS_ENABLED
+#define STAT_ADD(stat, n) stats_add(stat, n)
+// times the rest of the enclosing block as one call of op, including early returns
+#define STATS_SCOPE(op) stats_scope_t stats_scope __attribute__((cleanup(stats_scope_end))) = stats_scope_begin(op)
+#else
+#define STAT_ADD(stat, n) do { } while (0)
+#define STATS_SCOPE(op) do { } while (0)
+#endif
+
+uint64_t      stats_now();
+void          stats_add(uint8_t stat, uint64_t n);
+stats_scope_t stats_scope_begin(uint8_t op);
+void          stats_scope_end(stats_scope_t* scope);
+void          stats_reset();
+void          stats_print();
+bool_t        stats_write_json(const char* path);
+void          stats_write_on_exit(const char* path);
+const char*   stats_name(uint8_t stat);
+const char*   stats_op_name(uint8_t op);
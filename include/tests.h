@@ -12,4 +12,16 @@ void fstest_files_delete();
 
 void fstest_files_rename();
 
-void fstest_dirs_rename();
\ No newline at end of file
+void fstest_dirs_rename();
+
+void fstest_files_compress();
+void fstest_files_inline();
+void fstest_files_pack();
+
+void fstest_resize();
+void fstest_defrag();
+void fstest_dedup();
+void fstest_checksums();
+void fstest_snapshot();
+void fstest_overlay();
+void fstest_index();
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+
+#define TRACE_MAGIC   0x54594F56
+#define TRACE_VERSION 1
+
+// recorded vfs operations
+#define TRACE_OP_DIR_EXISTS  0
+#define TRACE_OP_FILE_EXISTS 1
+#define TRACE_OP_DIR_INFO    2
+#define TRACE_OP_FILE_INFO   3
+#define TRACE_OP_COUNT_DIRS  4
+#define TRACE_OP_COUNT_FILES 5
+#define TRACE_OP_GET_DIRS    6
+#define TRACE_OP_GET_FILES   7
+#define TRACE_OP_READ        8
+#define TRACE_OP_WRITE       9
+#define TRACE_OP_CREATE_DIR  10
+#define TRACE_OP_RENAME_DIR  11
+#define TRACE_OP_RENAME_FILE 12
+#define TRACE_OP_DELETE_DIR  13
+#define TRACE_OP_DELETE_FILE 14
+#define TRACE_OP_COPY_DIR    15
+#define TRACE_OP_COPY_FILE   16
+#define TRACE_OP_COUNT       17
+
+#define TRACE_FLAG_RECURSIVE 0x01
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t started;
+} PACKED trace_header_t;
+
+// followed by path_len bytes of path and arg_len bytes of second path or name, neither terminated
+typedef struct
+{
+    uint32_t delta_us;
+    uint8_t  op;
+    uint8_t  flags;
+    uint16_t path_len;
+    uint16_t arg_len;
+    uint32_t size;
+} PACKED trace_record_t;
+
+extern volatile bool_t trace_active;
+
+// arguments are only evaluated while a trace is being recorded
+#define TRACE(op, flags, path, arg, size) do { if (trace_active) { trace_record(op, flags, path, arg, size); } } while (0)
+
+bool_t      trace_start(const char* filename);
+bool_t      trace_stop();
+void        trace_record(uint8_t op, uint8_t flags, const char* path, const char* arg, uint32_t size);
+bool_t      trace_replay(const char* filename, bool_t paced);
+const char* trace_op_name(uint8_t op);
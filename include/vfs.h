@@ -29,6 +29,10 @@ typedef struct
     uint8_t*    data;
 } PACKED vfs_file_t;
 
+// returned when entry does not exist, its strings are not allocated
+extern vfs_directory_t VFS_NULL_DIR;
+extern vfs_file_t      VFS_NULL_FILE;
+
 bool_t          vfs_dir_exists(const char* path);
 bool_t          vfs_file_exists(const char* path);
 vfs_directory_t vfs_dir_info(const char* path);
@@ -37,12 +41,15 @@ uint32_t        vfs_count_dirs(const char* path);
 uint32_t        vfs_count_files(const char* path);
 char**          vfs_get_dirs(const char* path, int* count);
 char**          vfs_get_files(const char* path, int* count);
+uint32_t        vfs_count_type(const char* path, uint8_t type);
+char**          vfs_get_type(const char* path, uint8_t type, int* count);
 char**          vfs_read_lines(const char* path);
 char*           vfs_read_text(const char* path);
 uint8_t*        vfs_read_bytes(const char* path);
 bool_t          vfs_write_lines(const char* path, char** lines, int line_count);
 bool_t          vfs_write_text(const char* path, char* text);
 bool_t          vfs_write_bytes(const char* path, uint8_t* data, uint32_t size);
+bool_t          vfs_import_file(const char* path, int fd);
 bool_t          vfs_create_dir(const char* path);
 bool_t          vfs_rename_dir(const char* path, const char* name);
 bool_t          vfs_rename_file(const char* path, const char* name);
@@ -1,20 +1,58 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "ata.h"
+#include "stats.h"
+#include "heatmap.h"
 
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define ATA_HAVE_URING 1
+#endif
+
+// sector reads and writes are plain copies and may run on any thread, loading and resizing replace the buffer and need exclusive access
+// images opened with ata_open_file stay on the host file, reads and writes become positioned syscalls
 uint8_t* ata_data;
 uint64_t ata_size;
 char*    ata_filename;
+int      ata_fd;
+uint8_t  ata_backend;
+
+// overlay images keep changed sectors in the delta file opened as ata_fd and read every other sector from the base
+int                  ata_base_fd = -1;
+uint8_t*             ata_bitmap  = NULL;
+ata_overlay_header_t ata_overlay;
+pthread_mutex_t      ata_bitmap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// original contents of sectors written since the snapshot was taken
+volatile bool_t ata_snap_active = FALSE;
+ata_snapshot_t  ata_snap;
+pthread_mutex_t ata_snap_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void ata_init()
 {
     ata_data     = NULL;
     ata_size     = 0;
     ata_filename = NULL;
+    ata_fd       = -1;
+    ata_base_fd  = -1;
+    ata_backend  = ATA_BACKEND_SYNC;
     printf("Initialized ATA controller\n");
 }
 
 void ata_unload()
 {
+    ata_snapshot_discard();
+    ata_overlay_close();
     if (ata_data != NULL) { free(ata_data); ata_data = NULL; }
+    if (ata_fd >= 0) { close(ata_fd); ata_fd = -1; }
     ata_size = 0;
     printf("Unloaded disk image '%s'\n", ata_filename);
     if (ata_filename != NULL) { free(ata_filename); ata_filename = NULL; }
@@ -29,6 +67,9 @@ void ata_load_file(const char* filename)
     fseek(fileptr, 0, SEEK_SET);
     if (size == 0) { printf("Unable to locate disk image '%s'\n", filename); return; }
 
+    ata_snapshot_discard();
+    ata_overlay_close();
+    if (ata_fd >= 0) { close(ata_fd); ata_fd = -1; }
     if (ata_data != NULL) { free(ata_data); }    
     ata_data = malloc(size);
     ata_size = size;
@@ -42,22 +83,102 @@ void ata_load_file(const char* filename)
     printf("Loaded disk image '%s'\n", ata_filename);
 }
 
+// open disk image in place, sectors are read and written on demand instead of loading the whole image
+bool_t ata_open_file(const char* filename, uint8_t backend)
+{
+    int fd = open(filename, O_RDWR);
+    if (fd < 0) { printf("Unable to locate disk image '%s'\n", filename); return FALSE; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); printf("Unable to locate disk image '%s'\n", filename); return FALSE; }
+
+    // delta files are recognized by their header, the base is opened before the current image is let go
+    ata_overlay_header_t header;
+    int      base_fd = -1;
+    uint8_t* bitmap  = NULL;
+    bool_t   overlay = pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == ATA_OVERLAY_MAGIC;
+    if (overlay && !ata_overlay_attach(fd, &header, &base_fd, &bitmap)) { close(fd); return FALSE; }
+
+    ata_snapshot_discard();
+    ata_overlay_close();
+    if (ata_data != NULL) { free(ata_data); ata_data = NULL; }
+    if (ata_fd >= 0) { close(ata_fd); }
+    ata_fd   = fd;
+    ata_size = st.st_size;
+    if (overlay)
+    {
+        ata_overlay = header;
+        ata_base_fd = base_fd;
+        ata_bitmap  = bitmap;
+        ata_size    = header.size;
+        printf("Opened overlay '%s' on base image '%s', %llu sectors changed\n", filename, header.base, (unsigned long long)ata_overlay_count());
+    }
+
+    if (ata_filename != NULL) { free(ata_filename); }
+    ata_filename = malloc(strlen(filename) + 1);
+    strcpy(ata_filename, filename);
+
+    ata_backend = backend == ATA_BACKEND_URING ? ATA_BACKEND_URING : ATA_BACKEND_SYNC;
+    if (overlay) { ata_backend = ATA_BACKEND_OVERLAY; }
+    if (ata_backend == ATA_BACKEND_URING)
+    {
+        // probe once so an unsupported kernel falls back before the first copy
+        ata_queue_t* queue = ata_queue_create(1);
+        if (queue->ring_fd < 0) { ata_backend = ATA_BACKEND_SYNC; printf("io_uring is not available, using synchronous I/O\n"); }
+        ata_queue_destroy(queue);
+    }
+    if (!overlay) { printf("Opened disk image '%s' in place, backend = %s\n", ata_filename, ata_backend == ATA_BACKEND_URING ? "io_uring" : "sync"); }
+    return TRUE;
+}
+
 void ata_save_file(const char* filename)
 {
-    if (ata_data == NULL) { printf("No disk image loaded\n"); return; }
+    if (!ata_loaded()) { printf("No disk image loaded\n"); return; }
+
+    // images opened in place only need flushing when saved over themselves
+    if (ata_fd >= 0 && ata_filename != NULL && !strcmp(filename, ata_filename))
+    {
+        fsync(ata_fd);
+        printf("Saved disk image '%s'\n", filename);
+        return;
+    }
+
     FILE* fileptr = fopen(filename, "wb");
     if (fileptr == NULL) { printf("Unable to save disk image '%s'\n", filename); return; }
 
-    fwrite(ata_data, ata_size, 1, fileptr);
+    if (ata_fd < 0) { fwrite(ata_data, ata_size, 1, fileptr); }
+    else
+    {
+        uint64_t sectors = ata_size / ATA_SECTOR_SIZE;
+        uint8_t* data = malloc(ATA_COPY_CHUNK * ATA_SECTOR_SIZE);
+        for (uint64_t sec = 0; sec < sectors; sec += ATA_COPY_CHUNK)
+        {
+            uint32_t count = (sectors - sec > ATA_COPY_CHUNK) ? ATA_COPY_CHUNK : (uint32_t)(sectors - sec);
+            ata_read(sec, count, data);
+            fwrite(data, (size_t)count * ATA_SECTOR_SIZE, 1, fileptr);
+        }
+        free(data);
+    }
     if (ata_filename != NULL) { free(ata_filename); }
     ata_filename = malloc(strlen(filename) + 1);
     strcpy(ata_filename, filename);
     fclose(fileptr);
+
+    // an image opened in place continues on the saved copy, for an overlay that copy is the flattened image
+    if (ata_fd >= 0)
+    {
+        ata_overlay_close();
+        close(ata_fd);
+        ata_fd = open(filename, O_RDWR);
+        if (ata_fd < 0) { printf("Unable to reopen disk image '%s'\n", filename); ata_size = 0; }
+    }
     printf("Saved disk image '%s'\n", filename);
 }
 
 void ata_create(uint64_t size)
 {
+    ata_snapshot_discard();
+    ata_overlay_close();
+    if (ata_fd >= 0) { close(ata_fd); ata_fd = -1; }
     ata_size     = size;
     ata_data     = malloc(size);
     ata_filename = NULL;
@@ -66,19 +187,121 @@ void ata_create(uint64_t size)
     printf("Created disk of size %lld MB\n", size / 1024 / 1024);
 }
 
+bool_t ata_resize(uint64_t size)
+{
+    if (!ata_loaded()) { printf("No disk image loaded\n"); return FALSE; }
+    if (ata_snap_active) { printf("Unable to resize disk while a snapshot is active\n"); return FALSE; }
+    if (ata_backend == ATA_BACKEND_OVERLAY) { printf("Unable to resize an overlay image, flatten it first\n"); return FALSE; }
+    if (ata_fd >= 0)
+    {
+        if (ftruncate(ata_fd, size) != 0) { printf("Unable to resize disk to %lld MB\n", size / 1024 / 1024); return FALSE; }
+        ata_size = size;
+        printf("Resized disk to %lld MB\n", size / 1024 / 1024);
+        return TRUE;
+    }
+    uint8_t* data = realloc(ata_data, size);
+    if (data == NULL) { printf("Unable to resize disk to %lld MB\n", size / 1024 / 1024); return FALSE; }
+    if (size > ata_size) { memset(data + ata_size, 0, size - ata_size); }
+    ata_data = data;
+    ata_size = size;
+    printf("Resized disk to %lld MB\n", size / 1024 / 1024);
+    return TRUE;
+}
+
+// positioned transfer of whole range, short transfers are retried and a read past the end leaves zeros
+bool_t ata_pio(int fd, bool_t write, uint64_t offset, size_t len, uint8_t* buffer)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write ? pwrite(fd, buffer + done, len - done, offset + done) : pread(fd, buffer + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { break; }
+        done += n;
+    }
+    if (done == len) { return TRUE; }
+    if (!write) { memset(buffer + done, 0, len - done); }
+    return FALSE;
+}
+
+bool_t ata_overlay_present(uint64_t sector) { return (__atomic_load_n(&ata_bitmap[sector / 8], __ATOMIC_ACQUIRE) >> (sector % 8)) & 1; }
+
+// set presence bits of sectors written to the delta and store the bytes that changed
+void ata_overlay_mark(uint64_t sector, uint32_t count)
+{
+    bool_t changed = FALSE;
+    pthread_mutex_lock(&ata_bitmap_mutex);
+    for (uint64_t sec = sector; sec < sector + count; sec++)
+    {
+        if (ata_overlay_present(sec)) { continue; }
+        __atomic_fetch_or(&ata_bitmap[sec / 8], (uint8_t)(1 << (sec % 8)), __ATOMIC_RELEASE);
+        changed = TRUE;
+    }
+    uint64_t first = sector / 8, last = (sector + count - 1) / 8;
+    if (changed) { ata_pio(ata_fd, TRUE, ata_overlay.bitmap_offset + first, last - first + 1, ata_bitmap + first); }
+    pthread_mutex_unlock(&ata_bitmap_mutex);
+}
+
+// writes go to the delta, reads take each run of sectors from whichever file holds it
+bool_t ata_overlay_io(bool_t write, uint64_t sector, uint32_t count, uint8_t* buffer)
+{
+    if (write)
+    {
+        // contents land before their bits so a present sector is never read from a hole
+        if (!ata_pio(ata_fd, TRUE, ata_overlay.data_offset + (sector * ATA_SECTOR_SIZE), (size_t)count * ATA_SECTOR_SIZE, buffer)) { return FALSE; }
+        ata_overlay_mark(sector, count);
+        return TRUE;
+    }
+
+    bool_t result = TRUE;
+    for (uint32_t i = 0; i < count;)
+    {
+        bool_t   present = ata_overlay_present(sector + i);
+        uint32_t run = 1;
+        while (i + run < count && ata_overlay_present(sector + i + run) == present) { run++; }
+        uint64_t offset = (sector + i) * ATA_SECTOR_SIZE + (present ? ata_overlay.data_offset : 0);
+        if (!ata_pio(present ? ata_fd : ata_base_fd, FALSE, offset, (size_t)run * ATA_SECTOR_SIZE, buffer + (i * ATA_SECTOR_SIZE))) { result = FALSE; }
+        i += run;
+    }
+    return result;
+}
+
+bool_t ata_file_io(bool_t write, uint64_t sector, uint32_t count, uint8_t* buffer)
+{
+    bool_t result;
+    if (ata_backend == ATA_BACKEND_OVERLAY) { result = ata_overlay_io(write, sector, count, buffer); }
+    else { result = ata_pio(ata_fd, write, sector * ATA_SECTOR_SIZE, (size_t)count * ATA_SECTOR_SIZE, buffer); }
+    if (result) { return TRUE; }
+    printf("Unable to %s %d sectors at 0x%08llx\n", write ? "write" : "read", count, (unsigned long long)sector);
+    return FALSE;
+}
+
 void ata_read(uint64_t sector, uint32_t count, uint8_t* buffer)
 {
+    STATS_SCOPE(STATS_OP_ATA_READ);
+    STAT_ADD(STAT_SECTORS_READ, count);
+    HEATMAP(FALSE, sector, count);
+    if (ata_fd >= 0) { ata_file_io(FALSE, sector, count, buffer); return; }
     uint8_t* p_start = ata_data + (sector * ATA_SECTOR_SIZE);
     uint32_t len = count * ATA_SECTOR_SIZE;
     memset(buffer, 0, len);
     memcpy(buffer, p_start, len);
 }
 
+// store sectors without hooks, used by writes and by rollback
+void ata_store(uint64_t sector, uint32_t count, uint8_t* buffer)
+{
+    if (ata_fd >= 0) { ata_file_io(TRUE, sector, count, buffer); return; }
+    memcpy(ata_data + (sector * ATA_SECTOR_SIZE), buffer, (size_t)count * ATA_SECTOR_SIZE);
+}
+
 void ata_write(uint64_t sector, uint32_t count, uint8_t* buffer)
 {
-    uint8_t* p_start = ata_data + (sector * ATA_SECTOR_SIZE);
-    uint32_t len = count * ATA_SECTOR_SIZE;
-    memcpy(p_start, buffer, len);
+    STATS_SCOPE(STATS_OP_ATA_WRITE);
+    STAT_ADD(STAT_SECTORS_WRITTEN, count);
+    HEATMAP(TRUE, sector, count);
+    ATA_SNAPSHOT_SAVE(sector, count);
+    ata_store(sector, count, buffer);
 }
 
 void ata_fill(uint64_t sector, uint32_t count, uint8_t value)
@@ -97,6 +320,521 @@ void ata_filldata(uint64_t sector, uint32_t count, uint8_t* data)
     }
 }
 
+// write bytes starting at sector to host file, copied inside the kernel when the image is a host file
+bool_t ata_copy_out(uint64_t sector, uint64_t bytes, int fd, uint64_t offset)
+{
+    uint64_t start = sector * ATA_SECTOR_SIZE;
+    if (start + bytes > ata_size) { printf("Invalid sector range 0x%08llx+%llu while copying out\n", (unsigned long long)sector, (unsigned long long)bytes); return FALSE; }
+    STAT_ADD(STAT_SECTORS_READ, (bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE);
+    HEATMAP(FALSE, sector, (bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE);
+
+    uint64_t done = 0;
+    if (ata_fd < 0)
+    {
+        while (done < bytes)
+        {
+            ssize_t n = pwrite(fd, ata_data + start + done, bytes - done, offset + done);
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { break; }
+            done += n;
+        }
+        return done == bytes;
+    }
+
+#ifdef __linux__
+    while (ata_backend != ATA_BACKEND_OVERLAY && done < bytes)
+    {
+        loff_t in = start + done, out = offset + done;
+        ssize_t n = copy_file_range(ata_fd, &in, fd, &out, bytes - done, 0);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { break; }
+        done += n;
+    }
+#endif
+
+    // hosts without copy_file_range between these files and overlays go through a buffer
+    uint8_t* buffer = malloc(ATA_COPY_CHUNK * ATA_SECTOR_SIZE);
+    while (done < bytes)
+    {
+        size_t  len = bytes - done < ATA_COPY_CHUNK * ATA_SECTOR_SIZE ? bytes - done : ATA_COPY_CHUNK * ATA_SECTOR_SIZE;
+        ssize_t n;
+        if (ata_backend == ATA_BACKEND_OVERLAY) { n = ata_file_io(FALSE, (start + done) / ATA_SECTOR_SIZE, (len + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE, buffer) ? (ssize_t)len : -1; }
+        else { n = pread(ata_fd, buffer, len, start + done); }
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { break; }
+        ssize_t written = 0;
+        while (written < n)
+        {
+            ssize_t w = pwrite(fd, buffer + written, n - written, offset + done + written);
+            if (w < 0 && errno == EINTR) { continue; }
+            if (w <= 0) { break; }
+            written += w;
+        }
+        done += written;
+        if (written < n) { break; }
+    }
+    free(buffer);
+    return done == bytes;
+}
+
+// fill sectors from bytes of host file, copied inside the kernel - only images opened in place, returns FALSE when the host cannot
+bool_t ata_copy_in(uint64_t sector, uint64_t bytes, int fd, uint64_t offset)
+{
+    uint64_t start = sector * ATA_SECTOR_SIZE;
+    if (ata_fd < 0 || ata_backend == ATA_BACKEND_OVERLAY || start + bytes > ata_size) { return FALSE; }
+#ifdef __linux__
+    ATA_SNAPSHOT_SAVE(sector, (bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE);
+    uint64_t done = 0;
+    while (done < bytes)
+    {
+        loff_t in = offset + done, out = start + done;
+        ssize_t n = copy_file_range(fd, &in, ata_fd, &out, bytes - done, 0);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { break; }
+        done += n;
+    }
+    if (done != bytes) { return FALSE; }
+    STAT_ADD(STAT_SECTORS_WRITTEN, (bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE);
+    HEATMAP(TRUE, sector, (bytes + ATA_SECTOR_SIZE - 1) / ATA_SECTOR_SIZE);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
 uint32_t ata_get_disk_size() { return ata_size; }
 
-uint8_t* ata_get_data() { return ata_data; }
\ No newline at end of file
+uint8_t* ata_get_data() { return ata_data; }
+
+bool_t ata_loaded() { return ata_data != NULL || ata_fd >= 0; }
+
+uint8_t ata_get_backend() { return ata_fd >= 0 ? ata_backend : ATA_BACKEND_MEMORY; }
+
+// ---- overlays ------------------------------------------------------------------------------------------------------
+// a delta file is a header, one presence bit per sector and a sparse data area laid out like the image itself
+// creating one allocates no data, only sectors written through the overlay take space on the host
+
+bool_t ata_overlay_create(const char* filename, const char* base)
+{
+    int base_fd = open(base, O_RDONLY);
+    struct stat st;
+    if (base_fd < 0 || fstat(base_fd, &st) != 0 || st.st_size == 0) { if (base_fd >= 0) { close(base_fd); } printf("Unable to locate base image '%s'\n", base); return FALSE; }
+    close(base_fd);
+
+    // base is stored by absolute path so the delta can be opened from any directory
+    char* path = realpath(base, NULL);
+    if (path == NULL || strlen(path) >= ATA_OVERLAY_PATH_MAX) { free(path); printf("Base image path '%s' is too long\n", base); return FALSE; }
+
+    ata_overlay_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic         = ATA_OVERLAY_MAGIC;
+    header.version       = ATA_OVERLAY_VERSION;
+    header.size          = st.st_size - (st.st_size % ATA_SECTOR_SIZE);
+    header.bitmap_offset = ATA_SECTOR_SIZE;
+    header.data_offset   = (header.bitmap_offset + (header.size / ATA_SECTOR_SIZE + 7) / 8 + 4095) & ~4095ull;
+    strcpy(header.base, path);
+    free(path);
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { printf("Unable to create overlay '%s'\n", filename); return FALSE; }
+    bool_t result = ata_pio(fd, TRUE, 0, sizeof(header), (uint8_t*)&header) && ftruncate(fd, header.data_offset + header.size) == 0;
+    close(fd);
+    if (!result) { unlink(filename); printf("Unable to create overlay '%s'\n", filename); return FALSE; }
+    printf("Created overlay '%s' on base image '%s'\n", filename, header.base);
+    return ata_open_file(filename, ATA_BACKEND_SYNC);
+}
+
+// validate header of delta, open its base read only and load the presence bits
+bool_t ata_overlay_attach(int fd, ata_overlay_header_t* header, int* base_fd, uint8_t** bitmap)
+{
+    header->base[ATA_OVERLAY_PATH_MAX - 1] = 0;
+    if (header->version != ATA_OVERLAY_VERSION || header->size == 0) { printf("Unsupported overlay version %u\n", header->version); return FALSE; }
+    struct stat st;
+    *base_fd = open(header->base, O_RDONLY);
+    if (*base_fd < 0 || fstat(*base_fd, &st) != 0) { if (*base_fd >= 0) { close(*base_fd); } printf("Unable to locate base image '%s'\n", header->base); return FALSE; }
+    if ((uint64_t)st.st_size < header->size) { close(*base_fd); printf("Base image '%s' is smaller than its overlay\n", header->base); return FALSE; }
+
+    size_t bytes = (header->size / ATA_SECTOR_SIZE + 7) / 8;
+    *bitmap = malloc(bytes);
+    if (!ata_pio(fd, FALSE, header->bitmap_offset, bytes, *bitmap)) { free(*bitmap); close(*base_fd); printf("Overlay bitmap is truncated\n"); return FALSE; }
+    return TRUE;
+}
+
+// forget overlay state, the delta itself is closed with ata_fd
+void ata_overlay_close()
+{
+    if (ata_backend != ATA_BACKEND_OVERLAY) { return; }
+    close(ata_base_fd);
+    free(ata_bitmap);
+    ata_base_fd = -1;
+    ata_bitmap  = NULL;
+    ata_backend = ATA_BACKEND_SYNC;
+    memset(&ata_overlay, 0, sizeof(ata_overlay));
+}
+
+uint64_t ata_overlay_count()
+{
+    uint64_t count = 0;
+    size_t bytes = (ata_overlay.size / ATA_SECTOR_SIZE + 7) / 8;
+    for (size_t i = 0; i < bytes; i++) { count += __builtin_popcount(ata_bitmap[i]); }
+    return count;
+}
+
+// write changed sectors into the base and empty the delta, other overlays of the same base no longer match it afterwards
+bool_t ata_overlay_commit()
+{
+    if (ata_backend != ATA_BACKEND_OVERLAY) { printf("Current disk image is not an overlay\n"); return FALSE; }
+    int fd = open(ata_overlay.base, O_RDWR);
+    if (fd < 0) { printf("Unable to open base image '%s' for writing\n", ata_overlay.base); return FALSE; }
+
+    uint64_t sectors = ata_overlay.size / ATA_SECTOR_SIZE, count = 0;
+    uint8_t* buffer  = malloc(ATA_COPY_CHUNK * ATA_SECTOR_SIZE);
+    bool_t   result  = TRUE;
+    for (uint64_t sec = 0; sec < sectors && result;)
+    {
+        if (!ata_overlay_present(sec)) { sec++; continue; }
+        uint32_t run = 1;
+        while (run < ATA_COPY_CHUNK && sec + run < sectors && ata_overlay_present(sec + run)) { run++; }
+        result = ata_pio(ata_fd, FALSE, ata_overlay.data_offset + (sec * ATA_SECTOR_SIZE), (size_t)run * ATA_SECTOR_SIZE, buffer) &&
+                 ata_pio(fd, TRUE, sec * ATA_SECTOR_SIZE, (size_t)run * ATA_SECTOR_SIZE, buffer);
+        count += run;
+        sec   += run;
+    }
+    free(buffer);
+    if (!result || fsync(fd) != 0) { close(fd); printf("Unable to write base image '%s'\n", ata_overlay.base); return FALSE; }
+    close(fd);
+
+    // truncating and extending again releases the data area of the delta
+    size_t bytes = (sectors + 7) / 8;
+    memset(ata_bitmap, 0, bytes);
+    ata_pio(ata_fd, TRUE, ata_overlay.bitmap_offset, bytes, ata_bitmap);
+    if (ftruncate(ata_fd, ata_overlay.data_offset) != 0 || ftruncate(ata_fd, ata_overlay.data_offset + ata_overlay.size) != 0) { printf("Unable to release data of overlay '%s'\n", ata_filename); }
+    printf("Committed %llu sectors to base image '%s'\n", (unsigned long long)count, ata_overlay.base);
+    return TRUE;
+}
+
+void ata_overlay_print()
+{
+    if (ata_backend != ATA_BACKEND_OVERLAY) { printf("Current disk image is not an overlay\n"); return; }
+    struct stat st;
+    uint64_t used = (fstat(ata_fd, &st) == 0) ? (uint64_t)st.st_blocks * 512 : 0;
+    printf("Overlay '%s' on base image '%s', %llu of %llu sectors changed, %llu KB used on host\n", ata_filename, ata_overlay.base,
+           (unsigned long long)ata_overlay_count(), (unsigned long long)(ata_overlay.size / ATA_SECTOR_SIZE), (unsigned long long)(used / 1024));
+}
+
+// ---- snapshots -----------------------------------------------------------------------------------------------------
+// taking a snapshot only sets the flag, the first write to a sector afterwards saves its original contents
+// memory used is one sector per sector changed plus its index slot, rollback writes back just those sectors
+
+bool_t ata_snapshot_take()
+{
+    if (!ata_loaded()) { printf("No disk image loaded\n"); return FALSE; }
+    if (ata_snap_active) { printf("A snapshot is already active\n"); return FALSE; }
+    pthread_mutex_lock(&ata_snap_mutex);
+    memset(&ata_snap, 0, sizeof(ata_snapshot_t));
+    ata_snap.taken = time(NULL);
+    pthread_mutex_unlock(&ata_snap_mutex);
+    ata_snap_active = TRUE;
+    printf("Took snapshot of disk image\n");
+    return TRUE;
+}
+
+// free saved sectors without restoring them
+void ata_snapshot_free()
+{
+    for (uint32_t i = 0; i < ata_snap.chunk_count; i++) { free(ata_snap.chunks[i]); }
+    free(ata_snap.chunks);
+    free(ata_snap.keys);
+    free(ata_snap.slots);
+    memset(&ata_snap, 0, sizeof(ata_snapshot_t));
+}
+
+// slot of sector in open addressed index, or where it would be inserted
+uint32_t ata_snapshot_find(uint64_t sector)
+{
+    uint32_t mask = ata_snap.capacity - 1;
+    uint32_t pos  = (uint32_t)((sector * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    while (ata_snap.keys[pos] != 0 && ata_snap.keys[pos] != sector + 1) { pos = (pos + 1) & mask; }
+    return pos;
+}
+
+void ata_snapshot_grow()
+{
+    uint64_t* keys     = ata_snap.keys;
+    uint32_t* slots    = ata_snap.slots;
+    uint32_t  capacity = ata_snap.capacity;
+    ata_snap.capacity = (capacity == 0) ? 1024 : capacity * 2;
+    ata_snap.keys     = calloc(ata_snap.capacity, sizeof(uint64_t));
+    ata_snap.slots    = malloc(ata_snap.capacity * sizeof(uint32_t));
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        if (keys[i] == 0) { continue; }
+        uint32_t pos = ata_snapshot_find(keys[i] - 1);
+        ata_snap.keys[pos]  = keys[i];
+        ata_snap.slots[pos] = slots[i];
+    }
+    free(keys);
+    free(slots);
+}
+
+uint8_t* ata_snapshot_sector(uint32_t slot) { return ata_snap.chunks[slot / ATA_SNAP_CHUNK] + ((slot % ATA_SNAP_CHUNK) * ATA_SECTOR_SIZE); }
+
+// save original contents of sectors about to be written that were not saved yet, runs before the write is issued
+void ata_snapshot_save(uint64_t sector, uint32_t count)
+{
+    pthread_mutex_lock(&ata_snap_mutex);
+    if (!ata_snap_active) { pthread_mutex_unlock(&ata_snap_mutex); return; }
+    for (uint64_t sec = sector; sec < sector + count && (sec + 1) * ATA_SECTOR_SIZE <= ata_size; sec++)
+    {
+        if ((ata_snap.count + 1) * 4 > ata_snap.capacity * 3) { ata_snapshot_grow(); }
+        uint32_t pos = ata_snapshot_find(sec);
+        if (ata_snap.keys[pos] != 0) { continue; }
+
+        uint32_t slot = ata_snap.count;
+        if (slot / ATA_SNAP_CHUNK == ata_snap.chunk_count)
+        {
+            ata_snap.chunks = realloc(ata_snap.chunks, (ata_snap.chunk_count + 1) * sizeof(uint8_t*));
+            ata_snap.chunks[ata_snap.chunk_count++] = malloc(ATA_SNAP_CHUNK * ATA_SECTOR_SIZE);
+        }
+        uint8_t* saved = ata_snapshot_sector(slot);
+        if (ata_fd >= 0) { ata_file_io(FALSE, sec, 1, saved); }
+        else { memcpy(saved, ata_data + (sec * ATA_SECTOR_SIZE), ATA_SECTOR_SIZE); }
+        ata_snap.keys[pos]  = sec + 1;
+        ata_snap.slots[pos] = slot;
+        ata_snap.count++;
+    }
+    pthread_mutex_unlock(&ata_snap_mutex);
+}
+
+// restore every sector changed since the snapshot and end it, no other thread may be writing
+bool_t ata_snapshot_rollback()
+{
+    if (!ata_snap_active) { printf("No snapshot is active\n"); return FALSE; }
+    pthread_mutex_lock(&ata_snap_mutex);
+    ata_snap_active = FALSE;
+    for (uint32_t i = 0; i < ata_snap.capacity; i++)
+    {
+        if (ata_snap.keys[i] == 0) { continue; }
+        ata_store(ata_snap.keys[i] - 1, 1, ata_snapshot_sector(ata_snap.slots[i]));
+    }
+    uint32_t count = ata_snap.count;
+    ata_snapshot_free();
+    pthread_mutex_unlock(&ata_snap_mutex);
+    printf("Rolled back %u sectors to snapshot\n", count);
+    return TRUE;
+}
+
+// keep every change and end the snapshot
+bool_t ata_snapshot_drop()
+{
+    if (!ata_snap_active) { printf("No snapshot is active\n"); return FALSE; }
+    uint32_t count = ata_snap.count;
+    ata_snapshot_discard();
+    printf("Dropped snapshot, kept %u changed sectors\n", count);
+    return TRUE;
+}
+
+// end snapshot silently when the image it belongs to is replaced
+void ata_snapshot_discard()
+{
+    pthread_mutex_lock(&ata_snap_mutex);
+    ata_snap_active = FALSE;
+    ata_snapshot_free();
+    pthread_mutex_unlock(&ata_snap_mutex);
+}
+
+void ata_snapshot_print()
+{
+    if (!ata_snap_active) { printf("No snapshot is active\n"); return; }
+    pthread_mutex_lock(&ata_snap_mutex);
+    uint64_t used = (uint64_t)ata_snap.chunk_count * ATA_SNAP_CHUNK * ATA_SECTOR_SIZE + (uint64_t)ata_snap.capacity * (sizeof(uint64_t) + sizeof(uint32_t));
+    printf("Snapshot taken %lld seconds ago, %u of %llu sectors changed, %llu KB saved\n", (long long)(time(NULL) - ata_snap.taken), ata_snap.count,
+           (unsigned long long)(ata_size / ATA_SECTOR_SIZE), (unsigned long long)(used / 1024));
+    pthread_mutex_unlock(&ata_snap_mutex);
+}
+
+// ---- submission queue ----------------------------------------------------------------------------------------------
+// requests on images in memory or opened with the sync backend complete on submission, io_uring keeps them in flight
+// a queue belongs to the thread that created it
+
+#ifdef ATA_HAVE_URING
+// set up ring with raw syscalls, leaves ring_fd at -1 if the kernel or sandbox refuses
+void ata_queue_ring_create(ata_queue_t* queue)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, queue->depth, &params);
+    if (fd < 0) { return; }
+
+    queue->sq_len  = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    queue->cq_len  = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    queue->sqe_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && queue->cq_len > queue->sq_len) { queue->sq_len = queue->cq_len; }
+
+    uint8_t* sq = mmap(NULL, queue->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) { close(fd); return; }
+    uint8_t* cq = sq;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cq = mmap(NULL, queue->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { munmap(sq, queue->sq_len); close(fd); return; }
+    }
+    void* sqes = mmap(NULL, queue->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { if (cq != sq) { munmap(cq, queue->cq_len); } munmap(sq, queue->sq_len); close(fd); return; }
+
+    queue->sq_ptr   = sq;
+    queue->cq_ptr   = cq;
+    queue->sq_head  = (uint32_t*)(sq + params.sq_off.head);
+    queue->sq_tail  = (uint32_t*)(sq + params.sq_off.tail);
+    queue->sq_mask  = (uint32_t*)(sq + params.sq_off.ring_mask);
+    queue->sq_array = (uint32_t*)(sq + params.sq_off.array);
+    queue->cq_head  = (uint32_t*)(cq + params.cq_off.head);
+    queue->cq_tail  = (uint32_t*)(cq + params.cq_off.tail);
+    queue->cq_mask  = (uint32_t*)(cq + params.cq_off.ring_mask);
+    queue->cqes     = cq + params.cq_off.cqes;
+    queue->sqes     = sqes;
+    queue->ring_fd  = fd;
+}
+
+void ata_queue_ring_destroy(ata_queue_t* queue)
+{
+    munmap(queue->sqes, queue->sqe_len);
+    if (queue->cq_ptr != queue->sq_ptr) { munmap(queue->cq_ptr, queue->cq_len); }
+    munmap(queue->sq_ptr, queue->sq_len);
+    close(queue->ring_fd);
+}
+
+bool_t ata_queue_ring_submit(ata_queue_t* queue, uint32_t slot)
+{
+    ata_request_t* req = &queue->requests[slot];
+    uint32_t tail  = *queue->sq_tail;
+    uint32_t index = tail & *queue->sq_mask;
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*)queue->sqes)[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode    = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd        = ata_fd;
+    sqe->off       = req->sector * ATA_SECTOR_SIZE;
+    sqe->addr      = (uint64_t)(uintptr_t)req->buffer;
+    sqe->len       = req->count * ATA_SECTOR_SIZE;
+    sqe->user_data = slot;
+    queue->sq_array[index] = index;
+    __atomic_store_n(queue->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (TRUE)
+    {
+        int n = syscall(__NR_io_uring_enter, queue->ring_fd, 1, 0, 0, NULL, 0);
+        if (n >= 0) { return TRUE; }
+        if (errno != EINTR && errno != EAGAIN) { return FALSE; }
+    }
+}
+
+// reap finished requests, short transfers are completed synchronously
+uint32_t ata_queue_ring_reap(ata_queue_t* queue, ata_completion_t* completions, uint32_t max, bool_t wait)
+{
+    uint32_t reaped = 0;
+    while (reaped < max)
+    {
+        uint32_t head = *queue->cq_head;
+        if (head == __atomic_load_n(queue->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if (reaped > 0 || !wait || queue->inflight == 0) { break; }
+            syscall(__NR_io_uring_enter, queue->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            continue;
+        }
+
+        struct io_uring_cqe* cqe = &((struct io_uring_cqe*)queue->cqes)[head & *queue->cq_mask];
+        uint32_t slot = (uint32_t)cqe->user_data;
+        int32_t  res  = cqe->res;
+        __atomic_store_n(queue->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        ata_request_t* req = &queue->requests[slot];
+        int32_t len = req->count * ATA_SECTOR_SIZE;
+        if (res >= 0 && res < len)
+        {
+            uint32_t done = res / ATA_SECTOR_SIZE;
+            res = ata_file_io(req->write, req->sector + done, req->count - done, req->buffer + (done * ATA_SECTOR_SIZE)) ? len : -EIO;
+        }
+        completions[reaped].tag    = req->tag;
+        completions[reaped].result = res;
+        reaped++;
+        req->active = FALSE;
+        queue->inflight--;
+    }
+    return reaped;
+}
+#endif
+
+ata_queue_t* ata_queue_create(uint32_t depth)
+{
+    if (depth == 0) { depth = 1; }
+    ata_queue_t* queue = malloc(sizeof(ata_queue_t));
+    memset(queue, 0, sizeof(ata_queue_t));
+    queue->ring_fd  = -1;
+    queue->depth    = depth;
+    queue->requests = calloc(depth, sizeof(ata_request_t));
+    queue->done     = calloc(depth, sizeof(ata_completion_t));
+#ifdef ATA_HAVE_URING
+    if (ata_fd >= 0 && ata_backend == ATA_BACKEND_URING) { ata_queue_ring_create(queue); }
+#endif
+    return queue;
+}
+
+void ata_queue_destroy(ata_queue_t* queue)
+{
+    if (queue == NULL) { return; }
+    ata_completion_t scratch[ATA_QUEUE_DEPTH];
+    while (queue->inflight > 0) { ata_poll(queue, scratch, ATA_QUEUE_DEPTH, TRUE); }
+#ifdef ATA_HAVE_URING
+    if (queue->ring_fd >= 0) { ata_queue_ring_destroy(queue); }
+#endif
+    free(queue->done);
+    free(queue->requests);
+    free(queue);
+}
+
+bool_t ata_submit(ata_queue_t* queue, bool_t write, uint64_t sector, uint32_t count, uint8_t* buffer, uint64_t tag)
+{
+    if (queue->inflight + queue->done_count >= queue->depth) { return FALSE; }
+    if ((sector + count) * ATA_SECTOR_SIZE > ata_size) { printf("Invalid sector range 0x%08llx+%d while submitting request\n", (unsigned long long)sector, count); return FALSE; }
+
+#ifdef ATA_HAVE_URING
+    if (queue->ring_fd >= 0)
+    {
+        uint32_t slot = 0;
+        while (queue->requests[slot].active) { slot++; }
+        HEATMAP(write, sector, count);
+        if (write) { ATA_SNAPSHOT_SAVE(sector, count); }
+        ata_request_t req = { sector, count, buffer, tag, write, TRUE };
+        queue->requests[slot] = req;
+        if (!ata_queue_ring_submit(queue, slot)) { queue->requests[slot].active = FALSE; return FALSE; }
+        queue->inflight++;
+        return TRUE;
+    }
+#endif
+
+    if (write) { ata_write(sector, count, buffer); }
+    else { ata_read(sector, count, buffer); }
+    queue->done[queue->done_count].tag    = tag;
+    queue->done[queue->done_count].result = count * ATA_SECTOR_SIZE;
+    queue->done_count++;
+    return TRUE;
+}
+
+// queue read of sector range, returns FALSE when the queue is full
+bool_t ata_submit_read(ata_queue_t* queue, uint64_t sector, uint32_t count, uint8_t* buffer, uint64_t tag) { return ata_submit(queue, FALSE, sector, count, buffer, tag); }
+
+// queue write of sector range, buffer must stay untouched until its completion is polled
+bool_t ata_submit_write(ata_queue_t* queue, uint64_t sector, uint32_t count, uint8_t* buffer, uint64_t tag) { return ata_submit(queue, TRUE, sector, count, buffer, tag); }
+
+// collect up to max completions, waiting for at least one when requested and any are pending
+uint32_t ata_poll(ata_queue_t* queue, ata_completion_t* completions, uint32_t max, bool_t wait)
+{
+    uint32_t count = 0;
+    while (queue->done_count > 0 && count < max) { completions[count++] = queue->done[--queue->done_count]; }
+#ifdef ATA_HAVE_URING
+    if (queue->ring_fd >= 0 && count < max) { count += ata_queue_ring_reap(queue, completions + count, max - count, wait && count == 0); }
+#endif
+    return count;
+}
+
+uint32_t ata_pending(ata_queue_t* queue) { return queue->inflight + queue->done_count; }
@@ -0,0 +1,479 @@
+#include <time.h>
+#include "bench.h"
+#include "ata.h"
+#include "fs.h"
+#include "vfs.h"
+#include "fsck.h"
+
+bench_result_t bench_results[BENCH_RESULTS_MAX];
+uint32_t       bench_count   = 0;
+uint8_t        bench_backend = ATA_BACKEND_MEMORY;
+
+const char* BENCH_IMAGE = "/tmp/voy_bench.img";
+
+uint64_t bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+void bench_timer_init(bench_timer_t* timer, uint32_t max)
+{
+    timer->samples = malloc(max * sizeof(uint64_t));
+    timer->count   = 0;
+    timer->max     = max;
+    timer->bytes   = 0;
+}
+
+void bench_begin(bench_timer_t* timer) { timer->started = bench_now(); }
+
+void bench_end(bench_timer_t* timer, uint64_t bytes)
+{
+    uint64_t elapsed = bench_now() - timer->started;
+    if (timer->count < timer->max) { timer->samples[timer->count++] = elapsed; }
+    timer->bytes += bytes;
+}
+
+int bench_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    if (x < y) { return -1; }
+    return x > y;
+}
+
+// reduce samples to result and release timer
+void bench_record(const char* name, const char* param, bench_timer_t* timer)
+{
+    if (bench_count >= BENCH_RESULTS_MAX || timer->count == 0) { free(timer->samples); return; }
+    bench_result_t* result = &bench_results[bench_count++];
+    memset(result, 0, sizeof(bench_result_t));
+    strncpy(result->name, name, sizeof(result->name) - 1);
+    strncpy(result->param, param, sizeof(result->param) - 1);
+
+    for (uint32_t i = 0; i < timer->count; i++) { result->total_ns += timer->samples[i]; }
+    qsort(timer->samples, timer->count, sizeof(uint64_t), bench_compare);
+    result->ops    = timer->count;
+    result->p50_ns = timer->samples[timer->count / 2];
+    result->p99_ns = timer->samples[((uint64_t)timer->count * 99) / 100];
+    if (timer->bytes > 0 && result->total_ns > 0) { result->mb_per_sec = (timer->bytes / (1024.0 * 1024.0)) / (result->total_ns / 1e9); }
+    free(timer->samples);
+    fprintf(stderr, "%-12s %-14s %8d ops  p50 %10llu ns  p99 %10llu ns\n", result->name, result->param, result->ops, (unsigned long long)result->p50_ns, (unsigned long long)result->p99_ns);
+}
+
+// fresh formatted disk in memory, setup runs here before bench_attach
+void bench_disk()
+{
+    ata_unload();
+    ata_create(BENCH_DISK_SIZE);
+    fs_format(BENCH_DISK_SIZE, FALSE, 0);
+    fs_mount();
+}
+
+// move prepared disk to the backend being measured, images opened in place go through a host file
+void bench_attach()
+{
+    if (bench_backend == ATA_BACKEND_MEMORY) { return; }
+    ata_save_file(BENCH_IMAGE);
+    ata_unload();
+    ata_open_file(BENCH_IMAGE, bench_backend);
+    fs_mount();
+}
+
+// fill file table to percentage of its entries with directories, 128 per parent to keep directories realistic
+void bench_fill(uint32_t percent)
+{
+    fs_info_t info   = fs_get_info();
+    uint32_t  target = ((info.file_table_count_max - 1) * percent) / 100;
+    char      path[64];
+    for (uint32_t i = 0; i < target; i++)
+    {
+        if (i % 129 == 0) { sprintf(path, "/fill%d", i / 129); }
+        else { sprintf(path, "/fill%d/d%d", i / 129, i % 129); }
+        vfs_create_dir(path);
+    }
+}
+
+void bench_lookup(uint32_t iterations)
+{
+    const uint32_t depths[] = { 1, 4, 8, 16 };
+    uint8_t data[64] = { 0 };
+    for (uint32_t d = 0; d < sizeof(depths) / sizeof(uint32_t); d++)
+    {
+        bench_disk();
+        bench_fill(25);
+        char path[512] = "";
+        for (uint32_t i = 1; i < depths[d]; i++) { strcat(path, "/level"); vfs_create_dir(path); }
+        strcat(path, "/file.bin");
+        fs_file_write(path, data, sizeof(data));
+        bench_attach();
+
+        bench_timer_t timer;
+        bench_timer_init(&timer, iterations);
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            bench_begin(&timer);
+            fs_file_t file = fs_get_file_byname(path);
+            bench_end(&timer, 0);
+            if (file.type != FSTYPE_FILE) { fprintf(stderr, "Lookup of %s failed\n", path); break; }
+        }
+        char param[32];
+        sprintf(param, "depth=%d", depths[d]);
+        bench_record("lookup", param, &timer);
+    }
+}
+
+void bench_create(uint32_t iterations)
+{
+    const uint32_t occupancy[] = { 0, 50, 90 };
+    uint8_t data[2048];
+    memset(data, 0x5A, sizeof(data));
+    for (uint32_t o = 0; o < sizeof(occupancy) / sizeof(uint32_t); o++)
+    {
+        bench_disk();
+        bench_fill(occupancy[o]);
+        vfs_create_dir("/bench");
+        bench_attach();
+
+        bench_timer_t create, delete;
+        bench_timer_init(&create, iterations);
+        bench_timer_init(&delete, iterations);
+        char path[64];
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            sprintf(path, "/bench/f%d", i);
+            bench_begin(&create);
+            fs_file_write(path, data, sizeof(data));
+            bench_end(&create, 0);
+            bench_begin(&delete);
+            vfs_delete_file(path);
+            bench_end(&delete, 0);
+        }
+        char param[32];
+        sprintf(param, "occupancy=%d%%", occupancy[o]);
+        bench_record("create", param, &create);
+        bench_record("delete", param, &delete);
+    }
+}
+
+void bench_alloc(uint32_t iterations)
+{
+    const uint32_t holes[] = { 0, 1000, 4000 };
+    for (uint32_t h = 0; h < sizeof(holes) / sizeof(uint32_t); h++)
+    {
+        // every other block is freed so free space is scattered in holes too small for the measured allocations
+        bench_disk();
+        fs_blkentry_t* blocks = malloc(holes[h] * 2 * sizeof(fs_blkentry_t));
+        for (uint32_t i = 0; i < holes[h] * 2; i++) { blocks[i] = fs_blktable_allocate(1 + (i % 3)); }
+        for (uint32_t i = 0; i < holes[h] * 2; i += 2) { fs_blktable_free(blocks[i]); }
+        free(blocks);
+        bench_attach();
+
+        bench_timer_t alloc, release;
+        bench_timer_init(&alloc, iterations);
+        bench_timer_init(&release, iterations);
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            bench_begin(&alloc);
+            fs_blkentry_t blk = fs_blktable_allocate(8);
+            bench_end(&alloc, 0);
+            bench_begin(&release);
+            fs_blktable_free(blk);
+            bench_end(&release, 0);
+        }
+        char param[32];
+        sprintf(param, "holes=%d", holes[h]);
+        bench_record("allocate", param, &alloc);
+        bench_record("free", param, &release);
+    }
+}
+
+void bench_sequential(uint32_t iterations)
+{
+    const uint32_t sizes[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+    bench_disk();
+    bench_attach();
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(uint32_t); s++)
+    {
+        uint8_t* data = malloc(sizes[s]);
+        for (uint32_t i = 0; i < sizes[s]; i++) { data[i] = (uint8_t)(i * 31); }
+        uint32_t count = iterations / 10 > 0 ? iterations / 10 : 1;
+        if (sizes[s] > 1024 * 1024) { count = count / 16 > 0 ? count / 16 : 1; }
+
+        bench_timer_t write, read;
+        bench_timer_init(&write, count);
+        bench_timer_init(&read, count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            bench_begin(&write);
+            fs_file_write("/seq.bin", data, sizes[s]);
+            bench_end(&write, sizes[s]);
+            bench_begin(&read);
+            fs_file_t file = fs_file_read("/seq.bin");
+            bench_end(&read, sizes[s]);
+            if (file.data != NULL) { free(file.data); }
+            vfs_delete_file("/seq.bin");
+        }
+        char param[32];
+        sprintf(param, "size=%dK", sizes[s] / 1024);
+        bench_record("write", param, &write);
+        bench_record("read", param, &read);
+        free(data);
+    }
+}
+
+void bench_list(uint32_t iterations)
+{
+    const uint32_t entries[] = { 100, 1000, 4000 };
+    for (uint32_t e = 0; e < sizeof(entries) / sizeof(uint32_t); e++)
+    {
+        bench_disk();
+        vfs_create_dir("/list");
+        uint8_t data[16] = { 0 };
+        char path[64];
+        for (uint32_t i = 0; i < entries[e]; i++) { sprintf(path, "/list/entry%d", i); fs_file_write(path, data, sizeof(data)); }
+        bench_attach();
+
+        bench_timer_t timer;
+        uint32_t count = iterations / 10 > 0 ? iterations / 10 : 1;
+        bench_timer_init(&timer, count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int found = 0;
+            bench_begin(&timer);
+            char** names = vfs_get_files("/list", &found);
+            bench_end(&timer, 0);
+            for (int j = 0; j < found; j++) { free(names[j]); }
+            if (names != NULL) { free(names); }
+        }
+        char param[32];
+        sprintf(param, "entries=%d", entries[e]);
+        bench_record("ls", param, &timer);
+    }
+}
+
+void bench_mount(uint32_t iterations)
+{
+    const uint32_t occupancy[] = { 0, 50 };
+    for (uint32_t o = 0; o < sizeof(occupancy) / sizeof(uint32_t); o++)
+    {
+        bench_disk();
+        bench_fill(occupancy[o]);
+        bench_attach();
+
+        bench_timer_t timer;
+        uint32_t count = iterations / 100 > 0 ? iterations / 100 : 1;
+        bench_timer_init(&timer, count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            bench_begin(&timer);
+            fs_mount();
+            bench_end(&timer, 0);
+        }
+        char param[32];
+        sprintf(param, "occupancy=%d%%", occupancy[o]);
+        bench_record("mount", param, &timer);
+    }
+}
+
+void bench_run_all(uint32_t iterations, uint8_t backend)
+{
+    bench_count   = 0;
+    bench_backend = backend;
+    bench_lookup(iterations);
+    bench_create(iterations);
+    bench_alloc(iterations);
+    bench_sequential(iterations);
+    bench_list(iterations);
+    bench_mount(iterations);
+    ata_unload();
+    if (backend != ATA_BACKEND_MEMORY) { remove(BENCH_IMAGE); }
+}
+
+// used entries of block table, free extents included
+uint32_t bench_blk_used()
+{
+    fs_info_t      info  = fs_get_info();
+    fs_blkentry_t* table = fs_blktable_load();
+    uint32_t       used  = 0;
+    for (uint32_t i = 0; i < info.blk_table_count_max; i++) { if (table[i].start != 0 || table[i].count != 0 || table[i].state != 0) { used++; } }
+    free(table);
+    return used;
+}
+
+uint32_t bench_random()
+{
+    static uint32_t state = 0x9E3779B9;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// fill both tables to percentage of their entries with single sector files, then directories for the remaining file entries
+void bench_fill_tables(uint32_t percent, char (*live)[48], uint32_t* live_count)
+{
+    fs_info_t info        = fs_get_info();
+    uint32_t  blk_target  = (info.blk_table_count_max * percent) / 100;
+    uint32_t  file_target = ((info.file_table_count_max - 1) * percent) / 100;
+    uint8_t   data[ATA_SECTOR_SIZE];
+    memset(data, 0x3C, sizeof(data));
+    vfs_create_dir("/scale");
+
+    char path[48];
+    uint32_t blk_used = bench_blk_used();
+    for (uint32_t i = 0; blk_used + i < blk_target && fs_get_info().file_table_count < file_target; i++)
+    {
+        if (i % BENCH_SCALE_PER_DIR == 0) { sprintf(path, "/scale/d%d", i / BENCH_SCALE_PER_DIR); vfs_create_dir(path); }
+        sprintf(path, "/scale/d%d/f%d", i / BENCH_SCALE_PER_DIR, i % BENCH_SCALE_PER_DIR);
+        if (!fs_file_write(path, data, sizeof(data))) { break; }
+        strcpy(live[(*live_count)++], path);
+    }
+    for (uint32_t i = 0; fs_get_info().file_table_count < file_target; i++)
+    {
+        sprintf(path, "/scale/e%d", i);
+        if (!vfs_create_dir(path)) { break; }
+    }
+}
+
+// randomized create, delete, rename and rewrite mix at each occupancy, tables are checked after every phase
+bool_t bench_scaling(uint32_t iterations)
+{
+    const uint32_t occupancy[] = { 10, 50, 90, 100 };
+    const char*    names[]     = { "scale_create", "scale_delete", "scale_rename", "scale_write" };
+    bool_t         result      = TRUE;
+    uint8_t        data[BENCH_SCALE_SECTORS * ATA_SECTOR_SIZE];
+    memset(data, 0x6B, sizeof(data));
+
+    for (uint32_t o = 0; o < sizeof(occupancy) / sizeof(uint32_t); o++)
+    {
+        bench_disk();
+        uint32_t live_count = 0;
+        char (*live)[48] = malloc((FS_BLK_COUNT_MAX + iterations) * 48);
+        bench_fill_tables(occupancy[o], live, &live_count);
+        bench_attach();
+
+        fs_info_t info = fs_get_info();
+        uint32_t  blk_used = bench_blk_used();
+        fprintf(stderr, "Occupancy %d%%: %d of %d file entries, %d of %d block entries\n", occupancy[o],
+                info.file_table_count, info.file_table_count_max, blk_used, info.blk_table_count_max);
+
+        bench_timer_t timers[4];
+        uint32_t      failed[4] = { 0 };
+        for (int t = 0; t < 4; t++) { bench_timer_init(&timers[t], iterations); }
+        char path[48];
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            uint32_t op   = bench_random() % 4;
+            uint32_t pick = live_count > 0 ? bench_random() % live_count : 0;
+            uint32_t size = 1 + (bench_random() % (BENCH_SCALE_SECTORS * ATA_SECTOR_SIZE));
+            bool_t   ok   = TRUE;
+            if (op != 0 && live_count == 0) { op = 0; }
+
+            bench_begin(&timers[op]);
+            switch (op)
+            {
+                case 0:
+                    sprintf(path, "/scale/n%d", i);
+                    ok = fs_file_write(path, data, size);
+                    bench_end(&timers[op], size);
+                    if (ok) { strcpy(live[live_count++], path); }
+                    break;
+                case 1:
+                    ok = vfs_delete_file(live[pick]);
+                    bench_end(&timers[op], 0);
+                    if (ok) { strcpy(live[pick], live[--live_count]); }
+                    break;
+                case 2:
+                {
+                    char name[16];
+                    sprintf(name, "r%d", i);
+                    ok = vfs_rename_file(live[pick], name);
+                    bench_end(&timers[op], 0);
+                    if (ok) { char* slash = strrchr(live[pick], '/'); strcpy(slash + 1, name); }
+                    break;
+                }
+                default:
+                    ok = fs_file_write(live[pick], data, size);
+                    bench_end(&timers[op], size);
+                    break;
+            }
+            if (!ok) { failed[op]++; }
+        }
+
+        char param[32];
+        sprintf(param, "occupancy=%d%%", occupancy[o]);
+        for (int t = 0; t < 4; t++)
+        {
+            if (failed[t] > 0) { fprintf(stderr, "%-12s %-14s %8d failed, table full\n", names[t], param, failed[t]); }
+            bench_record(names[t], param, &timers[t]);
+        }
+
+        fsck_result_t check = fsck_run(FALSE, 0);
+        if (fsck_errors(check) > 0) { fprintf(stderr, "Table invariants violated at %d%% occupancy, %d problems\n", occupancy[o], fsck_errors(check)); result = FALSE; }
+        free(live);
+    }
+
+    bench_plot("scale_");
+    return result;
+}
+
+// p50 of every result with name prefix against its parameter, bars on a log scale
+void bench_plot(const char* prefix)
+{
+    uint64_t max = 1;
+    for (uint32_t i = 0; i < bench_count; i++) { if (!strncmp(bench_results[i].name, prefix, strlen(prefix)) && bench_results[i].p50_ns > max) { max = bench_results[i].p50_ns; } }
+    int max_bits = 64 - __builtin_clzll(max);
+
+    // one curve per name, in order of first appearance
+    for (uint32_t i = 0; i < bench_count; i++)
+    {
+        bench_result_t* first = &bench_results[i];
+        if (strncmp(first->name, prefix, strlen(prefix))) { continue; }
+        uint32_t seen = 0;
+        while (seen < i && strcmp(bench_results[seen].name, first->name)) { seen++; }
+        if (seen < i) { continue; }
+
+        fprintf(stderr, "%s p50\n", first->name);
+        for (uint32_t j = i; j < bench_count; j++)
+        {
+            bench_result_t* r = &bench_results[j];
+            if (strcmp(r->name, first->name)) { continue; }
+            int bits = r->p50_ns > 0 ? 64 - __builtin_clzll(r->p50_ns) : 0;
+            char bar[65];
+            int width = (bits * 48) / max_bits;
+            memset(bar, '#', width);
+            bar[width] = 0;
+            fprintf(stderr, "  %-14s %10.1f us |%s\n", r->param, r->p50_ns / 1000.0, bar);
+        }
+    }
+}
+
+bool_t bench_run_scaling(uint32_t iterations, uint8_t backend)
+{
+    bench_count   = 0;
+    bench_backend = backend;
+    bool_t result = bench_scaling(iterations);
+    ata_unload();
+    if (backend != ATA_BACKEND_MEMORY) { remove(BENCH_IMAGE); }
+    return result;
+}
+
+bool_t bench_write_json(const char* path, uint8_t backend)
+{
+    FILE* fileptr = fopen(path, "w");
+    if (fileptr == NULL) { fprintf(stderr, "Unable to write benchmark results to '%s'\n", path); return FALSE; }
+
+    const char* backends[] = { "memory", "sync", "io_uring" };
+    fprintf(fileptr, "{\n  \"backend\": \"%s\",\n  \"timestamp\": %llu,\n  \"results\": [\n", backends[backend], (unsigned long long)time(NULL));
+    for (uint32_t i = 0; i < bench_count; i++)
+    {
+        bench_result_t* r = &bench_results[i];
+        double ops_per_sec = r->total_ns > 0 ? r->ops / (r->total_ns / 1e9) : 0;
+        fprintf(fileptr, "    { \"name\": \"%s\", \"param\": \"%s\", \"ops\": %d, \"ops_per_sec\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"mb_per_sec\": %.1f }%s\n",
+                r->name, r->param, r->ops, ops_per_sec, (unsigned long long)r->p50_ns, (unsigned long long)r->p99_ns, r->mb_per_sec, i + 1 < bench_count ? "," : "");
+    }
+    fprintf(fileptr, "  ]\n}\n");
+    fclose(fileptr);
+    return TRUE;
+}
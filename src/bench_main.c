@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "ata.h"
+#include "bench.h"
+
+int main(int argc, char** argv)
+{
+    const char* output     = "bench.json";
+    uint32_t    iterations = 2000;
+    uint8_t     backend    = ATA_BACKEND_MEMORY;
+    bool_t      verbose    = FALSE;
+    bool_t      scaling    = FALSE;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) { output = argv[++i]; }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) { iterations = atoi(argv[++i]); }
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "memory")) { backend = ATA_BACKEND_MEMORY; }
+            else if (!strcmp(argv[i], "sync")) { backend = ATA_BACKEND_SYNC; }
+            else if (!strcmp(argv[i], "uring")) { backend = ATA_BACKEND_URING; }
+            else { printf("Invalid backend '%s'\n", argv[i]); return 2; }
+        }
+        else if (!strcmp(argv[i], "-v")) { verbose = TRUE; }
+        else if (!strcmp(argv[i], "-s")) { scaling = TRUE; }
+        else { printf("Usage: voy_bench [-o results.json] [-n iterations] [-b memory/sync/uring] [-v : show file system output] [-s : occupancy scaling stress]\n"); return 2; }
+    }
+    if (iterations == 0) { iterations = 1; }
+
+    // file system messages go to stdout, the summary goes to stderr
+    if (!verbose) { freopen("/dev/null", "w", stdout); }
+    ata_init();
+    if (scaling)
+    {
+        // table invariant violations fail the run after results are written
+        bool_t passed = bench_run_scaling(iterations, backend);
+        return (bench_write_json(output, backend) && passed) ? 0 : 1;
+    }
+    bench_run_all(iterations, backend);
+    return bench_write_json(output, backend) ? 0 : 1;
+}
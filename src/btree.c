@@ -0,0 +1,539 @@
+#include "btree.h"
+#include "ata.h"
+#include "crc32c.h"
+
+// block holding the index and its node count, set when attaching
+uint32_t btree_start = 0;
+uint32_t btree_nodes = 0;
+
+// node readers start from, BTREE_NONE while no index is attached - published after every node it reaches is written
+uint32_t btree_root = BTREE_NONE;
+
+// writer state, only touched while the name index write lock is held
+// nodes written by an update are fresh until released, the ones they replace are retired and freed once no reader can still see them
+btree_header_t btree_header;
+uint32_t       btree_fresh[8 * BTREE_DEPTH_MAX];
+uint32_t       btree_fresh_count = 0;
+uint32_t       btree_retired[8 * BTREE_DEPTH_MAX];
+uint32_t       btree_retired_count = 0;
+
+// sectors of an index block for a table of entries, enough for a full table of half full nodes
+uint32_t btree_sectors(uint32_t entries)
+{
+    uint32_t nodes = BTREE_SPARE, level = entries;
+    do
+    {
+        level = (level + BTREE_NODE_MIN - 1) / BTREE_NODE_MIN;
+        nodes += level;
+    } while (level > 1);
+    if (nodes > BTREE_NODES_MAX) { nodes = BTREE_NODES_MAX; }
+    return 1 + (nodes * BTREE_NODE_SECTORS);
+}
+
+uint32_t btree_sector(uint32_t node) { return btree_start + 1 + (node * BTREE_NODE_SECTORS); }
+
+// read node - returns FALSE when its number or count is not valid
+bool_t btree_read(uint32_t node, btree_node_t* data)
+{
+    if (node >= btree_nodes) { return FALSE; }
+    ata_read(btree_sector(node), BTREE_NODE_SECTORS, (uint8_t*)data);
+    return data->count <= BTREE_NODE_MAX;
+}
+
+void btree_write_node(uint32_t node, const btree_node_t* data) { ata_write(btree_sector(node), BTREE_NODE_SECTORS, (uint8_t*)data); }
+
+void btree_header_write()
+{
+    btree_header.checksum = 0;
+    if (fs_get_info().flags & FSFLAG_CHECKSUMS) { btree_header.checksum = crc32c(0, (uint8_t*)&btree_header, sizeof(btree_header_t) - sizeof(uint32_t)); }
+    ata_write(btree_start, 1, (uint8_t*)&btree_header);
+}
+
+bool_t btree_used(uint32_t node) { return (btree_header.used[node / 8] >> (node % 8)) & 1; }
+
+void btree_mark(uint32_t node, bool_t used)
+{
+    if (used) { btree_header.used[node / 8] |= (uint8_t)(1 << (node % 8)); }
+    else { btree_header.used[node / 8] &= (uint8_t)~(1 << (node % 8)); }
+}
+
+// lowest free node, marked used - returns BTREE_NONE when the block is full
+uint32_t btree_alloc()
+{
+    if (btree_fresh_count == 8 * BTREE_DEPTH_MAX) { return BTREE_NONE; }
+    for (uint32_t node = 0; node < btree_nodes; node++)
+    {
+        if (btree_header.used[node / 8] == 0xFF) { node += 7; continue; }
+        if (btree_used(node)) { continue; }
+        btree_mark(node, TRUE);
+        btree_fresh[btree_fresh_count++] = node;
+        return node;
+    }
+    return BTREE_NONE;
+}
+
+void btree_retire(uint32_t node) { if (btree_retired_count < 8 * BTREE_DEPTH_MAX) { btree_retired[btree_retired_count++] = node; } }
+
+// undo an update that failed halfway, nodes it wrote are freed and the ones it would have replaced stay
+void btree_rollback(uint32_t fresh, uint32_t retired)
+{
+    for (uint32_t i = fresh; i < btree_fresh_count; i++) { btree_mark(btree_fresh[i], FALSE); }
+    btree_fresh_count   = fresh;
+    btree_retired_count = retired;
+}
+
+void btree_publish(uint32_t root)
+{
+    btree_header.root = root;
+    __atomic_store_n(&btree_root, root, __ATOMIC_RELEASE);
+}
+
+int btree_compare(const btree_entry_t* a, const btree_entry_t* b)
+{
+    if (a->parent != b->parent) { return (a->parent < b->parent) ? -1 : 1; }
+    int cmp = strncmp(a->name, b->name, FS_NAME_MAX);
+    if (cmp != 0) { return cmp; }
+    return (int)a->type - (int)b->type;
+}
+
+// first position whose entry is not below key
+uint32_t btree_lower_bound(const btree_node_t* node, const btree_entry_t* key)
+{
+    uint32_t low = 0, high = node->count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (btree_compare(key, &node->entries[mid]) > 0) { low = mid + 1; }
+        else { high = mid; }
+    }
+    return low;
+}
+
+// child of inner node that holds key, the last one whose lowest entry is not above it
+uint32_t btree_child(const btree_node_t* node, const btree_entry_t* key)
+{
+    uint32_t low = 0, high = node->count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (btree_compare(key, &node->entries[mid]) >= 0) { low = mid + 1; }
+        else { high = mid; }
+    }
+    return (low > 0) ? low - 1 : 0;
+}
+
+// write count sorted entries to a new node, or to two new halves when they do not fit one
+// out gets the lowest entry and node of each - returns the number of nodes, 0 when the block is full
+uint32_t btree_emit(bool_t leaf, const btree_entry_t* entries, uint32_t count, btree_entry_t* out)
+{
+    uint32_t parts = (count > BTREE_NODE_MAX) ? 2 : 1;
+    btree_node_t* data = malloc(sizeof(btree_node_t));
+    for (uint32_t p = 0; p < parts; p++)
+    {
+        uint32_t start = (p * count) / parts;
+        uint32_t end   = ((p + 1) * count) / parts;
+        uint32_t node  = btree_alloc();
+        if (node == BTREE_NONE) { free(data); return 0; }
+        memset(data, 0, sizeof(btree_node_t));
+        data->leaf  = leaf;
+        data->count = end - start;
+        memcpy(data->entries, entries + start, (end - start) * sizeof(btree_entry_t));
+        btree_write_node(node, data);
+        if (end > start) { out[p] = entries[start]; }
+        else { memset(&out[p], 0, sizeof(btree_entry_t)); }
+        out[p].index = node;
+    }
+    free(data);
+    return parts;
+}
+
+// find the block of the index in the block table, the header is reset and has to be built or read
+bool_t btree_attach()
+{
+    fs_info_t info = fs_get_info();
+    fs_blkentry_t* table = fs_blktable_load();
+    uint32_t blk = 0;
+    for (uint32_t i = 2; i < info.blk_table_count_max && blk == 0; i++) { if (table[i].start != 0 && table[i].state == FSSTATE_INDEX) { blk = i; } }
+    bool_t found = blk != 0 && table[blk].count > BTREE_NODE_SECTORS;
+    if (found)
+    {
+        btree_start = table[blk].start;
+        btree_nodes = (table[blk].count - 1) / BTREE_NODE_SECTORS;
+        if (btree_nodes > BTREE_NODES_MAX) { btree_nodes = BTREE_NODES_MAX; }
+    }
+    free(table);
+    if (!found) { return FALSE; }
+
+    memset(&btree_header, 0, sizeof(btree_header_t));
+    btree_header.magic  = BTREE_MAGIC;
+    btree_header.nodes  = btree_nodes;
+    btree_header.root   = BTREE_NONE;
+    btree_fresh_count   = 0;
+    btree_retired_count = 0;
+    return TRUE;
+}
+
+// use the index as it was left on disk - returns FALSE when it is missing or its header is damaged
+bool_t btree_open()
+{
+    if (!btree_attach()) { return FALSE; }
+    btree_header_t header;
+    ata_read(btree_start, 1, (uint8_t*)&header);
+    if (header.magic != BTREE_MAGIC || header.nodes != btree_nodes || header.root >= btree_nodes) { return FALSE; }
+    if ((fs_get_info().flags & FSFLAG_CHECKSUMS) && crc32c(0, (uint8_t*)&header, sizeof(btree_header_t) - sizeof(uint32_t)) != header.checksum) { return FALSE; }
+    memcpy(&btree_header, &header, sizeof(btree_header_t));
+    if (!btree_used(header.root)) { return FALSE; }
+    btree_publish(header.root);
+    printf("Opened name index of %d entries\n", btree_header.count);
+    return TRUE;
+}
+
+// readers fall back to whatever else indexes the table until the index is built or opened again
+void btree_stop() { __atomic_store_n(&btree_root, BTREE_NONE, __ATOMIC_RELEASE); }
+
+bool_t btree_ready() { return __atomic_load_n(&btree_root, __ATOMIC_ACQUIRE) != BTREE_NONE; }
+
+// write tree over count sorted entries into an attached block, leaves first and in key order so they are read sequentially
+// no reader may use the index while it is built
+bool_t btree_build(const btree_entry_t* entries, uint32_t count)
+{
+    memset(btree_header.used, 0, BTREE_MAP_BYTES);
+    btree_fresh_count   = 0;
+    btree_retired_count = 0;
+
+    uint32_t       nodes = (count > BTREE_NODE_MAX) ? (count + BTREE_NODE_FILL - 1) / BTREE_NODE_FILL : 1;
+    btree_entry_t* level = malloc(nodes * sizeof(btree_entry_t));
+    bool_t         built = TRUE;
+    for (uint32_t n = 0; n < nodes && built; n++)
+    {
+        uint32_t start = (uint32_t)(((uint64_t)n * count) / nodes);
+        uint32_t end   = (uint32_t)(((uint64_t)(n + 1) * count) / nodes);
+        built = btree_emit(TRUE, entries + start, end - start, level + n) == 1;
+        btree_fresh_count = 0;
+    }
+
+    // each level groups the one below evenly, written over its front as groups never start before their own slot
+    while (nodes > 1 && built)
+    {
+        uint32_t groups = (nodes > BTREE_NODE_MAX) ? (nodes + BTREE_NODE_FILL - 1) / BTREE_NODE_FILL : 1;
+        for (uint32_t g = 0; g < groups && built; g++)
+        {
+            uint32_t start = (uint32_t)(((uint64_t)g * nodes) / groups);
+            uint32_t end   = (uint32_t)(((uint64_t)(g + 1) * nodes) / groups);
+            built = btree_emit(FALSE, level + start, end - start, level + g) == 1;
+            btree_fresh_count = 0;
+        }
+        nodes = groups;
+    }
+
+    if (built)
+    {
+        btree_header.count = count;
+        btree_publish(level[0].index);
+        btree_header_write();
+    }
+    free(level);
+    return built;
+}
+
+// copy of the subtree below node with entry inserted, out gets the lowest entry and node of one copy or of two halves
+// returns the number of nodes, 0 when the tree is damaged or the block is full
+uint32_t btree_insert_at(uint32_t node, const btree_entry_t* entry, btree_entry_t* out, uint32_t depth)
+{
+    btree_node_t* data = malloc(sizeof(btree_node_t));
+    uint32_t n = 0;
+    if (depth < BTREE_DEPTH_MAX && btree_read(node, data) && (data->leaf || data->count > 0))
+    {
+        btree_entry_t* entries = malloc((BTREE_NODE_MAX + 1) * sizeof(btree_entry_t));
+        uint32_t count = data->count;
+        uint32_t added = 1;
+        if (data->leaf)
+        {
+            uint32_t pos = btree_lower_bound(data, entry);
+            memcpy(entries, data->entries, pos * sizeof(btree_entry_t));
+            entries[pos] = *entry;
+            memcpy(entries + pos + 1, data->entries + pos, (count - pos) * sizeof(btree_entry_t));
+        }
+        else
+        {
+            btree_entry_t split[2];
+            uint32_t pos = btree_child(data, entry);
+            added = btree_insert_at(data->entries[pos].index, entry, split, depth + 1);
+            memcpy(entries, data->entries, pos * sizeof(btree_entry_t));
+            memcpy(entries + pos, split, added * sizeof(btree_entry_t));
+            memcpy(entries + pos + added, data->entries + pos + 1, (count - pos - 1) * sizeof(btree_entry_t));
+            count--;
+        }
+        if (added > 0)
+        {
+            btree_retire(node);
+            n = btree_emit(data->leaf, entries, count + added, out);
+        }
+        free(entries);
+    }
+    free(data);
+    return n;
+}
+
+// put the changed copy of the child at pos back into inner node, an empty child is dropped
+// a child below half full is merged with a neighbour, which is split again when both do not fit one node
+bool_t btree_replace(btree_node_t* node, uint32_t pos, btree_node_t* child)
+{
+    btree_entry_t written[2];
+    uint32_t first = pos, last = pos + 1, n = 0;
+    if (child->count > 0 && child->count < BTREE_NODE_MIN && node->count > 1)
+    {
+        uint32_t       other     = (pos + 1 < node->count) ? pos + 1 : pos - 1;
+        btree_node_t*  neighbour = malloc(sizeof(btree_node_t));
+        btree_entry_t* merged    = malloc(2 * BTREE_NODE_MAX * sizeof(btree_entry_t));
+        if (btree_read(node->entries[other].index, neighbour) && neighbour->leaf == child->leaf)
+        {
+            btree_node_t* left  = (other > pos) ? child : neighbour;
+            btree_node_t* right = (other > pos) ? neighbour : child;
+            memcpy(merged, left->entries, left->count * sizeof(btree_entry_t));
+            memcpy(merged + left->count, right->entries, right->count * sizeof(btree_entry_t));
+            n = btree_emit(child->leaf, merged, left->count + right->count, written);
+            btree_retire(node->entries[other].index);
+            first = (other > pos) ? pos : other;
+            last  = first + 2;
+        }
+        free(merged);
+        free(neighbour);
+        if (n == 0) { return FALSE; }
+    }
+    else if (child->count > 0)
+    {
+        n = btree_emit(child->leaf, child->entries, child->count, written);
+        if (n == 0) { return FALSE; }
+    }
+
+    memmove(node->entries + first + n, node->entries + last, (node->count - last) * sizeof(btree_entry_t));
+    memcpy(node->entries + first, written, n * sizeof(btree_entry_t));
+    node->count = node->count - (last - first) + n;
+    return TRUE;
+}
+
+// copy of the subtree below node without entry, out gets the copy of node unwritten so the caller can merge it
+// names are not unique on a damaged table, so every child whose range holds the name is searched and entries are matched by table index
+// returns 1 when removed, 0 when the entry is not below node and -1 when the tree is damaged or the block is full
+int btree_remove_at(uint32_t node, const btree_entry_t* entry, btree_node_t* out, uint32_t depth)
+{
+    if (depth >= BTREE_DEPTH_MAX || !btree_read(node, out)) { return -1; }
+    uint32_t pos = btree_lower_bound(out, entry);
+    if (out->leaf)
+    {
+        while (pos < out->count && btree_compare(entry, &out->entries[pos]) == 0 && out->entries[pos].index != entry->index) { pos++; }
+        if (pos >= out->count || btree_compare(entry, &out->entries[pos]) != 0) { return 0; }
+        memmove(out->entries + pos, out->entries + pos + 1, (out->count - pos - 1) * sizeof(btree_entry_t));
+        out->count--;
+        btree_retire(node);
+        return 1;
+    }
+
+    // the child before the first lowest entry not below the name may hold it as well
+    btree_node_t* child = malloc(sizeof(btree_node_t));
+    int result = 0;
+    if (pos > 0) { pos--; }
+    for (; pos < out->count && btree_compare(entry, &out->entries[pos]) >= 0; pos++)
+    {
+        result = btree_remove_at(out->entries[pos].index, entry, child, depth + 1);
+        if (result != 0) { break; }
+    }
+    if (result == 1)
+    {
+        result = btree_replace(out, pos, child) ? 1 : -1;
+        if (result == 1) { btree_retire(node); }
+    }
+    free(child);
+    return result;
+}
+
+// add entry, the new root is published once every node below it is written - returns FALSE when the index could not be updated
+bool_t btree_insert(const btree_entry_t* entry)
+{
+    uint32_t fresh = btree_fresh_count, retired = btree_retired_count;
+    btree_entry_t split[2], root;
+    uint32_t n = btree_insert_at(btree_header.root, entry, split, 0);
+
+    // a split root gets a new root above its two halves
+    if (n == 2) { n = btree_emit(FALSE, split, 2, &root); }
+    else if (n == 1) { root = split[0]; }
+    if (n == 0) { btree_rollback(fresh, retired); printf("Unable to add '%s' to name index\n", entry->name); return FALSE; }
+
+    btree_header.count++;
+    btree_publish(root.index);
+    return TRUE;
+}
+
+// remove entry for table index - returns FALSE when it was not indexed or the index could not be updated
+bool_t btree_remove(const btree_entry_t* entry)
+{
+    uint32_t fresh = btree_fresh_count, retired = btree_retired_count;
+    btree_node_t* data = malloc(sizeof(btree_node_t));
+    btree_entry_t root;
+    int result = btree_remove_at(btree_header.root, entry, data, 0);
+
+    // an inner root left with a single child is replaced by it, an empty root becomes an empty leaf
+    if (result == 1 && !data->leaf && data->count == 1) { root = data->entries[0]; }
+    else if (result == 1)
+    {
+        if (data->count == 0) { data->leaf = TRUE; }
+        if (btree_emit(data->leaf, data->entries, data->count, &root) == 0) { result = -1; }
+    }
+    free(data);
+
+    if (result != 1)
+    {
+        btree_rollback(fresh, retired);
+        if (result < 0) { printf("Unable to remove '%s' from name index\n", entry->name); }
+        return FALSE;
+    }
+    btree_header.count--;
+    btree_publish(root.index);
+    return TRUE;
+}
+
+// free nodes replaced by the last updates and write the header, called once no reader can still see them
+void btree_release()
+{
+    for (uint32_t i = 0; i < btree_retired_count; i++) { btree_mark(btree_retired[i], FALSE); }
+    btree_retired_count = 0;
+    btree_fresh_count   = 0;
+    btree_header_write();
+}
+
+// get table index of named child of parent - returns -1 if it does not exist
+// only valid between nameidx_read_begin and nameidx_read_end, nodes are never rewritten while a reader can reach them
+int btree_find(uint32_t parent, const char* name, uint32_t len, uint8_t type)
+{
+    uint32_t node = __atomic_load_n(&btree_root, __ATOMIC_ACQUIRE);
+    if (node == BTREE_NONE || len >= FS_NAME_MAX) { return -1; }
+
+    btree_entry_t key;
+    memset(&key, 0, sizeof(btree_entry_t));
+    key.parent = parent;
+    key.type   = type;
+    memcpy(key.name, name, len);
+
+    btree_node_t* data = malloc(sizeof(btree_node_t));
+    int index = -1;
+    for (uint32_t depth = 0; depth < BTREE_DEPTH_MAX && btree_read(node, data) && data->count > 0; depth++)
+    {
+        if (!data->leaf) { node = data->entries[btree_child(data, &key)].index; continue; }
+        uint32_t pos = btree_lower_bound(data, &key);
+        if (pos < data->count && btree_compare(&key, &data->entries[pos]) == 0) { index = data->entries[pos].index; }
+        break;
+    }
+    free(data);
+    return index;
+}
+
+// descend from node to a leaf along key, or along the first children when key is NULL
+void btree_cursor_descend(btree_cursor_t* cursor, uint32_t node, const btree_entry_t* key)
+{
+    while (btree_read(node, &cursor->leaf))
+    {
+        if (cursor->leaf.leaf) { cursor->next = (key != NULL) ? btree_lower_bound(&cursor->leaf, key) : 0; return; }
+        if (cursor->depth == BTREE_DEPTH_MAX || cursor->leaf.count == 0) { break; }
+        uint32_t level = cursor->depth++;
+        uint32_t pos   = (key != NULL) ? btree_child(&cursor->leaf, key) : 0;
+        for (uint32_t i = 0; i < cursor->leaf.count; i++) { cursor->children[level][i] = cursor->leaf.entries[i].index; }
+        cursor->counts[level] = cursor->leaf.count;
+        cursor->pos[level]    = pos + 1;
+        node = cursor->children[level][pos];
+    }
+    cursor->done = TRUE;
+}
+
+// start ordered walk at the first entry of parent - only valid between nameidx_read_begin and nameidx_read_end
+void btree_cursor_seek(btree_cursor_t* cursor, uint32_t parent)
+{
+    btree_entry_t key;
+    memset(&key, 0, sizeof(btree_entry_t));
+    key.parent = parent;
+    cursor->depth = 0;
+    cursor->next  = 0;
+    cursor->done  = FALSE;
+    cursor->leaf.count = 0;
+
+    uint32_t root = __atomic_load_n(&btree_root, __ATOMIC_ACQUIRE);
+    if (root == BTREE_NONE) { cursor->done = TRUE; return; }
+    btree_cursor_descend(cursor, root, &key);
+}
+
+// next entry in key order, across parents - returns NULL after the last one
+const btree_entry_t* btree_cursor_next(btree_cursor_t* cursor)
+{
+    while (!cursor->done)
+    {
+        if (cursor->next < cursor->leaf.count) { return &cursor->leaf.entries[cursor->next++]; }
+
+        // climb to the nearest level with children left and take the first leaf below the next one
+        while (cursor->depth > 0 && cursor->pos[cursor->depth - 1] >= cursor->counts[cursor->depth - 1]) { cursor->depth--; }
+        if (cursor->depth == 0) { cursor->done = TRUE; break; }
+        uint32_t level = cursor->depth - 1;
+        btree_cursor_descend(cursor, cursor->children[level][cursor->pos[level]++], NULL);
+    }
+    return NULL;
+}
+
+// check the nodes below node, seen marks visited nodes and leaf_depth is the depth of the first leaf found - returns problems found
+uint32_t btree_verify_node(uint32_t node, uint32_t depth, uint32_t* leaf_depth, uint8_t* seen, const btree_entry_t* low)
+{
+    if (node >= btree_nodes || depth >= BTREE_DEPTH_MAX) { printf("Name index node 0x%08x is out of range\n", node); return 1; }
+    if (seen[node / 8] & (1 << (node % 8))) { printf("Name index node 0x%08x is reached twice\n", node); return 1; }
+    seen[node / 8] |= (uint8_t)(1 << (node % 8));
+
+    btree_node_t* data = malloc(sizeof(btree_node_t));
+    uint32_t problems = 0;
+    if (!btree_read(node, data)) { printf("Name index node 0x%08x is damaged\n", node); free(data); return 1; }
+    if (!btree_used(node)) { printf("Name index node 0x%08x is used but marked free\n", node); problems++; }
+    if (low != NULL && (data->count == 0 || btree_compare(low, &data->entries[0]) != 0)) { printf("Name index node 0x%08x does not start at its key\n", node); problems++; }
+    for (uint32_t i = 1; i < data->count; i++)
+    {
+        if (btree_compare(&data->entries[i - 1], &data->entries[i]) > 0) { printf("Name index node 0x%08x is not sorted\n", node); problems++; break; }
+    }
+
+    if (data->leaf)
+    {
+        if (*leaf_depth == UINT32_MAX) { *leaf_depth = depth; }
+        else if (*leaf_depth != depth) { printf("Name index leaf 0x%08x is at depth %d, expected %d\n", node, depth, *leaf_depth); problems++; }
+    }
+    for (uint32_t i = 0; !data->leaf && i < data->count; i++) { problems += btree_verify_node(data->entries[i].index, depth + 1, leaf_depth, seen, &data->entries[i]); }
+    free(data);
+    return problems;
+}
+
+// check structure of the index, every node reachable from the root must be marked used and every other one free
+uint32_t btree_verify()
+{
+    uint32_t root = __atomic_load_n(&btree_root, __ATOMIC_ACQUIRE);
+    if (root == BTREE_NONE) { printf("Name index is missing\n"); return 1; }
+
+    uint8_t* seen = calloc(BTREE_MAP_BYTES, 1);
+    uint32_t leaf_depth = UINT32_MAX;
+    uint32_t problems = btree_verify_node(root, 0, &leaf_depth, seen, NULL);
+    for (uint32_t node = 0; node < btree_nodes; node++)
+    {
+        if (btree_used(node) && !(seen[node / 8] & (1 << (node % 8)))) { printf("Name index node 0x%08x is marked used but not reachable\n", node); problems++; }
+    }
+    free(seen);
+    return problems;
+}
+
+void btree_print()
+{
+    if (!btree_ready()) { printf("No on-disk name index, the table is indexed in memory\n"); return; }
+    uint32_t used = 0, depth = 0;
+    for (uint32_t node = 0; node < btree_nodes; node++) { if (btree_used(node)) { used++; } }
+
+    btree_node_t* data = malloc(sizeof(btree_node_t));
+    for (uint32_t node = btree_header.root; depth < BTREE_DEPTH_MAX && btree_read(node, data); depth++)
+    {
+        if (data->leaf || data->count == 0) { depth++; break; }
+        node = data->entries[0].index;
+    }
+    free(data);
+    printf("Name index: %d entries, %d of %d nodes used, depth %d, %d sectors at 0x%08x\n", btree_header.count, used, btree_nodes, depth,
+           1 + (btree_nodes * BTREE_NODE_SECTORS), btree_start);
+}
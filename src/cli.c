@@ -1,7 +1,19 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "cli.h"
 #include "fs.h"
 #include "vfs.h"
 #include "ata.h"
+#include "dedup.h"
+#include "pack.h"
+#include "btree.h"
+#include "fsck.h"
+#include "log.h"
+#include "trace.h"
+#include "stats.h"
+#include "heatmap.h"
+#include "export.h"
 
 char* CLI_DIR = NULL;
 
@@ -28,12 +40,31 @@ void cli_init()
     cli_register(CMD_NEWIMG);
     cli_register(CMD_SAVEIMG);
     cli_register(CMD_LOADIMG);
+    cli_register(CMD_OPENIMG);
     cli_register(CMD_UNLOADIMG);
+    cli_register(CMD_RESIZE);
+    cli_register(CMD_SNAPSHOT);
+    cli_register(CMD_ROLLBACK);
+    cli_register(CMD_OVERLAY);
+    cli_register(CMD_FLATTEN);
+    cli_register(CMD_DEFRAG);
+    cli_register(CMD_COMPRESS);
+    cli_register(CMD_DEDUP);
+    cli_register(CMD_PACK);
+    cli_register(CMD_INDEX);
+    cli_register(CMD_CHECK);
+    cli_register(CMD_LOG);
+    cli_register(CMD_TRACE);
+    cli_register(CMD_REPLAY);
+    cli_register(CMD_STATS);
+    cli_register(CMD_HEATMAP);
 
     cli_register(CMD_EXISTS);
     cli_register(CMD_MKDIR);
     cli_register(CMD_INFILE);
     cli_register(CMD_INDIR);
+    cli_register(CMD_OUTFILE);
+    cli_register(CMD_OUTDIR);
     cli_register(CMD_RM);
     cli_register(CMD_RMDIR);
     cli_register(CMD_REN);
@@ -124,20 +155,13 @@ void _FS_INFILE(char* dest, char* src)
     char* path_dest = dest;
     char* path_src  = src;
 
-    FILE* fileptr = fopen(path_src, "rb");
-    if (fileptr == NULL) { printf("Unable to locate file '%s'\n", path_src); return; }
-    fseek(fileptr, 0, SEEK_END);
-    size_t size = ftell(fileptr);
-    fseek(fileptr, 0, SEEK_SET);
-    if (size == 0) { printf("Unable to locate file '%s'\n", path_src); return; }
-
-    uint8_t* fdata = malloc(size);
-    fread(fdata, size, 1, fileptr);
+    int fd = open(path_src, O_RDONLY);
+    if (fd < 0) { printf("Unable to locate file '%s'\n", path_src); return; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { printf("Unable to locate file '%s'\n", path_src); close(fd); return; }
 
-    bool_t success = vfs_write_bytes(path_dest, fdata, size);
-
-    fclose(fileptr);
-    free(fdata);
+    bool_t success = vfs_import_file(path_dest, fd);
+    close(fd);
     if (success) { printf("Copied file '%s' from host to '%s' on disk\n", path_src, path_dest); }
     else { printf("Unable to copy file '%s' from host to '%s' on disk\n", path_src, path_dest); }
 }
@@ -252,7 +276,9 @@ void CMD_METHOD_SCRIPT(char* input, char** argv, int argc)
 
 void CMD_METHOD_FORMAT(char* input, char** argv, int argc)
 {
-    fs_format(ata_get_disk_size(), TRUE);
+    uint32_t flags = 0;
+    for (int i = 1; i < argc; i++) { if (!strcmp(argv[i], "-b")) { flags |= FSFLAG_BTREE; } }
+    fs_format(ata_get_disk_size(), TRUE, flags);
     fs_mount();
 }
 
@@ -276,11 +302,148 @@ void CMD_METHOD_LOADIMG(char* input, char** argv, int argc)
     fs_mount();
 }
 
+void CMD_METHOD_OPENIMG(char* input, char** argv, int argc)
+{
+    if (argc < 2) { printf("Usage: openimg [path] [-u : io_uring]\n"); return; }
+    uint8_t backend = (argc > 2 && !strcmp(argv[2], "-u")) ? ATA_BACKEND_URING : ATA_BACKEND_SYNC;
+    if (ata_open_file(argv[1], backend)) { fs_mount(); }
+}
+
 void CMD_METHOD_UNLOADIMG(char* input, char** argv, int argc)
 {
     ata_unload();
 }
 
+void CMD_METHOD_RESIZE(char* input, char** argv, int argc)
+{
+    // sizes are 32 bit on disk, larger ones are rejected rather than wrapped
+    char* end = NULL;
+    unsigned long long size = (argc == 2) ? strtoull(argv[1], &end, 10) : 0;
+    if (argc != 2 || end == argv[1] || *end != 0 || argv[1][0] == '-' || size > UINT32_MAX) { printf("Usage: %s\n", CMD_RESIZE.usage); return; }
+    if (!fs_resize((uint32_t)size)) { printf("Unable to resize disk image to %llu bytes\n", size); }
+}
+
+void CMD_METHOD_SNAPSHOT(char* input, char** argv, int argc)
+{
+    if (argc > 1 && !strcmp(argv[1], "take")) { ata_snapshot_take(); }
+    else if (argc > 1 && !strcmp(argv[1], "drop")) { ata_snapshot_drop(); }
+    else { ata_snapshot_print(); }
+}
+
+void CMD_METHOD_ROLLBACK(char* input, char** argv, int argc)
+{
+    // cached tables and indexes describe the discarded changes, mount again from restored sectors
+    if (ata_snapshot_rollback()) { fs_mount(); }
+}
+
+void CMD_METHOD_OVERLAY(char* input, char** argv, int argc)
+{
+    if (argc < 2) { ata_overlay_print(); return; }
+    if (argc < 3) { printf("Usage: overlay [delta_path] [base_path]\n"); return; }
+    if (ata_overlay_create(argv[1], argv[2])) { fs_mount(); }
+}
+
+void CMD_METHOD_FLATTEN(char* input, char** argv, int argc)
+{
+    if (argc < 2) { printf("Usage: flatten [path/-b : into base]\n"); return; }
+    if (!strcmp(argv[1], "-b")) { ata_overlay_commit(); return; }
+    if (ata_get_backend() != ATA_BACKEND_OVERLAY) { printf("Current disk image is not an overlay\n"); return; }
+    ata_save_file(argv[1]);
+}
+
+void CMD_METHOD_DEFRAG(char* input, char** argv, int argc)
+{
+    bool_t analyze = (argc > 1 && !strcmp(argv[1], "-a"));
+    if (!fs_defrag(analyze)) { printf("Unable to defragment disk\n"); }
+}
+
+void CMD_METHOD_COMPRESS(char* input, char** argv, int argc)
+{
+    if (argc > 1 && !strcmp(argv[1], "on")) { fs_set_compression(TRUE); }
+    else if (argc > 1 && !strcmp(argv[1], "off")) { fs_set_compression(FALSE); }
+    printf("Compression is %s\n", fs_get_compression() ? "on" : "off");
+}
+
+void CMD_METHOD_DEDUP(char* input, char** argv, int argc)
+{
+    if (argc > 1 && !strcmp(argv[1], "on")) { dedup_set_enabled(TRUE); }
+    else if (argc > 1 && !strcmp(argv[1], "off")) { dedup_set_enabled(FALSE); }
+    dedup_print();
+}
+
+void CMD_METHOD_PACK(char* input, char** argv, int argc)
+{
+    pack_print();
+}
+
+void CMD_METHOD_INDEX(char* input, char** argv, int argc)
+{
+    btree_print();
+}
+
+void CMD_METHOD_CHECK(char* input, char** argv, int argc)
+{
+    bool_t repair  = FALSE;
+    int    threads = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-r")) { repair = TRUE; }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) { threads = atoi(argv[++i]); }
+    }
+    fsck_run(repair, threads);
+}
+
+void CMD_METHOD_LOG(char* input, char** argv, int argc)
+{
+    if (argc > 1)
+    {
+        int level = log_parse_level(argv[1]);
+        if (level < 0) { printf("Invalid log level '%s'\n", argv[1]); return; }
+        log_set_level(level);
+    }
+    if (argc > 2)
+    {
+        int categories = log_parse_categories(argv[2]);
+        if (categories < 0) { printf("Invalid log categories '%s'\n", argv[2]); return; }
+        log_set_categories(categories);
+    }
+    log_print();
+}
+
+void CMD_METHOD_TRACE(char* input, char** argv, int argc)
+{
+    if (argc > 2 && !strcmp(argv[1], "start")) { trace_start(argv[2]); }
+    else if (argc > 1 && !strcmp(argv[1], "stop")) { trace_stop(); }
+    else { printf("Trace is %s\n", trace_active ? "being recorded" : "off"); }
+}
+
+void CMD_METHOD_REPLAY(char* input, char** argv, int argc)
+{
+    if (argc < 2) { printf("Usage: %s\n", CMD_REPLAY.usage); return; }
+    bool_t paced = (argc > 2 && !strcmp(argv[2], "-p"));
+    trace_replay(argv[1], paced);
+}
+
+void CMD_METHOD_STATS(char* input, char** argv, int argc)
+{
+    if (argc > 1 && !strcmp(argv[1], "reset")) { stats_reset(); printf("Statistics reset\n"); return; }
+    if (argc > 2 && !strcmp(argv[1], "json"))
+    {
+        if (argc > 3 && !strcmp(argv[3], "-x")) { stats_write_on_exit(argv[2]); printf("Statistics will be written to '%s' on exit\n", argv[2]); }
+        else if (stats_write_json(argv[2])) { printf("Statistics written to '%s'\n", argv[2]); }
+        return;
+    }
+    stats_print();
+}
+
+void CMD_METHOD_HEATMAP(char* input, char** argv, int argc)
+{
+    if (argc > 1 && !strcmp(argv[1], "start")) { heatmap_start(fs_get_info()); }
+    else if (argc > 1 && !strcmp(argv[1], "stop")) { heatmap_stop(); }
+    else if (argc > 1 && !strcmp(argv[1], "reset")) { heatmap_reset(); printf("Heatmap reset\n"); }
+    else { heatmap_print(); }
+}
+
 void CMD_METHOD_EXISTS(char* input, char** argv, int argc)
 {
     char* path = (char*)(input + 7);
@@ -349,6 +512,21 @@ void CMD_METHOD_INDIR(char* input, char** argv, int argc)
     printf("Importing entire directories at once not yet supported\n");
 }
 
+void CMD_METHOD_OUTFILE(char* input, char** argv, int argc)
+{
+    if (argc < 3) { printf("Invalid arguments\n"); return; }
+    if (export_file(argv[1], argv[2], NULL)) { printf("Copied file '%s' on disk to '%s' on host\n", argv[2], argv[1]); }
+    else { printf("Unable to copy file '%s' on disk to '%s' on host\n", argv[2], argv[1]); }
+}
+
+void CMD_METHOD_OUTDIR(char* input, char** argv, int argc)
+{
+    if (argc < 3) { printf("Invalid arguments\n"); return; }
+    int threads = 0;
+    if (argc > 4 && !strcmp(argv[3], "-t")) { threads = atoi(argv[4]); }
+    export_dir(argv[1], argv[2], threads);
+}
+
 void CMD_METHOD_RM(char* input, char** argv, int argc)
 {
     char* path = (char*)(input + 3);
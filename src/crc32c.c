@@ -0,0 +1,107 @@
+#include "crc32c.h"
+
+typedef uint32_t (*crc32c_func_t)(uint32_t, const uint8_t*, uint32_t);
+
+uint32_t      crc32c_table[8][256];
+crc32c_func_t crc32c_func = NULL;
+
+// slicing-by-8 software implementation
+uint32_t crc32c_sw(uint32_t crc, const uint8_t* data, uint32_t len)
+{
+    crc = ~crc;
+    while (len > 0 && ((uintptr_t)data & 7)) { crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8); len--; }
+
+    while (len >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, data, sizeof(uint32_t));
+        memcpy(&hi, data + 4, sizeof(uint32_t));
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^ crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^ crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        data += 8;
+        len  -= 8;
+    }
+
+    while (len-- > 0) { crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8); }
+    return ~crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// sse4.2 crc32 instruction
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const uint8_t* data, uint32_t len)
+{
+    crc = ~crc;
+    while (len > 0 && ((uintptr_t)data & 7)) { crc = __builtin_ia32_crc32qi(crc, *data++); len--; }
+
+#if defined(__x86_64__)
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, data, sizeof(uint64_t));
+        crc = (uint32_t)__builtin_ia32_crc32di(crc, v);
+        data += 8;
+        len  -= 8;
+    }
+#endif
+
+    while (len >= 4)
+    {
+        uint32_t v;
+        memcpy(&v, data, sizeof(uint32_t));
+        crc = __builtin_ia32_crc32si(crc, v);
+        data += 4;
+        len  -= 4;
+    }
+
+    while (len-- > 0) { crc = __builtin_ia32_crc32qi(crc, *data++); }
+    return ~crc;
+}
+#endif
+
+void crc32c_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) { crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1; }
+        crc32c_table[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (int j = 1; j < 8; j++) { crc32c_table[j][i] = crc32c_table[0][crc32c_table[j - 1][i] & 0xFF] ^ (crc32c_table[j - 1][i] >> 8); }
+    }
+
+    crc32c_func = crc32c_sw;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) { crc32c_func = crc32c_hw; }
+#endif
+}
+
+bool_t crc32c_hardware()
+{
+    if (crc32c_func == NULL) { crc32c_init(); }
+    return crc32c_func != crc32c_sw;
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, uint32_t len)
+{
+    if (crc32c_func == NULL) { crc32c_init(); }
+    return crc32c_func(crc, data, len);
+}
+
+// continue checksum over specified amount of zero bytes
+uint32_t crc32c_zeros(uint32_t crc, uint32_t len)
+{
+    static const uint8_t zeros[512] = { 0 };
+    while (len > 0)
+    {
+        uint32_t count = len > sizeof(zeros) ? sizeof(zeros) : len;
+        crc = crc32c(crc, zeros, count);
+        len -= count;
+    }
+    return crc;
+}
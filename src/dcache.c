@@ -0,0 +1,175 @@
+#include <pthread.h>
+#include "dcache.h"
+#include "stats.h"
+
+// slots are direct mapped by hash, a newer result replaces whatever shared its slot
+dcache_entry_t  dcache_slots[DCACHE_SLOTS];
+pthread_mutex_t dcache_locks[DCACHE_STRIPES] = { [0 ... DCACHE_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER };
+
+// bumped by every invalidation, results walked across a change are not inserted
+uint32_t dcache_gen = 0;
+
+uint32_t dcache_hash_bytes(uint32_t hash, const char* str, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) { hash = (hash ^ (uint8_t)str[i]) * 16777619u; }
+    return hash;
+}
+
+// hash of first depth components joined by '/' and type, matches the hash of the joined string
+uint32_t dcache_hash_path(const fs_path_t* path, uint32_t depth, uint8_t type)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        if (i > 0) { hash = dcache_hash_bytes(hash, "/", 1); }
+        hash = dcache_hash_bytes(hash, path->parts[i].str, path->parts[i].len);
+    }
+    return (hash ^ type) * 16777619u;
+}
+
+uint32_t dcache_hash_str(const char* str, uint32_t len, uint8_t type) { return (dcache_hash_bytes(2166136261u, str, len) ^ type) * 16777619u; }
+
+// length of first depth components joined by '/'
+uint32_t dcache_path_len(const fs_path_t* path, uint32_t depth)
+{
+    uint32_t len = depth - 1;
+    for (uint32_t i = 0; i < depth; i++) { len += path->parts[i].len; }
+    return len;
+}
+
+bool_t dcache_match(const dcache_entry_t* entry, const fs_path_t* path, uint32_t depth)
+{
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        if (i > 0 && (pos >= entry->len || entry->path[pos++] != '/')) { return FALSE; }
+        if (pos + path->parts[i].len > entry->len || memcmp(entry->path + pos, path->parts[i].str, path->parts[i].len)) { return FALSE; }
+        pos += path->parts[i].len;
+    }
+    return pos == entry->len;
+}
+
+uint32_t dcache_generation() { return __atomic_load_n(&dcache_gen, __ATOMIC_SEQ_CST); }
+
+// cached result of resolving first depth components as type - returns FALSE when not cached
+bool_t dcache_lookup(const fs_path_t* path, uint32_t depth, uint8_t type, int* index)
+{
+    if (depth == 0 || dcache_path_len(path, depth) > DCACHE_PATH_MAX) { return FALSE; }
+    uint32_t hash = dcache_hash_path(path, depth, type);
+    uint32_t slot = hash % DCACHE_SLOTS;
+
+    pthread_mutex_lock(&dcache_locks[slot % DCACHE_STRIPES]);
+    dcache_entry_t* entry = &dcache_slots[slot];
+    bool_t found = entry->used && entry->hash == hash && entry->type == type && dcache_match(entry, path, depth);
+    if (found) { *index = entry->index; }
+    pthread_mutex_unlock(&dcache_locks[slot % DCACHE_STRIPES]);
+    STAT_ADD(found ? STAT_DCACHE_HITS : STAT_DCACHE_MISSES, 1);
+    return found;
+}
+
+// remember result of a walk, generation is taken before the walk started
+void dcache_insert(const fs_path_t* path, uint32_t depth, uint8_t type, int index, uint32_t generation)
+{
+    uint32_t len = (depth == 0) ? 0 : dcache_path_len(path, depth);
+    if (depth == 0 || len > DCACHE_PATH_MAX) { return; }
+    uint32_t hash = dcache_hash_path(path, depth, type);
+    uint32_t slot = hash % DCACHE_SLOTS;
+
+    // checked under the slot lock, an invalidation either sees this entry or has already changed the generation
+    pthread_mutex_lock(&dcache_locks[slot % DCACHE_STRIPES]);
+    if (__atomic_load_n(&dcache_gen, __ATOMIC_SEQ_CST) == generation)
+    {
+        dcache_entry_t* entry = &dcache_slots[slot];
+        uint32_t pos = 0;
+        for (uint32_t i = 0; i < depth; i++)
+        {
+            if (i > 0) { entry->path[pos++] = '/'; }
+            memcpy(entry->path + pos, path->parts[i].str, path->parts[i].len);
+            pos += path->parts[i].len;
+        }
+        entry->hash  = hash;
+        entry->index = index;
+        entry->type  = type;
+        entry->len   = len;
+        entry->used  = TRUE;
+    }
+    pthread_mutex_unlock(&dcache_locks[slot % DCACHE_STRIPES]);
+}
+
+// full path of entry taken from the file table - returns -1 when its parents do not lead to root, 0 when it is too long to be cached
+int dcache_path(fs_directory_t entry, char* out, uint32_t* len)
+{
+    fs_directory_t chain[FS_PATH_DEPTH_MAX];
+    uint32_t depth  = 0;
+    uint32_t parent = entry.parent_index;
+    chain[depth++] = entry;
+    while (parent != 0)
+    {
+        if (depth == FS_PATH_DEPTH_MAX) { return -1; }
+        fs_directory_t dir = fs_filetable_read_dir(parent);
+        if (dir.type != FSTYPE_DIR) { return -1; }
+        chain[depth++] = dir;
+        parent = dir.parent_index;
+    }
+
+    uint32_t pos = 0;
+    for (int i = depth - 1; i >= 0; i--)
+    {
+        uint32_t n = strnlen(chain[i].name, FS_NAME_MAX);
+        if (pos + n + 1 > DCACHE_PATH_MAX) { return 0; }
+        if (pos > 0) { out[pos++] = '/'; }
+        memcpy(out + pos, chain[i].name, n);
+        pos += n;
+    }
+    *len = pos;
+    return 1;
+}
+
+void dcache_drop(const char* path, uint32_t len, uint8_t type)
+{
+    uint32_t hash = dcache_hash_str(path, len, type);
+    uint32_t slot = hash % DCACHE_SLOTS;
+    pthread_mutex_lock(&dcache_locks[slot % DCACHE_STRIPES]);
+    dcache_entry_t* entry = &dcache_slots[slot];
+    if (entry->used && entry->hash == hash && entry->len == len && !memcmp(entry->path, path, len)) { entry->used = FALSE; }
+    pthread_mutex_unlock(&dcache_locks[slot % DCACHE_STRIPES]);
+}
+
+// drop every path below directory, or every path when prefix is NULL
+void dcache_drop_below(const char* prefix, uint32_t len)
+{
+    for (uint32_t stripe = 0; stripe < DCACHE_STRIPES; stripe++)
+    {
+        pthread_mutex_lock(&dcache_locks[stripe]);
+        for (uint32_t slot = stripe; slot < DCACHE_SLOTS; slot += DCACHE_STRIPES)
+        {
+            dcache_entry_t* entry = &dcache_slots[slot];
+            if (!entry->used) { continue; }
+            if (prefix == NULL || (entry->len > len && entry->path[len] == '/' && !memcmp(entry->path, prefix, len))) { entry->used = FALSE; }
+        }
+        pthread_mutex_unlock(&dcache_locks[stripe]);
+    }
+}
+
+// forget every result entry could have changed, called with the old and the new entry after the name index was updated
+// the path itself under both types and for directories every path below it, missing paths there may exist now
+void dcache_invalidate(fs_directory_t entry)
+{
+    if (entry.type == FSTYPE_NULL) { return; }
+    __atomic_add_fetch(&dcache_gen, 1, __ATOMIC_SEQ_CST);
+
+    char     path[DCACHE_PATH_MAX];
+    uint32_t len = 0;
+    int      result = dcache_path(entry, path, &len);
+    if (result < 0) { dcache_drop_below(NULL, 0); return; }
+    if (result == 0) { return; }
+    dcache_drop(path, len, FSTYPE_DIR);
+    dcache_drop(path, len, FSTYPE_FILE);
+    if (entry.type == FSTYPE_DIR) { dcache_drop_below(path, len); }
+}
+
+void dcache_clear()
+{
+    __atomic_add_fetch(&dcache_gen, 1, __ATOMIC_SEQ_CST);
+    dcache_drop_below(NULL, 0);
+}
@@ -0,0 +1,169 @@
+#include "dedup.h"
+#include "fs.h"
+#include "ata.h"
+#include "fslock.h"
+
+// index is guarded by the allocator lock, it changes together with block reference counts
+bool_t    dedup_enabled = FALSE;
+int*      dedup_buckets = NULL;
+int*      dedup_next    = NULL;
+uint64_t* dedup_hashes  = NULL;
+uint32_t  dedup_max     = 0;
+uint32_t  dedup_count   = 0;
+
+void dedup_set_enabled(bool_t enabled)
+{
+    dedup_enabled = enabled;
+    if (enabled && ata_loaded()) { dedup_build(); }
+    if (!enabled) { dedup_clear(); }
+}
+
+bool_t dedup_get_enabled() { return dedup_enabled; }
+
+void dedup_clear()
+{
+    fslock_alloc();
+    if (dedup_buckets != NULL) { free(dedup_buckets); dedup_buckets = NULL; }
+    if (dedup_next != NULL) { free(dedup_next); dedup_next = NULL; }
+    if (dedup_hashes != NULL) { free(dedup_hashes); dedup_hashes = NULL; }
+    dedup_max   = 0;
+    dedup_count = 0;
+    fslock_alloc_unlock();
+}
+
+uint64_t dedup_mix(uint64_t h, uint64_t v)
+{
+    h ^= v * 0x9E3779B97F4A7C15ull;
+    h  = (h << 31) | (h >> 33);
+    return h * 0xC2B2AE3D27D4EB4Full;
+}
+
+// hash data as it is stored on disk - bytes past len up to the sector boundary count as zeros
+uint64_t dedup_hash(const uint8_t* data, uint32_t len, uint32_t sectors)
+{
+    uint64_t h = 0xCBF29CE484222325ull ^ sectors;
+    uint32_t words = len / sizeof(uint64_t);
+    for (uint32_t i = 0; i < words; i++)
+    {
+        uint64_t v;
+        memcpy(&v, data + (i * sizeof(uint64_t)), sizeof(uint64_t));
+        h = dedup_mix(h, v);
+    }
+
+    if (len % sizeof(uint64_t) != 0)
+    {
+        uint64_t tail = 0;
+        memcpy(&tail, data + (words * sizeof(uint64_t)), len % sizeof(uint64_t));
+        h = dedup_mix(h, tail);
+        words++;
+    }
+
+    // zero padding of the final sector
+    for (; words < (sectors * ATA_SECTOR_SIZE) / sizeof(uint64_t); words++) { h = dedup_mix(h, 0); }
+    return h ^ (h >> 29);
+}
+
+// hash every used block on disk
+void dedup_build()
+{
+    fslock_alloc();
+    dedup_clear();
+    fs_info_t info = fs_get_info();
+    dedup_max     = info.blk_table_count_max;
+    dedup_buckets = malloc(sizeof(int) * DEDUP_BUCKETS);
+    dedup_next    = malloc(sizeof(int) * dedup_max);
+    dedup_hashes  = malloc(sizeof(uint64_t) * dedup_max);
+    for (uint32_t i = 0; i < DEDUP_BUCKETS; i++) { dedup_buckets[i] = -1; }
+    for (uint32_t i = 0; i < dedup_max; i++) { dedup_next[i] = -1; }
+
+    fs_blkentry_t* table = fs_blktable_load();
+    uint8_t* data = NULL;
+    uint32_t data_sectors = 0;
+
+    // index 1 is the file table itself
+    for (uint32_t i = 2; i < dedup_max; i++)
+    {
+        if (table[i].start == 0 || table[i].count == 0 || table[i].state != FSSTATE_USED) { continue; }
+        if (table[i].count > data_sectors) { data_sectors = table[i].count; data = realloc(data, data_sectors * ATA_SECTOR_SIZE); }
+        ata_read(table[i].start, table[i].count, data);
+        dedup_insert(dedup_hash(data, table[i].count * ATA_SECTOR_SIZE, table[i].count), i);
+    }
+
+    if (data != NULL) { free(data); }
+    free(table);
+    printf("Built deduplication index of %d blocks\n", dedup_count);
+    fslock_alloc_unlock();
+}
+
+// locate used block with identical contents - returns block index or -1
+int dedup_find(uint64_t hash, const uint8_t* data, uint32_t len, uint32_t sectors)
+{
+    fslock_alloc();
+    if (dedup_buckets == NULL) { fslock_alloc_unlock(); return -1; }
+
+    uint8_t* blkdata = NULL;
+    for (int i = dedup_buckets[hash % DEDUP_BUCKETS]; i >= 0; i = dedup_next[i])
+    {
+        if (dedup_hashes[i] != hash) { continue; }
+        fs_blkentry_t blk = fs_blktable_read(i);
+        if (blk.count != sectors || blk.state != FSSTATE_USED) { continue; }
+
+        // confirm contents so hash collisions never share data
+        if (blkdata == NULL) { blkdata = malloc(sectors * ATA_SECTOR_SIZE); }
+        ata_read(blk.start, blk.count, blkdata);
+        bool_t equal = !memcmp(blkdata, data, len);
+        for (uint32_t j = len; equal && j < sectors * ATA_SECTOR_SIZE; j++) { if (blkdata[j] != 0) { equal = FALSE; } }
+        if (equal) { free(blkdata); fslock_alloc_unlock(); return i; }
+    }
+
+    if (blkdata != NULL) { free(blkdata); }
+    fslock_alloc_unlock();
+    return -1;
+}
+
+void dedup_insert(uint64_t hash, int index)
+{
+    fslock_alloc();
+    if (dedup_buckets == NULL || index < 0 || index >= dedup_max) { fslock_alloc_unlock(); return; }
+    dedup_remove(index);
+    dedup_hashes[index] = hash;
+    dedup_next[index]   = dedup_buckets[hash % DEDUP_BUCKETS];
+    dedup_buckets[hash % DEDUP_BUCKETS] = index;
+    dedup_count++;
+    fslock_alloc_unlock();
+}
+
+void dedup_remove(int index)
+{
+    fslock_alloc();
+    if (dedup_buckets == NULL || index < 0 || index >= dedup_max) { fslock_alloc_unlock(); return; }
+
+    int* link = &dedup_buckets[dedup_hashes[index] % DEDUP_BUCKETS];
+    while (*link >= 0 && *link != index) { link = &dedup_next[*link]; }
+    if (*link == index)
+    {
+        *link = dedup_next[index];
+        dedup_next[index] = -1;
+        dedup_count--;
+    }
+    fslock_alloc_unlock();
+}
+
+void dedup_print()
+{
+    printf("Deduplication is %s\n", dedup_enabled ? "on" : "off");
+    fslock_alloc();
+    if (dedup_buckets == NULL) { fslock_alloc_unlock(); return; }
+
+    uint32_t shared = 0, saved = 0;
+    fs_blkentry_t* table = fs_blktable_load();
+    for (uint32_t i = 2; i < dedup_max; i++)
+    {
+        if (table[i].start == 0 || table[i].state != FSSTATE_USED || table[i].refs <= 1) { continue; }
+        shared++;
+        saved += table[i].count * (table[i].refs - 1);
+    }
+    free(table);
+    fslock_alloc_unlock();
+    printf("INDEXED: %d blocks, SHARED: %d blocks, SAVED: %d sectors\n", dedup_count, shared, saved);
+}
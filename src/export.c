@@ -0,0 +1,148 @@
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "export.h"
+#include "fs.h"
+#include "nameidx.h"
+#include "stats.h"
+
+// export one file, host file is created or truncated - bytes written are added to bytes when given
+bool_t export_file(const char* host, const char* path, uint64_t* bytes)
+{
+    int fd = open(host, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { printf("Unable to create host file '%s'\n", host); return FALSE; }
+    bool_t result = fs_file_export(path, fd);
+    struct stat st;
+    if (result && bytes != NULL && fstat(fd, &st) == 0) { *bytes += st.st_size; }
+    close(fd);
+    if (!result) { unlink(host); }
+    return result;
+}
+
+void* export_worker(void* arg)
+{
+    export_batch_t* batch = (export_batch_t*)arg;
+    uint64_t bytes = 0;
+    while (TRUE)
+    {
+        uint32_t i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (i >= batch->end) { break; }
+        export_job_t* job = &batch->jobs[i];
+        bool_t ok;
+        if (job->type == FSTYPE_DIR)
+        {
+            ok = mkdir(job->host, 0755) == 0 || errno == EEXIST;
+            if (!ok) { printf("Unable to create host directory '%s'\n", job->host); }
+        }
+        else { ok = export_file(job->host, job->path, &bytes); }
+        if (!ok) { __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED); }
+    }
+    __atomic_fetch_add(&batch->bytes, bytes, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// run jobs start to end on all workers and wait for them
+void export_run(export_batch_t* batch, uint32_t start, uint32_t end, int threads)
+{
+    if (start >= end) { return; }
+    batch->start = start;
+    batch->end   = end;
+    batch->next  = start;
+    if (threads > (int)(end - start)) { threads = end - start; }
+
+    pthread_t workers[EXPORT_THREADS_MAX];
+    for (int t = 1; t < threads; t++) { pthread_create(&workers[t], NULL, export_worker, batch); }
+    export_worker(batch);
+    for (int t = 1; t < threads; t++) { pthread_join(workers[t], NULL); }
+}
+
+char* export_join(const char* parent, const char* name)
+{
+    size_t len  = strlen(parent);
+    char*  path = malloc(len + strlen(name) + 2);
+    strcpy(path, parent);
+    if (len == 0 || parent[len - 1] != '/') { strcat(path, "/"); }
+    strcat(path, name);
+    return path;
+}
+
+// export directory tree, the tree is listed breadth first so jobs are ordered by depth
+bool_t export_dir(const char* host, const char* path, int threads)
+{
+    int root = nameidx_resolve(path, FSTYPE_DIR);
+    if (root < 0) { printf("Unable to locate directory '%s'\n", path); return FALSE; }
+    if (threads <= 0) { threads = sysconf(_SC_NPROCESSORS_ONLN); }
+    if (threads < 1) { threads = 1; }
+    if (threads > EXPORT_THREADS_MAX) { threads = EXPORT_THREADS_MAX; }
+
+    uint32_t      max   = 64;
+    uint32_t      count = 1;
+    export_job_t* jobs  = malloc(max * sizeof(export_job_t));
+    uint32_t*     dirs  = malloc(max * sizeof(uint32_t));
+    jobs[0].host  = strdup(host);
+    jobs[0].path  = strdup(path);
+    jobs[0].type  = FSTYPE_DIR;
+    jobs[0].depth = 0;
+    dirs[0]       = root;
+
+    // each listing is one consistent version, entries changed while walking may be missed
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (jobs[i].type != FSTYPE_DIR) { continue; }
+        uint32_t epoch = nameidx_read_begin();
+        nameidx_cursor_t cursor;
+        nameidx_cursor_begin(&cursor, dirs[i]);
+        for (const nameidx_entry_t* entry = nameidx_cursor_next(&cursor); entry != NULL; entry = nameidx_cursor_next(&cursor))
+        {
+            if (count == max)
+            {
+                max *= 2;
+                jobs = realloc(jobs, max * sizeof(export_job_t));
+                dirs = realloc(dirs, max * sizeof(uint32_t));
+            }
+            jobs[count].host  = export_join(jobs[i].host, entry->name);
+            jobs[count].path  = export_join(jobs[i].path, entry->name);
+            jobs[count].type  = entry->type;
+            jobs[count].depth = jobs[i].depth + 1;
+            dirs[count]       = entry->index;
+            count++;
+        }
+        nameidx_read_end(epoch);
+    }
+
+    // directories one depth at a time, then every file at once
+    uint64_t started = stats_now();
+    export_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.jobs = jobs;
+    uint32_t dir_count = 0;
+    for (uint32_t i = 0; i < count;)
+    {
+        uint32_t depth = jobs[i].depth, end = i;
+        uint32_t level_start = dir_count;
+        for (; end < count && jobs[end].depth == depth; end++)
+        {
+            // directories move to the front, files stay behind them in the order listed
+            if (jobs[end].type != FSTYPE_DIR) { continue; }
+            export_job_t tmp = jobs[end];
+            jobs[end] = jobs[dir_count];
+            jobs[dir_count] = tmp;
+            dir_count++;
+        }
+        export_run(&batch, level_start, dir_count, threads);
+        i = end;
+    }
+    export_run(&batch, dir_count, count, threads);
+    uint64_t elapsed = stats_now() - started;
+
+    printf("Exported %d files in %d directories, %llu bytes in %llu ms (%.1f MB/s) with %d threads\n", count - dir_count, dir_count,
+           (unsigned long long)batch.bytes, (unsigned long long)(elapsed / 1000000), elapsed > 0 ? (batch.bytes / (1024.0 * 1024.0)) / (elapsed / 1e9) : 0.0, threads);
+    if (batch.failed > 0) { printf("Unable to export %d entries\n", batch.failed); }
+
+    for (uint32_t i = 0; i < count; i++) { free(jobs[i].host); free(jobs[i].path); }
+    free(jobs);
+    free(dirs);
+    return batch.failed == 0;
+}
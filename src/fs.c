@@ -1,8 +1,20 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "fs.h"
 #include "ata.h"
+#include "lz.h"
+#include "dedup.h"
+#include "pack.h"
+#include "crc32c.h"
+#include "fslock.h"
+#include "nameidx.h"
+#include "btree.h"
+#include "log.h"
+#include "stats.h"
 
 // null structures
-fs_blkentry_t  NULL_BLKENTRY = { 0, 0, 0, { 0, 0, 0, 0, 0, 0 } };
+fs_blkentry_t  NULL_BLKENTRY = { 0, 0, 0, 0, 0 };
 fs_directory_t NULL_DIR      = { "", 0, 0, 0, { 0 } };
 fs_file_t      NULL_FILE     = { "", 0, 0, 0, 0, 0, NULL };
 
@@ -11,50 +23,90 @@ fs_info_t      fs_info;
 fs_blkentry_t  fs_blk_mass;
 fs_blkentry_t  fs_blk_files;
 fs_directory_t fs_rootdir;
+bool_t         fs_compression = FALSE;
+uint32_t*      fs_crc_table   = NULL;
+
+// table index searches for a free entry start at, lowered when an entry is freed - only a hint as the search wraps around
+uint32_t       fs_filetable_hint = 0;
 
 // mount file system from disk image
 void fs_mount()
 {
+    fslock_path_write();
+    fslock_file_write_all();
     fs_info_read();
     fs_blk_mass = fs_blktable_read(0);
     fs_blk_files = fs_blktable_read(1);
     fs_rootdir = fs_filetable_read_dir(0);
+    __atomic_store_n(&fs_filetable_hint, 0, __ATOMIC_RELAXED);
+    fs_verify();
+    nameidx_open();
+    pack_build();
+    if (dedup_get_enabled()) { dedup_build(); }
+    fslock_file_unlock_all();
+    fslock_path_unlock();
     printf("Mounted file system\n");
 }
 
 // format disk of specified size to file system
-void fs_format(uint32_t size, bool_t wipe)
+void fs_format(uint32_t size, bool_t wipe, uint32_t flags)
 {
     printf("Fomatting disk...\n");
+    fslock_path_write();
+    fslock_file_write_all();
+    nameidx_clear();
     if (wipe) { fs_wipe(size); }
+    if (fs_crc_table != NULL) { free(fs_crc_table); fs_crc_table = NULL; }
 
     // generate info block
     fs_info_create(size);
-    fs_info_read();
+    fs_info.flags |= flags;
 
     // create mass block entry
     fs_blk_mass.start = fs_info.blk_data_start;
     fs_blk_mass.count = fs_info.blk_data_sector_count;
     fs_blk_mass.state = FSSTATE_FREE;
-    memset(fs_blk_mass.padding, 0, sizeof(fs_blk_mass.padding));
+    fs_blk_mass.refs  = 0;
+    fs_blk_mass.crc   = 0;
     fs_blktable_write(0, fs_blk_mass);
     fs_blk_mass = fs_blktable_read(0);
     printf("Created mass block: START: %d, STATE = 0x%02x, COUNT = %d\n", fs_blk_mass.start, fs_blk_mass.state, fs_blk_mass.count);
 
     // create files block entry and update info
-    fs_info_read();
-    fs_info.file_table_count_max = 32768;
+    fs_info.file_table_count_max = FS_FILE_COUNT_MAX;
     fs_info.file_table_count     = 0;
     fs_info.file_table_sector_count = (fs_info.file_table_count_max * sizeof(fs_file_t)) / ATA_SECTOR_SIZE;
     fs_info_write();
     fs_blk_files = fs_blktable_allocate(fs_info.file_table_sector_count);
     fs_info.file_table_start = fs_blk_files.start;
+
+    // create name index block, sized for a full file table
+    if (fs_info.flags & FSFLAG_BTREE)
+    {
+        fs_blkentry_t index = fs_blktable_allocate(btree_sectors(fs_info.file_table_count_max));
+        if (index.start == 0) { printf("Unable to allocate name index, file table is indexed in memory\n"); fs_info.flags &= ~FSFLAG_BTREE; }
+        else
+        {
+            int blk = fs_blktable_get_index(index);
+            index.state = FSSTATE_INDEX;
+            fs_blktable_write(blk, index);
+            printf("Created name index block: START: %d, COUNT = %d\n", index.start, index.count);
+        }
+    }
     fs_info_write();
 
     // create root directory
+    __atomic_store_n(&fs_filetable_hint, 0, __ATOMIC_RELAXED);
     fs_root_create("VOS");
 
+    // checksum all table sectors
+    fs_crc_rebuild();
+    nameidx_build();
+    pack_build();
+
     // finished
+    fslock_file_unlock_all();
+    fslock_path_unlock();
     printf("Finished formatting disk\n");
 
 }
@@ -76,10 +128,21 @@ void fs_wipe(uint32_t size)
 fs_info_t fs_get_info()
 {
     fs_info_t output;
+    fslock_meta();
     memcpy(&output, &fs_info, sizeof(fs_info_t));
+    fslock_meta_unlock();
     return output;
 }
 
+// replace info block, used when repairing counts
+void fs_set_info(fs_info_t info)
+{
+    fslock_meta();
+    memcpy(&fs_info, &info, sizeof(fs_info_t));
+    fslock_meta_unlock();
+    fs_info_write();
+}
+
 // create new info block
 void fs_info_create(uint32_t size)
 {
@@ -90,12 +153,18 @@ void fs_info_create(uint32_t size)
     // block table
     fs_info.blk_table_start     = FS_SECTOR_BLKS;
     fs_info.blk_table_count     = 0;
-    fs_info.blk_table_count_max = 16384;
+    fs_info.blk_table_count_max = FS_BLK_COUNT_MAX;
     fs_info.blk_table_sector_count = (fs_info.blk_table_count_max * sizeof(fs_blkentry_t)) / ATA_SECTOR_SIZE;
 
+    // checksum table - one entry for every block table and file table sector
+    uint32_t file_table_sectors = (FS_FILE_COUNT_MAX * sizeof(fs_file_t)) / ATA_SECTOR_SIZE;
+    fs_info.flags            = FSFLAG_CHECKSUMS;
+    fs_info.crc_start        = fs_info.blk_table_start + fs_info.blk_table_sector_count + 4;
+    fs_info.crc_sector_count = fs_bytes_to_sectors((fs_info.blk_table_sector_count + file_table_sectors) * sizeof(uint32_t));
+
     // block data
-    fs_info.blk_data_start = fs_info.blk_table_start + fs_info.blk_table_sector_count + 4;
-    fs_info.blk_data_sector_count = fs_info.sector_count - (fs_info.blk_table_sector_count + 8);
+    fs_info.blk_data_start = fs_info.crc_start + fs_info.crc_sector_count;
+    fs_info.blk_data_sector_count = fs_info.sector_count - fs_info.blk_data_start;
     fs_info.blk_data_used = 0;
 
     // write to disk
@@ -105,7 +174,7 @@ void fs_info_create(uint32_t size)
     printf("Created new info block\n");
 }
 
-// read info block from disk
+// read info block from disk - only done when mounting, afterwards the copy in memory is authoritative
 void fs_info_read()
 {
     uint8_t* sec = malloc(ATA_SECTOR_SIZE);
@@ -119,21 +188,160 @@ void fs_info_write()
 {
     uint8_t* sec = malloc(ATA_SECTOR_SIZE);
     memset(sec, 0, ATA_SECTOR_SIZE);
+    fslock_meta();
+    if (fs_info.flags & FSFLAG_CHECKSUMS) { fs_info.checksum = crc32c(0, (uint8_t*)&fs_info, sizeof(fs_info_t) - sizeof(uint32_t)); }
     memcpy(sec, &fs_info, sizeof(fs_info_t));
     ata_write(FS_SECTOR_INFO, 1, sec);
+    fslock_meta_unlock();
     free(sec);
 }
 
+// get checksum table slot of block table or file table sector - returns -1 for other sectors
+int fs_crc_slot(uint32_t sector)
+{
+    if (sector >= fs_info.blk_table_start && sector < fs_info.blk_table_start + fs_info.blk_table_sector_count) { return sector - fs_info.blk_table_start; }
+    if (sector >= fs_info.file_table_start && sector < fs_info.file_table_start + fs_info.file_table_sector_count) { return fs_info.blk_table_sector_count + (sector - fs_info.file_table_start); }
+    return -1;
+}
+
+// read block table or file table sectors, waiting for writers of each sector
+void fs_table_read(uint32_t sector, uint32_t count, uint8_t* data)
+{
+    STAT_ADD(STAT_TABLE_SCANNED, count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fslock_sector_read(sector + i);
+        ata_read(sector + i, 1, data + (i * ATA_SECTOR_SIZE));
+        fslock_sector_unlock(sector + i);
+    }
+}
+
+// write block table or file table sectors and update their checksums
+void fs_table_write(uint32_t sector, uint32_t count, uint8_t* data)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fslock_sector_write(sector + i);
+        ata_write(sector + i, 1, data + (i * ATA_SECTOR_SIZE));
+        fs_table_checksum(sector + i, 1, data + (i * ATA_SECTOR_SIZE));
+        fslock_sector_unlock(sector + i);
+    }
+}
+
+// update checksums of written table sectors - callers hold the sector locks so checksums land in write order
+void fs_table_checksum(uint32_t sector, uint32_t count, uint8_t* data)
+{
+    if (!(fs_info.flags & FSFLAG_CHECKSUMS) || fs_crc_table == NULL) { return; }
+
+    fslock_meta();
+    int first = -1, last = -1;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int slot = fs_crc_slot(sector + i);
+        if (slot < 0) { continue; }
+        fs_crc_table[slot] = crc32c(0, data + (i * ATA_SECTOR_SIZE), ATA_SECTOR_SIZE);
+        if (first < 0) { first = slot; }
+        last = slot;
+    }
+    if (first < 0) { fslock_meta_unlock(); return; }
+
+    // write checksum sectors covering changed slots
+    uint32_t per_sector = ATA_SECTOR_SIZE / sizeof(uint32_t);
+    uint32_t sec_first  = first / per_sector;
+    uint32_t sec_last   = last / per_sector;
+    ata_write(fs_info.crc_start + sec_first, sec_last - sec_first + 1, (uint8_t*)(fs_crc_table + (sec_first * per_sector)));
+    fslock_meta_unlock();
+}
+
+// checksum of all sectors in block
+uint32_t fs_crc_blk(fs_blkentry_t blk)
+{
+    uint8_t* data = malloc(FS_COPY_CHUNK * ATA_SECTOR_SIZE);
+    uint32_t crc  = 0;
+    for (uint32_t sec = 0; sec < blk.count; sec += FS_COPY_CHUNK)
+    {
+        uint32_t count = blk.count - sec;
+        if (count > FS_COPY_CHUNK) { count = FS_COPY_CHUNK; }
+        ata_read(blk.start + sec, count, data);
+        crc = crc32c(crc, data, count * ATA_SECTOR_SIZE);
+    }
+    free(data);
+    return crc;
+}
+
+// recalculate checksums of every table sector
+void fs_crc_rebuild()
+{
+    if (!(fs_info.flags & FSFLAG_CHECKSUMS)) { return; }
+    if (fs_crc_table != NULL) { free(fs_crc_table); }
+    fs_crc_table = malloc(fs_info.crc_sector_count * ATA_SECTOR_SIZE);
+    memset(fs_crc_table, 0, fs_info.crc_sector_count * ATA_SECTOR_SIZE);
+
+    uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
+    {
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
+        fs_crc_table[sec] = crc32c(0, data, ATA_SECTOR_SIZE);
+    }
+    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
+    {
+        fs_table_read(fs_info.file_table_start + sec, 1, data);
+        fs_crc_table[fs_info.blk_table_sector_count + sec] = crc32c(0, data, ATA_SECTOR_SIZE);
+    }
+    free(data);
+    ata_write(fs_info.crc_start, fs_info.crc_sector_count, (uint8_t*)fs_crc_table);
+    fs_info_write();
+}
+
+// verify info block and table sectors against stored checksums
+bool_t fs_verify()
+{
+    if (fs_crc_table != NULL) { free(fs_crc_table); fs_crc_table = NULL; }
+    if (!(fs_info.flags & FSFLAG_CHECKSUMS)) { return TRUE; }
+
+    bool_t valid = TRUE;
+    if (fs_info.checksum != crc32c(0, (uint8_t*)&fs_info, sizeof(fs_info_t) - sizeof(uint32_t))) { printf("Checksum mismatch in info block\n"); valid = FALSE; }
+
+    fs_crc_table = malloc(fs_info.crc_sector_count * ATA_SECTOR_SIZE);
+    ata_read(fs_info.crc_start, fs_info.crc_sector_count, (uint8_t*)fs_crc_table);
+
+    uint32_t total = fs_info.blk_table_sector_count + fs_info.file_table_sector_count;
+    uint8_t* data  = malloc(FS_COPY_CHUNK * ATA_SECTOR_SIZE);
+    uint32_t bad   = 0;
+    uint32_t slot  = 0;
+    while (slot < total)
+    {
+        // a chunk never spans both tables
+        uint32_t end   = slot < fs_info.blk_table_sector_count ? fs_info.blk_table_sector_count : total;
+        uint32_t count = end - slot;
+        if (count > FS_COPY_CHUNK) { count = FS_COPY_CHUNK; }
+        uint32_t sector = slot < fs_info.blk_table_sector_count ? fs_info.blk_table_start + slot : fs_info.file_table_start + (slot - fs_info.blk_table_sector_count);
+        ata_read(sector, count, data);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (crc32c(0, data + (i * ATA_SECTOR_SIZE), ATA_SECTOR_SIZE) == fs_crc_table[slot + i]) { continue; }
+            printf("Checksum mismatch in table sector 0x%08x\n", sector + i);
+            bad++;
+        }
+        slot += count;
+    }
+    free(data);
+
+    if (bad > 0) { valid = FALSE; }
+    printf("Verified %d table sectors, %d damaged (%s)\n", total, bad, crc32c_hardware() ? "sse4.2" : "software");
+    return valid;
+}
+
 void fs_blktable_print()
 {
     printf("PRINTING BLOCK TABLE: \n");
 
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -169,14 +377,13 @@ uint32_t fs_blktable_offset_from_index(uint32_t sector, int index)
 // read block entry from disk
 fs_blkentry_t fs_blktable_read(int index)
 {
-    fs_info_read();
     if (index < 0 || index >= fs_info.blk_table_count_max) { printf("Invalid index while reading from block table\n"); return NULL_BLKENTRY; }
     uint32_t sector = fs_blktable_sector_from_index(index);
     uint32_t offset = fs_blktable_offset_from_index(sector, index);
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    ata_read(sector, 1, data);
+    fs_table_read(sector, 1, data);
     fs_blkentry_t* entry = (fs_blkentry_t*)(data + offset);
-    fs_blkentry_t output = { entry->start, entry->count, entry->state, { 0 } };
+    fs_blkentry_t output = { entry->start, entry->count, entry->state, entry->refs, entry->crc };
     free(data);
     return output;
 }
@@ -184,18 +391,23 @@ fs_blkentry_t fs_blktable_read(int index)
 // write block entry to disk 
 void fs_blktable_write(int index, fs_blkentry_t entry)
 {
-    fs_info_read();
     if (index < 0 || index >= fs_info.blk_table_count_max) { printf("Invalid index while reading from block table\n"); return; }
     uint32_t sector = fs_blktable_sector_from_index(index);
     uint32_t offset = fs_blktable_offset_from_index(sector, index);
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    fslock_alloc();
+    fslock_sector_write(sector);
     ata_read(sector, 1, data);
     fs_blkentry_t* temp = (fs_blkentry_t*)(data + offset);
     temp->start         = entry.start;
     temp->count         = entry.count;
     temp->state         = entry.state;
-    memcpy(temp->padding, entry.padding, sizeof(entry.padding));
+    temp->refs          = entry.refs;
+    temp->crc           = entry.crc;
     ata_write(sector, 1, data);
+    fs_table_checksum(sector, 1, data);
+    fslock_sector_unlock(sector);
+    fslock_alloc_unlock();
     free(data);
 }
 
@@ -203,13 +415,14 @@ void fs_blktable_write(int index, fs_blkentry_t entry)
 fs_blkentry_t fs_blktable_allocate(uint32_t sectors)
 {
     if (sectors == 0) { return NULL_BLKENTRY; }
+    STATS_SCOPE(STATS_OP_FS_ALLOC);
 
-    fs_info_read();
+    fslock_alloc();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -221,8 +434,11 @@ fs_blkentry_t fs_blktable_allocate(uint32_t sectors)
                 entry->state = FSSTATE_USED;
                 memcpy(&output, entry, sizeof(fs_blkentry_t));
                 fs_blktable_write(index, output);
-                printf("Allocated block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", output.start, output.state, output.count);
+                LOG(LOG_DEBUG, LOGCAT_ALLOC, "Allocated block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", output.start, output.state, output.count);
+                STAT_ADD(STAT_ALLOCS, 1);
+                STAT_ADD(STAT_ALLOC_SECTORS, sectors);
                 free(data);
+                fslock_alloc_unlock();
                 return output;
             }
 
@@ -230,28 +446,33 @@ fs_blkentry_t fs_blktable_allocate(uint32_t sectors)
         }
     }
 
-    ata_read(fs_info.blk_table_start, 1, data);
+    fs_table_read(fs_info.blk_table_start, 1, data);
     fs_blkentry_t* mass = (fs_blkentry_t*)data;
+    if (mass->count < sectors) { printf("Not enough free space to allocate %d sectors\n", sectors); free(data); fslock_alloc_unlock(); return NULL_BLKENTRY; }
 
     mass->start += sectors;
     mass->count -= sectors;
     mass->state  = FSSTATE_FREE;
-    ata_write(fs_info.blk_table_start, 1, data);
+    fs_table_write(fs_info.blk_table_start, 1, data);
     fs_blkentry_t output = fs_blktable_create_entry(mass->start - sectors, sectors, FSSTATE_USED);
-    printf("Allocated block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", output.start, output.state, output.count);
+    LOG(LOG_DEBUG, LOGCAT_ALLOC, "Allocated block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", output.start, output.state, output.count);
+    STAT_ADD(STAT_ALLOCS, 1);
+    STAT_ADD(STAT_ALLOC_SECTORS, sectors);
     free(data);
+    fslock_alloc_unlock();
     return output;
 }
 
 // free existing block entry
 bool_t fs_blktable_free(fs_blkentry_t entry)
 {
-    fs_info_read();
+    STATS_SCOPE(STATS_OP_FS_FREE);
+    fslock_alloc();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -260,9 +481,14 @@ bool_t fs_blktable_free(fs_blkentry_t entry)
             if (temp->start == entry.start && temp->count == entry.count && temp->state == entry.state)
             {
                 temp->state = FSSTATE_FREE;
-                ata_write(fs_info.blk_table_start + sec, 1, data);
-                printf("Freed block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", temp->start, temp->state, temp->count);
+                temp->refs  = 0;
+                temp->crc   = 0;
+                fs_table_write(fs_info.blk_table_start + sec, 1, data);
+                LOG(LOG_DEBUG, LOGCAT_ALLOC, "Freed block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", temp->start, temp->state, temp->count);
                 fs_blktable_merge_free();
+                STAT_ADD(STAT_FREES, 1);
+                free(data);
+                fslock_alloc_unlock();
                 return TRUE;
             }
         }
@@ -270,20 +496,51 @@ bool_t fs_blktable_free(fs_blkentry_t entry)
     }
 
     printf("Unable to free block START: %d, STATE = 0x%02x, COUNT = %d\n", entry.start, entry.state, entry.count);
+    free(data);
+    fslock_alloc_unlock();
     return FALSE;
 }
 
+// add reference to block shared by another file
+void fs_blktable_addref(int index)
+{
+    fslock_alloc();
+    fs_blkentry_t entry = fs_blktable_read(index);
+    entry.refs = (entry.refs == 0 ? 1 : entry.refs) + 1;
+    fs_blktable_write(index, entry);
+    fslock_alloc_unlock();
+}
+
+// drop reference to block, freeing it once no file references it
+bool_t fs_blktable_release(int index)
+{
+    fslock_alloc();
+    fs_blkentry_t entry = fs_blktable_read(index);
+    bool_t result = TRUE;
+    if (entry.refs > 1)
+    {
+        entry.refs--;
+        fs_blktable_write(index, entry);
+    }
+    else
+    {
+        dedup_remove(index);
+        result = fs_blktable_free(entry);
+    }
+    fslock_alloc_unlock();
+    return result;
+}
+
 fs_blkentry_t fs_blktable_nearest(fs_blkentry_t entry)
 {
     if (entry.start == 0) { return NULL_BLKENTRY; }
     if (entry.count == 0) { return NULL_BLKENTRY; }
 
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -292,7 +549,7 @@ fs_blkentry_t fs_blktable_nearest(fs_blkentry_t entry)
             if (temp->start == 0 || temp->count == 0) { index++; continue; }
 
             if ((temp->start + temp->count == entry.start && entry.state == FSSTATE_FREE) ||
-                (entry.start - entry.count == temp->start && entry.state == FSSTATE_FREE))
+                (entry.start + entry.count == temp->start && entry.state == FSSTATE_FREE))
                 {
                     fs_blkentry_t output;
                     memcpy(&output, temp, sizeof(fs_blkentry_t));
@@ -309,13 +566,13 @@ fs_blkentry_t fs_blktable_nearest(fs_blkentry_t entry)
 
 void fs_blktable_merge_free()
 {
-    fs_info_read();
+    fslock_alloc();
     fs_blkentry_t mass = fs_blktable_nearest(fs_blktable_at_index(0));
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -328,12 +585,12 @@ void fs_blktable_merge_free()
                 fs_blkentry_t nearest = fs_blktable_nearest(*temp);
                 if (nearest.start > 0 && nearest.count > 0 && nearest.start != temp->start && nearest.start != mass.start && nearest.state == FSSTATE_FREE)
                 {
-                    printf("TEMP: 0x%08x, NEAREST: 0x%08x\n", temp->start, nearest.start);
+                    LOG(LOG_TRACE, LOGCAT_ALLOC, "TEMP: 0x%08x, NEAREST: 0x%08x\n", temp->start, nearest.start);
                     if (temp->start > nearest.start) { temp->start = nearest.start; }
                     temp->count += nearest.count;
-                    ata_write(fs_info.blk_table_start + sec, 1, data);
-                    if (!fs_blktable_delete_entry(nearest)) { printf("Error deleting entry while merging\n"); return; }
-                    ata_read(fs_info.blk_table_start + sec, 1, data);
+                    fs_table_write(fs_info.blk_table_start + sec, 1, data);
+                    if (!fs_blktable_delete_entry(nearest)) { printf("Error deleting entry while merging\n"); free(data); fslock_alloc_unlock(); return; }
+                    fs_table_read(fs_info.blk_table_start + sec, 1, data);
                 }
             }
             index++;
@@ -343,11 +600,10 @@ void fs_blktable_merge_free()
 
     mass = fs_blktable_at_index(0);
 
-    fs_info_read();
     index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -357,15 +613,16 @@ void fs_blktable_merge_free()
 
             if (temp->start + temp->count == mass.start && temp->state == FSSTATE_FREE)
             {
-                printf("MASS: START = 0x%08x, COUNT = 0x%08x, STATE = 0x%02x\n", mass.start, mass.count, mass.state);
-                printf("TEMP: START = 0x%08x, COUNT = 0x%08x, STATE = 0x%02x\n", temp->start, temp->count, temp->state);
+                LOG(LOG_TRACE, LOGCAT_ALLOC, "MASS: START = 0x%08x, COUNT = 0x%08x, STATE = 0x%02x\n", mass.start, mass.count, mass.state);
+                LOG(LOG_TRACE, LOGCAT_ALLOC, "TEMP: START = 0x%08x, COUNT = 0x%08x, STATE = 0x%02x\n", temp->start, temp->count, temp->state);
                 mass.start = temp->start;
                 mass.count += temp->count;
                 mass.state = FSSTATE_FREE;
                 fs_blktable_write(0, mass);
-                ata_read(fs_info.blk_table_start + sec, 1, data);
+                fs_table_read(fs_info.blk_table_start + sec, 1, data);
                 memset(temp, 0, sizeof(fs_blkentry_t));
-                ata_write(fs_info.blk_table_start + sec, 1, data);
+                fs_table_write(fs_info.blk_table_start + sec, 1, data);
+                FSLOCK_DEC(fs_info.blk_table_count);
                 fs_info_write();
                 break;
             }
@@ -375,34 +632,79 @@ void fs_blktable_merge_free()
 
     free(data);
     fs_info_write();
+    fslock_alloc_unlock();
+}
+
+// sectors in chunk of block copy
+uint32_t fs_blktable_chunk(fs_blkentry_t blk, uint32_t chunk)
+{
+    uint32_t left = blk.count - (chunk * FS_COPY_CHUNK);
+    return left > FS_COPY_CHUNK ? FS_COPY_CHUNK : left;
 }
 
+// copy block data in multi-sector chunks with several in flight - safe for overlapping extents when dest is below src
 bool_t fs_blktable_copy(fs_blkentry_t dest, fs_blkentry_t src)
 {
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    for (uint32_t sec = 0; sec < src.count; sec++)
+    if (dest.start == src.start || src.count == 0) { return TRUE; }
+
+    // each buffer slot cycles through a read and a write, overlapping moves copy one chunk at a time in order
+    uint32_t chunks  = (src.count + FS_COPY_CHUNK - 1) / FS_COPY_CHUNK;
+    bool_t   overlap = dest.start < src.start + src.count && src.start < dest.start + src.count;
+    uint32_t slots   = overlap ? 1 : (chunks < ATA_QUEUE_DEPTH ? chunks : ATA_QUEUE_DEPTH);
+    uint8_t* data    = malloc(slots * FS_COPY_CHUNK * ATA_SECTOR_SIZE);
+    ata_queue_t* queue = ata_queue_create(slots);
+    ata_completion_t done[ATA_QUEUE_DEPTH];
+
+    // tag holds chunk, slot and whether it is the write
+    uint32_t next = 0, finished = 0;
+    bool_t   result = TRUE;
+    for (uint32_t slot = 0; slot < slots; slot++, next++)
     {
-        ata_read(src.start + sec, 1, data);
-        ata_write(dest.start + sec, 1, data);
+        ata_submit_read(queue, src.start + (next * FS_COPY_CHUNK), fs_blktable_chunk(src, next), data + (slot * FS_COPY_CHUNK * ATA_SECTOR_SIZE), ((uint64_t)next << 16) | (slot << 1));
     }
-    free(data);
 
-    return TRUE;
+    while (finished < chunks)
+    {
+        uint32_t n = ata_poll(queue, done, ATA_QUEUE_DEPTH, TRUE);
+        if (n == 0) { result = FALSE; break; }
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint32_t chunk = done[i].tag >> 16;
+            uint32_t slot  = (done[i].tag >> 1) & 0x7FFF;
+            uint8_t* buf   = data + (slot * FS_COPY_CHUNK * ATA_SECTOR_SIZE);
+            if (done[i].result < 0) { result = FALSE; }
+
+            if (!(done[i].tag & 1)) { ata_submit_write(queue, dest.start + (chunk * FS_COPY_CHUNK), fs_blktable_chunk(src, chunk), buf, done[i].tag | 1); continue; }
+
+            finished++;
+            if (next >= chunks) { continue; }
+            ata_submit_read(queue, src.start + (next * FS_COPY_CHUNK), fs_blktable_chunk(src, next), buf, ((uint64_t)next << 16) | (slot << 1));
+            next++;
+        }
+    }
+
+    ata_queue_destroy(queue);
+    free(data);
+    if (!result) { printf("Unable to copy block at 0x%08x to 0x%08x\n", src.start, dest.start); }
+    return result;
 }
 
 // create new block entry in table
 fs_blkentry_t fs_blktable_create_entry(uint32_t start, uint32_t count, uint8_t state)
 {
+    fslock_alloc();
     int i = fs_blktable_freeindex();
-    if (i < 0 || i >= fs_info.blk_table_count_max) { printf("Maximum amount of block entries reached\n"); return NULL_BLKENTRY; }
+    if (i < 0 || i >= fs_info.blk_table_count_max) { printf("Maximum amount of block entries reached\n"); fslock_alloc_unlock(); return NULL_BLKENTRY; }
     fs_blkentry_t entry;
     entry.start = start;
     entry.count = count;
     entry.state = state;
-    memset(entry.padding, 0, sizeof(entry.padding));
+    entry.refs  = 0;
+    entry.crc   = 0;
     fs_blktable_write(i, entry);
-    fs_info.blk_table_count++;
+    FSLOCK_INC(fs_info.blk_table_count);
     fs_info_write();
+    fslock_alloc_unlock();
     //printf("Created block: START: %d, STATE = 0x%02x, COUNT = %d\n", entry.start, entry.state, entry.count);
     return entry;
 }
@@ -410,11 +712,11 @@ fs_blkentry_t fs_blktable_create_entry(uint32_t start, uint32_t count, uint8_t s
 // delete existing block entry in table
 bool_t fs_blktable_delete_entry(fs_blkentry_t entry)
 {
-    fs_info_read();
+    fslock_alloc();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -423,17 +725,21 @@ bool_t fs_blktable_delete_entry(fs_blkentry_t entry)
 
             if (temp->start == entry.start && temp->count == entry.count && temp->state == entry.state)
             {
-                printf("Delete block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", entry.start, entry.state, entry.count);
+                LOG(LOG_DEBUG, LOGCAT_ALLOC, "Delete block: START: 0x%08x, STATE = 0x%02x, COUNT = 0x%08x\n", entry.start, entry.state, entry.count);
                 memset(temp, 0, sizeof(fs_blkentry_t));
-                ata_write(fs_info.blk_table_start + sec, 1, data);
-                fs_info.blk_table_count--;
+                fs_table_write(fs_info.blk_table_start + sec, 1, data);
+                FSLOCK_DEC(fs_info.blk_table_count);
                 fs_info_write();
+                free(data);
+                fslock_alloc_unlock();
                 return TRUE;
             }
         }
     }
 
     printf("Unable to delete block\n");
+    free(data);
+    fslock_alloc_unlock();
     return FALSE;
 }
 
@@ -442,7 +748,7 @@ bool_t fs_blktable_fill(fs_blkentry_t entry, uint8_t value)
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -467,12 +773,11 @@ fs_blkentry_t fs_blktable_at_index(int index)
 {
     if (index < 0 || index >+ fs_info.blk_table_count_max) { return NULL_BLKENTRY; }
 
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int temp_index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -503,17 +808,16 @@ bool_t fs_blktable_validate_sector(uint32_t sector)
 // get index of specified block entry
 int fs_blktable_get_index(fs_blkentry_t entry)
 {
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
             fs_blkentry_t* temp = (fs_blkentry_t*)(data + i);
-            if (temp->start == 0 || temp->count == 0) { continue; }
+            if (temp->start == 0 || temp->count == 0) { index++; continue; }
             if (temp->start == entry.start && temp->count == entry.count && temp->state == entry.state) { free(data); return index; }
             index++;
         }
@@ -525,12 +829,11 @@ int fs_blktable_get_index(fs_blkentry_t entry)
 // get next available block entry index in table
 int fs_blktable_freeindex()
 {
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.blk_table_sector_count; sec++)
     {
-        ata_read(fs_info.blk_table_start + sec, 1, data);
+        fs_table_read(fs_info.blk_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_blkentry_t))
         {
@@ -543,6 +846,293 @@ int fs_blktable_freeindex()
     return -1;
 }
 
+// load entire block table into memory
+fs_blkentry_t* fs_blktable_load()
+{
+    fs_blkentry_t* table = malloc(fs_info.blk_table_sector_count * ATA_SECTOR_SIZE);
+    fs_table_read(fs_info.blk_table_start, fs_info.blk_table_sector_count, (uint8_t*)table);
+    return table;
+}
+
+// write entire block table back to disk
+void fs_blktable_store(fs_blkentry_t* table)
+{
+    fs_table_write(fs_info.blk_table_start, fs_info.blk_table_sector_count, (uint8_t*)table);
+    fs_blk_mass  = table[0];
+    fs_blk_files = table[1];
+    fs_info.file_table_start = fs_blk_files.start;
+    fs_info_write();
+}
+
+// move used block at index to new start sector, keeping its index
+void fs_blktable_relocate(fs_blkentry_t* table, int index, uint32_t start)
+{
+    fs_blkentry_t dest = table[index];
+    dest.start = start;
+    fs_blktable_copy(dest, table[index]);
+    table[index].start = start;
+}
+
+// grow or shrink file system to specified size in place
+bool_t fs_resize(uint32_t size)
+{
+    fslock_path_write();
+    fslock_file_write_all();
+    bool_t result = fs_resize_exclusive(size);
+    fslock_file_unlock_all();
+    fslock_path_unlock();
+    return result;
+}
+
+// resize while holding exclusive path lock
+bool_t fs_resize_exclusive(uint32_t size)
+{
+    uint32_t sectors  = size / ATA_SECTOR_SIZE;
+    uint32_t data_end = fs_info.blk_data_start + fs_info.blk_data_sector_count;
+    if (sectors <= fs_info.blk_data_start + fs_info.file_table_sector_count) { printf("Invalid size while resizing file system\n"); return FALSE; }
+    if (sectors == fs_info.sector_count) { return TRUE; }
+
+    fs_blkentry_t* table = fs_blktable_load();
+    uint32_t max = fs_info.blk_table_count_max;
+
+    // grow - new sectors are appended to the mass block, which always ends at the end of the data region
+    if (sectors > fs_info.sector_count)
+    {
+        uint32_t delta = sectors - fs_info.sector_count;
+        if (!ata_resize((uint64_t)sectors * ATA_SECTOR_SIZE)) { free(table); return FALSE; }
+        if (table[0].count == 0) { table[0].start = data_end; }
+        table[0].count += delta;
+        fs_info.sector_count          += delta;
+        fs_info.blk_data_sector_count += delta;
+        fs_blktable_store(table);
+        free(table);
+        printf("Grew file system by %d sectors\n", delta);
+        return TRUE;
+    }
+
+    // shrink - make sure all used blocks will fit below the new end
+    uint32_t delta   = fs_info.sector_count - sectors;
+    uint32_t new_end = data_end - delta;
+    uint32_t used    = 0;
+    for (uint32_t i = 1; i < max; i++) { if (table[i].start != 0 && table[i].state != FSSTATE_FREE) { used += table[i].count; } }
+    if (used > new_end - fs_info.blk_data_start) { printf("Not enough free space to shrink file system by %d sectors\n", delta); free(table); return FALSE; }
+
+    // relocate used blocks beyond the new end into free blocks below it, splitting free blocks as needed
+    // when no single hole fits a block the used ones are compacted to the start instead, which always fits after the check above
+    uint32_t moved = 0;
+    bool_t   compacted = FALSE;
+    for (uint32_t i = 1; i < max && !compacted; i++)
+    {
+        if (table[i].start == 0 || table[i].state == FSSTATE_FREE) { continue; }
+        if (table[i].start + table[i].count <= new_end) { continue; }
+
+        fs_blkentry_t* hole = NULL;
+        for (uint32_t j = 0; j < max; j++)
+        {
+            fs_blkentry_t* temp = &table[j];
+            if (temp->start == 0 || temp->state != FSSTATE_FREE || temp->count < table[i].count) { continue; }
+            if (temp->start + table[i].count > new_end) { continue; }
+            hole = temp;
+            break;
+        }
+        if (hole == NULL)
+        {
+            fs_blkentry_t* packed = fs_blktable_compact(table, &moved);
+            free(table);
+            table = packed;
+            compacted = TRUE;
+            continue;
+        }
+
+        // the part of a block straddling the new end that stays below it becomes free
+        uint32_t old_start = table[i].start;
+        fs_blktable_relocate(table, i, hole->start);
+        if (old_start < new_end)
+        {
+            for (uint32_t j = 2; j < max; j++)
+            {
+                if (table[j].start != 0 || table[j].count != 0 || table[j].state != 0) { continue; }
+                table[j].start = old_start;
+                table[j].count = new_end - old_start;
+                table[j].state = FSSTATE_FREE;
+                FSLOCK_INC(fs_info.blk_table_count);
+                break;
+            }
+        }
+        hole->start += table[i].count;
+        hole->count -= table[i].count;
+        if (hole->count == 0 && hole != &table[0]) { memset(hole, 0, sizeof(fs_blkentry_t)); FSLOCK_DEC(fs_info.blk_table_count); }
+        moved += table[i].count;
+    }
+
+    // discard free blocks beyond the new end, the free block that reaches it becomes the mass block
+    fs_blkentry_t mass = { new_end, 0, FSSTATE_FREE, 0, 0 };
+    for (uint32_t i = 0; i < max; i++)
+    {
+        fs_blkentry_t* temp = &table[i];
+        if (temp->start == 0 || temp->state != FSSTATE_FREE) { continue; }
+        if (temp->start + temp->count > new_end) { temp->count = (temp->start < new_end) ? new_end - temp->start : 0; }
+        if (temp->count > 0 && temp->start + temp->count == new_end) { mass = *temp; temp->count = 0; }
+        if (temp->count == 0 && i != 0) { memset(temp, 0, sizeof(fs_blkentry_t)); FSLOCK_DEC(fs_info.blk_table_count); }
+    }
+    table[0] = mass;
+
+    // free extents left right below the new mass block by relocation are merged into it
+    fs_info.sector_count          -= delta;
+    fs_info.blk_data_sector_count -= delta;
+    fs_blktable_store(table);
+    fs_blktable_merge_free();
+    free(table);
+    if (fs_info.flags & FSFLAG_BTREE) { nameidx_open(); }
+    if (compacted)
+    {
+        pack_build();
+        if (dedup_get_enabled()) { dedup_build(); }
+    }
+    if (!ata_resize((uint64_t)sectors * ATA_SECTOR_SIZE)) { return FALSE; }
+    printf("Shrunk file system by %d sectors, relocated %d sectors\n", delta, moved);
+    return TRUE;
+}
+
+// gather fragmentation figures from loaded block table
+fs_fraginfo_t fs_blktable_fraginfo(fs_blkentry_t* table)
+{
+    fs_fraginfo_t info;
+    memset(&info, 0, sizeof(fs_fraginfo_t));
+    info.mass_sectors = table[0].count;
+    for (uint32_t i = 1; i < fs_info.blk_table_count_max; i++)
+    {
+        if (table[i].start == 0 || table[i].count == 0) { continue; }
+        if (table[i].state != FSSTATE_FREE) { info.used_extents++; info.used_sectors += table[i].count; continue; }
+        info.free_extents++;
+        info.free_sectors += table[i].count;
+        if (table[i].count > info.largest_free) { info.largest_free = table[i].count; }
+    }
+    return info;
+}
+
+void fs_fraginfo_print(const char* label, fs_fraginfo_t info)
+{
+    uint32_t total = info.free_sectors + info.mass_sectors;
+    uint32_t frag  = total == 0 ? 0 : (uint32_t)(((uint64_t)info.free_sectors * 100) / total);
+    printf("%s: USED = %d extents/%d sectors, HOLES = %d extents/%d sectors, LARGEST HOLE = %d, MASS = %d, FRAGMENTATION = %d%%\n",
+            label, info.used_extents, info.used_sectors, info.free_extents, info.free_sectors, info.largest_free, info.mass_sectors, frag);
+}
+
+int fs_defrag_compare(const void* a, const void* b)
+{
+    const fs_blkentry_t* x = *(const fs_blkentry_t**)a;
+    const fs_blkentry_t* y = *(const fs_blkentry_t**)b;
+    if (x->start < y->start) { return -1; }
+    return x->start > y->start;
+}
+
+// compact used blocks toward the start of the data region and merge all free space into the mass block
+bool_t fs_defrag(bool_t analyze)
+{
+    fslock_path_write();
+    fslock_file_write_all();
+    bool_t result = fs_defrag_exclusive(analyze);
+    fslock_file_unlock_all();
+    fslock_path_unlock();
+    return result;
+}
+
+// move used blocks of loaded table down to the start of the data region in position order and renumber them contiguously
+// block indices in the file table are rewritten to match - returns the new table with everything above the last block as mass block
+fs_blkentry_t* fs_blktable_compact(fs_blkentry_t* table, uint32_t* moved)
+{
+    uint32_t max = fs_info.blk_table_count_max;
+
+    // plan - used blocks ordered by position, the file table block always keeps index 1
+    fs_blkentry_t** plan = malloc(sizeof(fs_blkentry_t*) * max);
+    uint32_t plan_count = 0;
+    for (uint32_t i = 1; i < max; i++)
+    {
+        if (table[i].start != 0 && table[i].count != 0 && table[i].state != FSSTATE_FREE) { plan[plan_count++] = &table[i]; }
+    }
+    qsort(plan, plan_count, sizeof(fs_blkentry_t*), fs_defrag_compare);
+
+    // move blocks down, each move only overlaps space that has already been copied
+    uint32_t cursor = fs_info.blk_data_start;
+    for (uint32_t i = 0; i < plan_count; i++)
+    {
+        int index = plan[i] - table;
+        if (plan[i]->start != cursor) { fs_blktable_relocate(table, index, cursor); *moved += plan[i]->count; }
+        cursor += plan[i]->count;
+    }
+
+    // renumber entries so used blocks are contiguous in the table
+    fs_blkentry_t* packed = malloc(max * sizeof(fs_blkentry_t));
+    uint32_t* remap = malloc(max * sizeof(uint32_t));
+    memset(packed, 0, max * sizeof(fs_blkentry_t));
+    memset(remap, 0, max * sizeof(uint32_t));
+    packed[0].start = cursor;
+    packed[0].count = fs_info.blk_data_start + fs_info.blk_data_sector_count - cursor;
+    packed[0].state = FSSTATE_FREE;
+    packed[1] = table[1];
+    remap[1] = 1;
+    uint32_t next = 2;
+    for (uint32_t i = 0; i < plan_count; i++)
+    {
+        int index = plan[i] - table;
+        if (index == 1) { continue; }
+        packed[next] = *plan[i];
+        remap[index] = next++;
+    }
+    fs_info.blk_table_count = next - 1;
+
+    // rewrite block indices in file table, names and parents are unchanged so the name index stays valid
+    fs_info.file_table_start = packed[1].start;
+    uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
+    {
+        bool_t dirty = FALSE;
+        ata_read(packed[1].start + sec, 1, data);
+
+        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
+        {
+            fs_file_t* entry = (fs_file_t*)(data + i);
+            if (entry->type != FSTYPE_FILE || (entry->status & FSSTATUS_INLINE)) { continue; }
+            if (entry->status & FSSTATUS_PACKED)
+            {
+                uint32_t index = PACK_INDEX(entry->blk_index);
+                if (index < max && remap[index] != index) { entry->blk_index = PACK_REF(remap[index], PACK_OFFSET(entry->blk_index)); dirty = TRUE; }
+                continue;
+            }
+            if (entry->blk_index >= max) { continue; }
+            if (remap[entry->blk_index] != entry->blk_index) { entry->blk_index = remap[entry->blk_index]; dirty = TRUE; }
+        }
+        if (dirty) { fs_table_write(packed[1].start + sec, 1, data); }
+    }
+    free(data);
+    free(remap);
+    free(plan);
+    return packed;
+}
+
+// defragment while holding exclusive path lock
+bool_t fs_defrag_exclusive(bool_t analyze)
+{
+    fs_blkentry_t* table = fs_blktable_load();
+    fs_fraginfo_t before = fs_blktable_fraginfo(table);
+    fs_fraginfo_print("BEFORE", before);
+    if (analyze || before.free_extents == 0) { free(table); return TRUE; }
+
+    uint32_t moved = 0;
+    fs_blkentry_t* packed = fs_blktable_compact(table, &moved);
+    fs_blktable_store(packed);
+    if (fs_info.flags & FSFLAG_BTREE) { nameidx_open(); }
+    pack_build();
+    if (dedup_get_enabled()) { dedup_build(); }
+    fs_fraginfo_print("AFTER", fs_blktable_fraginfo(packed));
+    printf("Defragmented disk, moved %d sectors\n", moved);
+
+    free(packed);
+    free(table);
+    return TRUE;
+}
+
 // create new root directory
 bool_t fs_root_create(const char* label)
 {
@@ -562,18 +1152,18 @@ void fs_filetable_print()
 {
     printf("------ FILE TABLE ----------------------------\n");
 
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
     int index = 0;
     for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
     {
-        ata_read(fs_info.file_table_start + sec, 1, data);
+        fs_table_read(fs_info.file_table_start + sec, 1, data);
 
         for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
         {
             fs_directory_t* entry = (fs_directory_t*)(data + i);
 
-            if (entry->type != FSTYPE_NULL)
+            if (entry->type == FSTYPE_EXT) { printf("INDEX: 0x%08x INLINE RECORD\n", index); }
+            else if (entry->type != FSTYPE_NULL)
             {
                 printf("INDEX: 0x%08x PARENT: 0x%08x TYPE: 0x%02x STATUS: 0x%02x NAME: %s\n", index, entry->parent_index, entry->type, entry->status, entry->name);
             }
@@ -589,7 +1179,6 @@ void fs_filetable_print()
 uint32_t fs_filetable_sector_from_index(int index)
 {
     if (index == 0) { index = 1; }
-    fs_info_read();
     uint32_t sec = fs_info.file_table_start;
     uint32_t offset_bytes = (index * sizeof(fs_file_t));
     sec += (offset_bytes / ATA_SECTOR_SIZE);
@@ -607,63 +1196,84 @@ uint32_t fs_filetable_offset_from_index(uint32_t sector, int index)
 // read directory from disk at index in table
 fs_directory_t fs_filetable_read_dir(int index)
 {
-    fs_info_read();
     if (index < 0 || index >= fs_info.file_table_count_max) { printf("Invalid index while reading directory entry\n"); return NULL_DIR; }
     uint32_t sector = fs_filetable_sector_from_index(index);
     uint32_t offset = fs_filetable_offset_from_index(sector, index);
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    ata_read(sector, 1, data);
-    fs_directory_t* entry = (fs_directory_t*)(data + offset);
+    // lookups read an entry per resolved path, the sector is kept on the stack
+    uint8_t data[ATA_SECTOR_SIZE];
+    fs_table_read(sector, 1, data);
     fs_directory_t output;
-    memcpy(&output, entry, sizeof(fs_directory_t));
-    free(data);
+    memcpy(&output, data + offset, sizeof(fs_directory_t));
     return output;
 }
 
 // read file form disk at index in table
 fs_file_t fs_filetable_read_file(int index)
 {
-    fs_info_read();
     if (index < 0 || index >= fs_info.file_table_count_max) { printf("Invalid index while reading file entry\n"); return NULL_FILE; }
     uint32_t sector = fs_filetable_sector_from_index(index);
     uint32_t offset = fs_filetable_offset_from_index(sector, index);
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    ata_read(sector, 1, data);
-    fs_file_t* entry = (fs_file_t*)(data + offset);
+    uint8_t data[ATA_SECTOR_SIZE];
+    fs_table_read(sector, 1, data);
     fs_file_t output;
-    memcpy(&output, entry, sizeof(fs_file_t));
-    free(data); 
+    memcpy(&output, data + offset, sizeof(fs_file_t));
     return output;
 }
 
 // write directory to disk at index in table
 void fs_filetable_write_dir(int index, fs_directory_t dir)
 {
-    fs_info_read();
     if (index < 0 || index >= fs_info.file_table_count_max) { printf("Invalid index while writing directory entry\n"); return; }
     uint32_t sector = fs_filetable_sector_from_index(index);
     uint32_t offset = fs_filetable_offset_from_index(sector, index);
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    fslock_sector_write(sector);
     ata_read(sector, 1, data);
     fs_directory_t* temp = (fs_directory_t*)(data + offset);
+    fs_directory_t old = *temp;
     memcpy(temp, &dir, sizeof(fs_directory_t));
     ata_write(sector, 1, data);
+    fs_table_checksum(sector, 1, data);
+    fslock_sector_unlock(sector);
     free(data);
+    fs_filetable_reindex(index, old, dir);
 }
 
 // write file to disk at index in table
 void fs_filetable_write_file(int index, fs_file_t file)
 {
-    fs_info_read();
     if (index < 0 || index >= fs_info.file_table_count_max) { printf("Invalid index while writing file entry: %d\n", index); return; }
     uint32_t sector = fs_filetable_sector_from_index(index);
     uint32_t offset = fs_filetable_offset_from_index(sector, index);
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    fslock_sector_write(sector);
     ata_read(sector, 1, data);
     fs_file_t* temp = (fs_file_t*)(data + offset);
+    fs_directory_t old = *(fs_directory_t*)temp;
     memcpy(temp, &file, sizeof(fs_file_t));
     ata_write(sector, 1, data);
+    fs_table_checksum(sector, 1, data);
+    fslock_sector_unlock(sector);
     free(data); 
+    fs_filetable_reindex(index, old, *(fs_directory_t*)&file);
+}
+
+// update name index after entry at index was rewritten, only name, parent and type are indexed
+// called after the sector lock is dropped as the index waits for its readers
+void fs_filetable_reindex(int index, fs_directory_t old, fs_directory_t entry)
+{
+    if (index == 0) { return; }
+    // a freed entry is the next one handed out unless a lower one is free too
+    if (entry.type == FSTYPE_NULL)
+    {
+        uint32_t hint = __atomic_load_n(&fs_filetable_hint, __ATOMIC_RELAXED);
+        while (hint > (uint32_t)index && !__atomic_compare_exchange_n(&fs_filetable_hint, &hint, index, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+    }
+    // extension records have no name, to the index their slot is empty
+    if (old.type == FSTYPE_EXT) { old = NULL_DIR; }
+    if (entry.type == FSTYPE_EXT) { entry = NULL_DIR; }
+    if (old.type == entry.type && old.parent_index == entry.parent_index && !strncmp(old.name, entry.name, FS_NAME_MAX)) { return; }
+    nameidx_update(index, old, entry);
 }
 
 // create new directory entry in table
@@ -672,9 +1282,9 @@ fs_directory_t fs_filetable_create_dir(fs_directory_t dir)
     int i = fs_filetable_freeindex();
     if (i < 0 || i >= fs_info.file_table_count_max) { printf("Invalid index while creating directory entry\n"); return NULL_DIR; }
     fs_filetable_write_dir(i, dir);
-    fs_info.file_table_count++;
+    FSLOCK_INC(fs_info.file_table_count);
     fs_info_write();
-    printf("Created directory: INDEX = 0x%08x, NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x\n", i, dir.name, dir.parent_index, dir.type, dir.status);
+    LOG(LOG_DEBUG, LOGCAT_TABLE, "Created directory: INDEX = 0x%08x, NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x\n", i, dir.name, dir.parent_index, dir.type, dir.status);
     return dir;
 }
 
@@ -684,73 +1294,36 @@ fs_file_t fs_filetable_create_file(fs_file_t file)
     int i = fs_filetable_freeindex();
     if (i < 0 || i >= fs_info.file_table_count_max) { printf("Invalid index while creating file entry\n"); return NULL_FILE; }
     fs_filetable_write_file(i, file);
-    fs_info.file_table_count++;
+    FSLOCK_INC(fs_info.file_table_count);
     fs_info_write();
-    printf("Created file: NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x, BLK = 0x%08x, SIZE = %d\n", file.name, file.parent_index, file.type, file.status, file.blk_index, file.size);
+    LOG(LOG_DEBUG, LOGCAT_TABLE, "Created file: NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x, BLK = 0x%08x, SIZE = %d\n", file.name, file.parent_index, file.type, file.status, file.blk_index, file.size);
     return file;
 }
 
 // delete existing directory entry in table
 bool_t fs_filetable_delete_dir(fs_directory_t dir)
 {
-    fs_info_read();
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
-    {
-        ata_read(fs_info.file_table_start + sec, 1, data);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-        {
-            fs_directory_t* entry = (fs_directory_t*)(data + i);
-
-            if (fs_dir_equals(dir, *entry))
-            {
-                printf("Deleted directory: NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x\n", dir.name, dir.parent_index, dir.type, dir.status);
-                memset(entry, 0, sizeof(fs_directory_t));
-                ata_write(fs_info.file_table_start + sec, 1, data);
-                free(data); 
-                return TRUE;
-            }
-            index++;
-        }
-    }
+    int index = fs_get_dir_index(dir);
+    if (index <= 0) { printf("Unable to delete directory\n"); return FALSE; }
 
-    printf("Unable to delete directory\n");
-    free(data); 
-    return FALSE;
+    LOG(LOG_DEBUG, LOGCAT_TABLE, "Deleted directory: NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x\n", dir.name, dir.parent_index, dir.type, dir.status);
+    fs_filetable_write_dir(index, NULL_DIR);
+    FSLOCK_DEC(fs_info.file_table_count);
+    fs_info_write();
+    return TRUE;
 }
 
 // delete existing file entry in table
 bool_t fs_filetable_delete_file(fs_file_t file)
 {
-    fs_info_read();
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
-    {
-        ata_read(fs_info.file_table_start + sec, 1, data);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
-        {
-            fs_file_t* entry = (fs_file_t*)(data + i);
-
-            if (fs_file_equals(file, *entry))
-            {
-                printf("Deleted file: NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x, SIZE = %d\n", file.name, file.parent_index, file.type, file.status, file.size);
-                memset(entry, 0, sizeof(fs_file_t));
-                ata_write(fs_info.file_table_start + sec, 1, data);
-                free(data); 
-                return TRUE;
-            }
-
-            index++;
-        }
-    }
+    int index = fs_get_file_index(file);
+    if (index <= 0) { printf("Unable to delete file\n"); return FALSE; }
 
-    printf("Unable to delete directory\n");
-    free(data); 
-    return FALSE;
+    LOG(LOG_DEBUG, LOGCAT_TABLE, "Deleted file: NAME = %s, PARENT = 0x%08x, TYPE = 0x%02x, STATUS = 0x%02x, SIZE = %d\n", file.name, file.parent_index, file.type, file.status, file.size);
+    fs_filetable_write_file(index, NULL_FILE);
+    FSLOCK_DEC(fs_info.file_table_count);
+    fs_info_write();
+    return TRUE;
 }
 
 // validate that sector is within file table bounds
@@ -760,21 +1333,26 @@ bool_t fs_filetable_validate_sector(uint32_t sector)
     return TRUE;
 }
 
-// get next available index in file table
+// get next available index in file table, searching from the hint and wrapping around to it
 int fs_filetable_freeindex()
 {
-    fs_info_read();
     uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
+    uint32_t per_sector = ATA_SECTOR_SIZE / sizeof(fs_file_t);
+    uint32_t first = __atomic_load_n(&fs_filetable_hint, __ATOMIC_RELAXED) / per_sector;
+    if (first >= fs_info.file_table_sector_count) { first = 0; }
+    for (uint32_t n = 0; n < fs_info.file_table_sector_count; n++)
     {
-        ata_read(fs_info.file_table_start + sec, 1, data);
+        uint32_t sec = (first + n) % fs_info.file_table_sector_count;
+        fs_table_read(fs_info.file_table_start + sec, 1, data);
 
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
+        for (uint32_t i = 0; i < per_sector; i++)
         {
-            fs_file_t* entry = (fs_file_t*)(data + i);
-            if (entry->type == FSTYPE_NULL) {free(data);  return index; }
-            index++;
+            fs_file_t* entry = (fs_file_t*)(data + (i * sizeof(fs_file_t)));
+            if (entry->type != FSTYPE_NULL) { continue; }
+            int index = (sec * per_sector) + i;
+            __atomic_store_n(&fs_filetable_hint, index, __ATOMIC_RELAXED);
+            free(data);
+            return index;
         }
     }
 
@@ -782,6 +1360,54 @@ int fs_filetable_freeindex()
     return -1;
 }
 
+// create extension record holding len bytes of inline contents - returns its index, or -1 when the table is full
+// counted like any other entry, needs the path lock exclusively
+int fs_filetable_create_inline(const uint8_t* data, uint32_t len)
+{
+    if (len > FS_INLINE_MAX) { return -1; }
+    int index = fs_filetable_freeindex();
+    if (index <= 0) { printf("Invalid index while creating inline record\n"); return -1; }
+    fs_filetable_write_inline(index, data, len);
+    FSLOCK_INC(fs_info.file_table_count);
+    fs_info_write();
+    return index;
+}
+
+// read len bytes of inline contents from extension record at index
+bool_t fs_filetable_read_inline(int index, uint8_t* data, uint32_t len)
+{
+    if (len > FS_INLINE_MAX) { return FALSE; }
+    fs_directory_t entry = fs_filetable_read_dir(index);
+    if (entry.type != FSTYPE_EXT) { return FALSE; }
+    fs_inline_t* rec = (fs_inline_t*)&entry;
+    uint32_t head = len < FS_NAME_MAX ? len : FS_NAME_MAX;
+    memcpy(data, rec->data, head);
+    memcpy(data + head, rec->tail, len - head);
+    return TRUE;
+}
+
+// replace contents of extension record at index, unused bytes are cleared
+void fs_filetable_write_inline(int index, const uint8_t* data, uint32_t len)
+{
+    fs_inline_t rec;
+    memset(&rec, 0, sizeof(fs_inline_t));
+    uint32_t head = len < FS_NAME_MAX ? len : FS_NAME_MAX;
+    memcpy(rec.data, data, head);
+    memcpy(rec.tail, data + head, len - head);
+    rec.parent_index = UINT32_MAX;
+    rec.type         = FSTYPE_EXT;
+    fs_filetable_write_dir(index, *(fs_directory_t*)&rec);
+}
+
+bool_t fs_filetable_delete_inline(int index)
+{
+    if (index <= 0 || fs_filetable_read_dir(index).type != FSTYPE_EXT) { printf("Unable to delete inline record\n"); return FALSE; }
+    fs_filetable_write_dir(index, NULL_DIR);
+    FSLOCK_DEC(fs_info.file_table_count);
+    fs_info_write();
+    return TRUE;
+}
+
 // check if 2 directories are equal
 bool_t fs_dir_equals(fs_directory_t a, fs_directory_t b)
 {
@@ -804,215 +1430,134 @@ bool_t fs_file_equals(fs_file_t a, fs_file_t b)
     return TRUE;
 }
 
-// get parent directory from path - returns empty if unable to locate
-fs_directory_t fs_parent_from_path(const char* path)
+// split path into components in place - returns FALSE if a component is too long or the path too deep
+bool_t fs_path_parse(const char* path, fs_path_t* out)
 {
-    if (path == NULL) { return NULL_DIR; }
-    if (strlen(path) == 0) { return NULL_DIR; }
-
-    int    args_count = 0;
-    char** args = strsplit(path, '/', &args_count);
-
-    if (args_count <= 2 && path[0] == '/') { freearray(args, args_count); return fs_rootdir; }
+    out->str   = path;
+    out->count = 0;
+    if (path == NULL) { return FALSE; }
 
-    if (args_count > 1)
+    const char* pos = path;
+    while (TRUE)
     {
-        fs_info_read();
-        int32_t index = 0;
-        uint32_t p = 0;
-        fs_directory_t dir_out = NULL_DIR;
-
-        for (uint32_t arg = 0; arg < args_count - 1; arg++)
-        {
-            dir_out = NULL_DIR;
-            index = 0;
-
-            if (args[arg] != NULL && strlen(args[arg]) > 0)
-            {
-                uint8_t* data = malloc(ATA_SECTOR_SIZE);
-                for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
-                {
-                    ata_read(fs_info.file_table_start + sec, 1, data);
-
-                    for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-                    {
-                        fs_directory_t* dir = (fs_directory_t*)(data + i);
-
-                        if (dir->type == FSTYPE_DIR && dir->parent_index == (uint32_t)p && !strcmp(dir->name, args[arg]))
-                        {
-                            p = index;
-                            dir_out = *dir;
-                        }
-
-                        index++;
-                    }
-                }
-                free(data);
-            }
-        }
-
-        if (dir_out.type == FSTYPE_DIR) { freearray(args, args_count); return dir_out; }
+        while (*pos == '/') { pos++; }
+        if (*pos == 0) { return TRUE; }
+        const char* end = pos;
+        while (*end != 0 && *end != '/') { end++; }
+        if (end - pos >= FS_NAME_MAX || out->count == FS_PATH_DEPTH_MAX) { return FALSE; }
+        out->parts[out->count].str = pos;
+        out->parts[out->count].len = end - pos;
+        out->count++;
+        pos = end;
     }
-
-    printf("Unable to locate parent of %s\n", path);
-    freearray(args, args_count);
-    return NULL_DIR;
 }
 
-// return file by path - returns empty if unable to locate
-fs_file_t fs_get_file_byname(const char* path)
+// copy last component into name of FS_NAME_MAX characters, root is named by its label
+void fs_path_name(const fs_path_t* path, char* name)
 {
-    if (path == NULL) { return NULL_FILE; }
-    if (strlen(path) == 0) { return NULL_FILE; }
-
-    fs_info_read();
-
-    fs_directory_t parent = fs_parent_from_path(path);
-    if (parent.type != FSTYPE_DIR) { printf("Parent was null while getting file by name\n"); return NULL_FILE; }
-
-    int args_count = 0;
-    char** args = strsplit(path, '/', &args_count);
-
-    if (args_count == 0) { freearray(args, args_count); printf("Args was null while getting file by name\n"); return NULL_FILE; }
-
-    char* filename;
-    int xx = args_count - 1;
-    while (args[xx] != NULL)
-    {
-        if (args[xx] != NULL && strlen(args[xx]) > 0) { filename = args[xx]; break; }
-        if (xx == 0) { break; }
-        xx--;
-    }
-    if (strlen(filename) == 0 || filename == NULL) { freearray(args, args_count); printf("Unable to get name while getting file by name\n"); return NULL_FILE; }
-
-    uint32_t parent_index = fs_get_dir_index(parent);
+    if (path->count == 0) { strncpy(name, fs_rootdir.name, FS_NAME_MAX - 1); name[FS_NAME_MAX - 1] = 0; return; }
+    const fs_span_t* last = &path->parts[path->count - 1];
+    memcpy(name, last->str, last->len);
+    name[last->len] = 0;
+}
 
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
+// path of containing directory with a trailing separator - returns NULL for root
+char* fs_path_dirname(const fs_path_t* path)
+{
+    if (path->count == 0) { return NULL; }
+    char* output = malloc(strlen(path->str) + 2);
+    size_t len = 0;
+    output[len++] = '/';
+    for (uint32_t i = 0; i + 1 < path->count; i++)
     {
-        ata_read(fs_info.file_table_start + sec, 1, data);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
-        {
-            fs_file_t* entry = (fs_file_t*)(data + i);
-            if (entry->type == FSTYPE_FILE && entry->parent_index == parent_index && !strcmp(entry->name, filename))
-            {
-                fs_file_t output = *entry;
-                freearray(args, args_count);
-                free(data);
-                return output;
-            }
-            index++;
-        }
+        memcpy(output + len, path->parts[i].str, path->parts[i].len);
+        len += path->parts[i].len;
+        output[len++] = '/';
     }
-
-    freearray(args, args_count);
-    free(data);
-    return NULL_FILE;
+    output[len] = 0;
+    return output;
 }
 
-// return directory by path - returns empty if unable to locate;
-fs_directory_t fs_get_dir_byname(const char* path)
+// get parent directory of parsed path and its table index when given - returns empty if unable to locate
+fs_directory_t fs_path_parent(const fs_path_t* path, int* index)
 {
-    if (path == NULL) { return NULL_DIR; }
-    if (strlen(path) == 0) { return NULL_DIR; }
-
-    fs_info_read();
-
-    if (!strcmp(path, "/"))
+    int found = nameidx_resolve_path_parent(path);
+    if (index != NULL) { *index = found; }
+    if (found == 0) { return fs_rootdir; }
+    if (found > 0)
     {
-        fs_directory_t output;
-        memcpy(&output, &fs_rootdir, sizeof(fs_directory_t));
-        return output;
+        fs_directory_t dir = fs_filetable_read_dir(found);
+        if (dir.type == FSTYPE_DIR) { return dir; }
     }
 
-    fs_directory_t parent = fs_parent_from_path(path);
-    if (parent.type != FSTYPE_DIR) { printf("Parent was null while getting directory by name\n"); return NULL_DIR; }
+    printf("Unable to locate parent of %s\n", path->str);
+    return NULL_DIR;
+}
 
-    int args_count = 0;
-    char** args = strsplit(path, '/', &args_count);
+// return file at parsed path and its table index when given - returns empty if unable to locate
+fs_file_t fs_path_file(const fs_path_t* path, int* index)
+{
+    int found = nameidx_resolve_path(path, FSTYPE_FILE);
+    if (index != NULL) { *index = found; }
+    if (found <= 0) { return NULL_FILE; }
 
-    if (args_count == 0) { freearray(args, args_count); printf("Args was null while getting directory by name\n"); return NULL_DIR; }
+    // entry may have been replaced since it was resolved
+    fs_file_t file = fs_filetable_read_file(found);
+    if (file.type != FSTYPE_FILE) { return NULL_FILE; }
+    return file;
+}
 
-    char* dirname;
-    int xx = args_count - 1;
-    while (args[xx] != NULL)
-    {
-        if (args[xx] != NULL && strlen(args[xx]) > 0) { dirname = args[xx]; break; }
-        if (xx == 0) { break; }
-        xx--;
-    }
-    if (strlen(dirname) == 0 || dirname == NULL) { printf("Unable to get name while getting directory by name\n"); return NULL_DIR; }
+// return directory at parsed path and its table index when given - returns empty if unable to locate
+fs_directory_t fs_path_dir(const fs_path_t* path, int* index)
+{
+    int found = nameidx_resolve_path(path, FSTYPE_DIR);
+    if (index != NULL) { *index = found; }
+    if (found < 0) { return NULL_DIR; }
+    if (found == 0) { return fs_rootdir; }
 
-    uint32_t parent_index = fs_get_dir_index(parent);
+    fs_directory_t dir = fs_filetable_read_dir(found);
+    if (dir.type != FSTYPE_DIR) { return NULL_DIR; }
+    return dir;
+}
 
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
-    {
-        ata_read(fs_info.file_table_start + sec, 1, data);
+// get parent directory from path - returns empty if unable to locate
+fs_directory_t fs_parent_from_path(const char* path)
+{
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return NULL_DIR; }
+    return fs_path_parent(&parsed, NULL);
+}
 
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-        {
-            fs_directory_t* entry = (fs_directory_t*)(data + i);
-            if (entry->type == FSTYPE_DIR && entry->parent_index == parent_index && !strcmp(entry->name, dirname))
-            {
-                fs_directory_t output;
-                memcpy(&output, entry, sizeof(fs_directory_t));
-                freearray(args, args_count);
-                free(data);
-                return output;
-            }
-            index++;
-        }
-    }
+// return file by path - returns empty if unable to locate
+fs_file_t fs_get_file_byname(const char* path)
+{
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return NULL_FILE; }
+    return fs_path_file(&parsed, NULL);
+}
 
-    freearray(args, args_count);
-    free(data);
-    return NULL_DIR;
+// return directory by path - returns empty if unable to locate;
+fs_directory_t fs_get_dir_byname(const char* path)
+{
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return NULL_DIR; }
+    return fs_path_dir(&parsed, NULL);
 }
 
 // get index of specified file entry
 int fs_get_file_index(fs_file_t file)
 {
-    fs_info_read();
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
-    {
-        ata_read(fs_info.file_table_start + sec, 1, data);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
-        {
-            fs_file_t* entry = (fs_file_t*)(data + i);
-            if (fs_file_equals(*entry, file)) { free(data); return index; }
-            index++;
-        }
-    }
-    free(data);
-    return -1;
+    int index = nameidx_find(file.parent_index, file.name, FSTYPE_FILE);
+    if (index < 0 || !fs_file_equals(fs_filetable_read_file(index), file)) { return -1; }
+    return index;
 }
 
 // get index of specified directory entry
 int fs_get_dir_index(fs_directory_t dir)
 {
-    fs_info_read();
-    uint8_t* data = malloc(ATA_SECTOR_SIZE);
-    int index = 0;
-    for (uint32_t sec = 0; sec < fs_info.file_table_sector_count; sec++)
-    {
-        ata_read(fs_info.file_table_start + sec, 1, data);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-        {
-            fs_directory_t* entry = (fs_directory_t*)(data + i);
-            if (fs_dir_equals(*entry, dir)) { free(data); return index; }
-            index++;
-        }
-    }
-    free(data);
-    return -1;
+    int index = dir.parent_index == UINT32_MAX ? 0 : nameidx_find(dir.parent_index, dir.name, FSTYPE_DIR);
+    if (index < 0 || !fs_dir_equals(fs_filetable_read_dir(index), dir)) { return -1; }
+    return index;
 }
 
 int ceilnum(float num) 
@@ -1029,175 +1574,417 @@ uint32_t fs_bytes_to_sectors(uint32_t bytes)
 
 char* fs_get_name_from_path(const char* path)
 {
-    if (path == NULL) { return NULL; }
-    if (strlen(path) == 0) { return NULL; }
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return NULL; }
+    char* name = malloc(FS_NAME_MAX);
+    fs_path_name(&parsed, name);
+    return name;
+}
 
-    if (!strcmp(path, "/"))
-    {
-        char* rootname = malloc(strlen(fs_rootdir.name) + 1);
-        memset(rootname, 0, strlen(fs_rootdir.name));
-        strcpy(rootname, fs_rootdir.name);
-        return rootname;
-    }
+char* fs_get_parent_path_from_path(const char* path)
+{
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return NULL; }
+    return fs_path_dirname(&parsed);
+}
 
-    int args_count = 0;
-    char** args = strsplit(path, '/', &args_count);
+// create file entry referencing existing block
+fs_file_t fs_file_create_entry(const fs_path_t* path, uint32_t size, int blk_index, uint8_t status)
+{
+    int parent_index;
+    fs_directory_t parent = fs_path_parent(path, &parent_index);
+    if (parent.type != FSTYPE_DIR || path->count == 0) { printf("Unable to locate parent while creating file\n"); return NULL_FILE; }
 
-    if (args_count == 0) { freearray(args, args_count); printf("Args was null while getting name from path\n"); return NULL; }
+    // set properties and create file
+    fs_file_t file;
+    file.parent_index = parent_index;
+    file.type         = FSTYPE_FILE;
+    file.status       = status;
+    file.size         = size;
+    file.blk_index    = blk_index;
+    file.data         = NULL;
+    fs_path_name(path, file.name);
 
-    if (args_count == 2 && path[0] == '/')
-    {
-        char* rootname = malloc(strlen(args[1]) + 1);
-        memset(rootname, 0, strlen(args[1]) + 1);
-        strcpy(rootname, args[1]);
-        freearray(args, args_count);
-        return rootname;
-    }
+    return fs_filetable_create_file(file);
+}
 
-    char* filename;
-    int xx = args_count - 1;
-    while (args[xx] != NULL)
-    {
-        if (args[xx] != NULL && strlen(args[xx]) > 0) { filename = args[xx]; break; }
-        if (xx == 0) { break; }
-        xx--;
-    }
+// create file entry with a block of specified sector count, blocks are not cleared
+fs_file_t fs_file_create_blk(const fs_path_t* path, uint32_t size, uint32_t sectors, uint8_t status)
+{
+    fs_directory_t parent = fs_path_parent(path, NULL);
+    if (parent.type != FSTYPE_DIR) { printf("Unable to locate parent while creating file\n"); return NULL_FILE; }
 
-    char* output = malloc(strlen(filename) + 1);
-    memset(output, 0, strlen(filename));
-    strcpy(output, filename);
-    freearray(args, args_count);
-    return output;
+    fs_blkentry_t blk = fs_blktable_allocate(sectors);
+    if (blk.count == 0) { return NULL_FILE; }
+    return fs_file_create_entry(path, size, fs_blktable_get_index(blk), status);
 }
 
-char* fs_get_parent_path_from_path(const char* path)
+// create file entry with its contents inline in an extension record, no block is used
+fs_file_t fs_file_create_inline(const fs_path_t* path, const uint8_t* data, uint32_t len)
 {
+    fs_directory_t parent = fs_path_parent(path, NULL);
+    if (parent.type != FSTYPE_DIR) { printf("Unable to locate parent while creating file\n"); return NULL_FILE; }
 
-    if (path == NULL) { return NULL; }
-    if (strlen(path) == 0) { return NULL; }
-
-    char* output = malloc(strlen(path + 16));
-    memset(output, 0, strlen(path + 16));
+    int rec = fs_filetable_create_inline(data, len);
+    if (rec < 0) { return NULL_FILE; }
+    fs_file_t file = fs_file_create_entry(path, len, rec, FSSTATUS_INLINE);
+    if (file.type != FSTYPE_FILE) { fs_filetable_delete_inline(rec); }
+    return file;
+}
 
-    if (!strcmp(path, "/")) { free(output); return NULL; }
+// create file entry with its contents as a tail in a shared pack extent
+fs_file_t fs_file_create_packed(const fs_path_t* path, const uint8_t* data, uint32_t len)
+{
+    fs_directory_t parent = fs_path_parent(path, NULL);
+    if (parent.type != FSTYPE_DIR) { printf("Unable to locate parent while creating file\n"); return NULL_FILE; }
 
-    int args_count = 0;
-    char** args = strsplit(path, '/', &args_count);   
+    int ref = pack_store(data, len);
+    if (ref < 0) { return NULL_FILE; }
+    fs_file_t file = fs_file_create_entry(path, len, ref, FSSTATUS_PACKED);
+    if (file.type != FSTYPE_FILE) { pack_release(ref, len); }
+    return file;
+}
 
-    if (args_count <= 2 && path[0] == '/') { freearray(args, args_count); strcpy(output, "/"); return output; }
+fs_file_t fs_file_create(const char* path, uint32_t size)
+{
+    if (size == 0) { printf("Cannot create blank file\n"); return NULL_FILE; }
+    fs_path_t parsed;
+    if (!fs_path_parse(path, &parsed)) { return NULL_FILE; }
 
-    strcat(output, "/");
-    for (int i = 0; i < args_count - 1; i++)
+    fslock_path_write();
+    fs_file_t file;
+    if (size <= FS_INLINE_MAX)
     {
-        if (strlen(args[i]) == 0) { continue; }
-        strcat(output, args[i]);
-        strcat(output, "/");
+        uint8_t zeros[FS_INLINE_MAX] = { 0 };
+        file = fs_file_create_inline(&parsed, zeros, size);
     }
-    
-    freearray(args, args_count);
-    return output;
+    else
+    {
+        file = fs_file_create_blk(&parsed, size, fs_bytes_to_sectors(size), 0x00);
+        if (file.type == FSTYPE_FILE) { fs_blktable_fill(fs_blktable_read(file.blk_index), 0x00); }
+    }
+    fslock_path_unlock();
+    return file.type == FSTYPE_FILE ? file : NULL_FILE;
 }
 
-fs_file_t fs_file_create(const char* path, uint32_t size)
+// give up storage of file, its extension record when inline, its tail when packed and otherwise its reference to the block
+bool_t fs_file_release(fs_file_t file)
 {
-    if (size == 0) { printf("Cannot create blank file\n"); return NULL_FILE; }
+    if (file.status & FSSTATUS_INLINE) { return fs_filetable_delete_inline(file.blk_index); }
+    if (file.status & FSSTATUS_PACKED) { return pack_release(file.blk_index, file.size); }
+    return fs_blktable_release(file.blk_index);
+}
 
-    fs_directory_t parent = fs_parent_from_path(path);
-    if (parent.type != FSTYPE_DIR) { printf("Unable to locate parent while creating file\n"); return NULL_FILE; }
+void fs_set_compression(bool_t enabled) { fs_compression = enabled; }
 
-    uint32_t sectors = fs_bytes_to_sectors(size);
-    fs_blkentry_t blk = fs_blktable_allocate(sectors);
+bool_t fs_get_compression() { return fs_compression; }
 
-    // set properties and create file
-    fs_file_t file;
-    file.parent_index = fs_get_dir_index(parent);
-    file.type         = FSTYPE_FILE;
-    file.status       = 0x00;
-    file.size         = size;
-    file.blk_index    = fs_blktable_get_index(blk);
-    char* name = fs_get_name_from_path(path);
-    strcpy(file.name, name);
-    free(name);
+// compress data into sector padded buffer prefixed with compressed length - returns NULL if it would not save a sector
+uint8_t* fs_file_compress(uint8_t* data, uint32_t len, uint32_t* out_len)
+{
+    if (len < FS_COMPRESS_MIN) { return NULL; }
+
+    uint32_t cap = lz_bound(len);
+    uint8_t* output = malloc(sizeof(uint32_t) + cap);
+    uint32_t csize = lz_compress(data, len, output + sizeof(uint32_t), cap);
+    if (csize == 0 || fs_bytes_to_sectors(csize + sizeof(uint32_t)) >= fs_bytes_to_sectors(len)) { free(output); return NULL; }
+
+    memcpy(output, &csize, sizeof(uint32_t));
+    *out_len = csize + sizeof(uint32_t);
+    return output;
+}
 
-    fs_blktable_fill(blk, 0x00);
+// write data to start of block at index, padding final sector with zeros, and store its checksum
+// when fd is not negative it holds the same data, whole sectors are then copied from it by the kernel into images opened in place
+void fs_file_write_blk(int index, uint8_t* data, uint32_t len, int fd)
+{
+    fs_blkentry_t blk = fs_blktable_read(index);
+    uint32_t full = len / ATA_SECTOR_SIZE;
+    if (full > blk.count) { full = blk.count; }
+    if (full > 0 && (fd < 0 || ata_get_backend() == ATA_BACKEND_MEMORY || !ata_copy_in(blk.start, (uint64_t)full * ATA_SECTOR_SIZE, fd, 0))) { ata_write(blk.start, full, data); }
+
+    if (full < blk.count)
+    {
+        uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
+        memset(secdata, 0, ATA_SECTOR_SIZE);
+        memcpy(secdata, data + (full * ATA_SECTOR_SIZE), len - (full * ATA_SECTOR_SIZE));
+        ata_write(blk.start + full, 1, secdata);
+        free(secdata);
+    }
 
-    fs_file_t new_file = fs_filetable_create_file(file);
-    return new_file;
+    if (!(fs_info.flags & FSFLAG_CHECKSUMS)) { return; }
+    blk.crc = crc32c_zeros(crc32c(0, data, len), (blk.count * ATA_SECTOR_SIZE) - len);
+    fs_blktable_write(index, blk);
 }
 
 fs_file_t fs_file_read(const char* path)
 {
     if (path == NULL) { printf("Path was null while trying to read file %s\n", path); return NULL_FILE; }
     if (strlen(path) == 0) { printf("Path was empty while trying to read file %s\n", path); return NULL_FILE; }
+    STATS_SCOPE(STATS_OP_FS_READ);
 
+    // file lock keeps writers from replacing or deleting the block while it is read, the lookup itself takes no lock
+    uint32_t key = fslock_file_key(path);
+    fslock_file_read(key);
     fs_file_t file = fs_get_file_byname(path);
-    if (file.type != FSTYPE_FILE) { printf("Unable to locate file %s", path); return NULL_FILE; }
+    if (file.type != FSTYPE_FILE) { fslock_file_unlock(key); printf("Unable to locate file %s", path); return NULL_FILE; }
+
+    // inline contents come with the extension record and packed ones with the sectors holding the tail, padded to a sector like block reads
+    // pack extents are checked by fsck as a whole, a tail alone cannot be checked against them
+    if (file.status & (FSSTATUS_INLINE | FSSTATUS_PACKED))
+    {
+        uint8_t* data  = calloc(fs_bytes_to_sectors(file.size), ATA_SECTOR_SIZE);
+        bool_t   found = (file.status & FSSTATUS_PACKED) ? pack_load(file.blk_index, file.size, data) : fs_filetable_read_inline(file.blk_index, data, file.size);
+        fslock_file_unlock(key);
+        if (!found) { printf("Unable to read small file %s\n", path); free(data); return NULL_FILE; }
+        STAT_ADD(STAT_BYTES_READ, file.size);
+        file.data = data;
+        return file;
+    }
 
     fs_blkentry_t blk = fs_blktable_read(file.blk_index);
 
     uint8_t* data = malloc(blk.count * ATA_SECTOR_SIZE);
-    for (uint32_t i = 0; i < blk.count; i++) { ata_read(blk.start + i, 1, data + (i * ATA_SECTOR_SIZE)); }
+    ata_read(blk.start, blk.count, data);
+    fslock_file_unlock(key);
+
+    // blocks written before checksums were enabled have no checksum
+    if ((fs_info.flags & FSFLAG_CHECKSUMS) && blk.crc != 0 && crc32c(0, data, blk.count * ATA_SECTOR_SIZE) != blk.crc)
+    {
+        printf("Checksum mismatch in file %s\n", path);
+        free(data);
+        return NULL_FILE;
+    }
+
+    // decompress into buffer padded to whole sectors like uncompressed reads
+    if (file.status & FSSTATUS_COMPRESSED)
+    {
+        uint32_t csize;
+        memcpy(&csize, data, sizeof(uint32_t));
+        uint32_t out_size = fs_bytes_to_sectors(file.size) * ATA_SECTOR_SIZE;
+        uint8_t* output = malloc(out_size);
+        memset(output, 0, out_size);
+        if (csize > blk.count * ATA_SECTOR_SIZE - sizeof(uint32_t) || lz_decompress(data + sizeof(uint32_t), csize, output, file.size) != file.size)
+        {
+            printf("Unable to decompress file %s\n", path);
+            free(output);
+            free(data);
+            return NULL_FILE;
+        }
+        free(data);
+        data = output;
+    }
+
+    STAT_ADD(STAT_BYTES_READ, file.size);
     file.data = data;
     return file;
 }
 
+// write contents of file to host file descriptor, stored blocks go straight from the image without a buffer
+bool_t fs_file_export(const char* path, int fd)
+{
+    uint32_t key = fslock_file_key(path);
+    fslock_file_read(key);
+    fs_file_t file = fs_get_file_byname(path);
+    if (file.type != FSTYPE_FILE) { fslock_file_unlock(key); printf("Unable to locate file %s\n", path); return FALSE; }
+
+    if (file.status & (FSSTATUS_INLINE | FSSTATUS_PACKED))
+    {
+        uint8_t data[FS_PACK_MAX];
+        bool_t  found  = (file.status & FSSTATUS_PACKED) ? pack_load(file.blk_index, file.size, data) : fs_filetable_read_inline(file.blk_index, data, file.size);
+        bool_t  result = found && pwrite(fd, data, file.size, 0) == (ssize_t)file.size;
+        fslock_file_unlock(key);
+        if (!result) { printf("Unable to export file %s\n", path); return FALSE; }
+        STAT_ADD(STAT_BYTES_READ, file.size);
+        return TRUE;
+    }
+
+    // compressed files are read and decompressed as usual
+    if (file.status & FSSTATUS_COMPRESSED)
+    {
+        fslock_file_unlock(key);
+        fs_file_t full = fs_file_read(path);
+        if (full.type != FSTYPE_FILE) { return FALSE; }
+        uint32_t done = 0;
+        while (done < full.size)
+        {
+            ssize_t n = pwrite(fd, full.data + done, full.size - done, done);
+            if (n <= 0) { break; }
+            done += n;
+        }
+        free(full.data);
+        return done == full.size;
+    }
+
+    fs_blkentry_t blk = fs_blktable_read(file.blk_index);
+    bool_t result = (uint64_t)blk.count * ATA_SECTOR_SIZE >= file.size && ata_copy_out(blk.start, file.size, fd, 0);
+    fslock_file_unlock(key);
+    if (!result) { printf("Unable to export file %s\n", path); return FALSE; }
+    STAT_ADD(STAT_BYTES_READ, file.size);
+    return TRUE;
+}
+
 bool_t fs_file_write(const char* path, uint8_t* data, uint32_t len)
+{
+    return fs_file_write_fd(path, data, len, -1);
+}
+
+// import host file, mapped instead of read into memory so only the copy into the image touches its contents
+bool_t fs_file_import(const char* path, int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { printf("Unable to import empty file %s\n", path); return FALSE; }
+    if ((uint64_t)st.st_size > UINT32_MAX) { printf("File is too large to import to %s\n", path); return FALSE; }
+
+    uint8_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) { printf("Unable to map file while importing to %s\n", path); return FALSE; }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    bool_t result = fs_file_write_fd(path, data, st.st_size, fd);
+    munmap(data, st.st_size);
+    return result;
+}
+
+// write file from data, fd is -1 or a host file holding the same data
+bool_t fs_file_write_fd(const char* path, uint8_t* data, uint32_t len, int fd)
 {
     if (path == NULL) { printf("Path was null while trying to write file %s\n", path); return FALSE; }
     if (strlen(path) == 0) { printf("Path was empty while trying to write file %s\n", path); return FALSE; }
+    fs_path_t parsed;
+    if (!fs_path_parse(path, &parsed)) { printf("Path was invalid while trying to write file %s\n", path); return FALSE; }
+    STATS_SCOPE(STATS_OP_FS_WRITE);
+
+    // store compressed copy when enabled and it saves at least a sector
+    uint8_t  status  = 0x00;
+    uint8_t* payload = data;
+    uint32_t payload_len = len;
+    uint8_t* compressed = fs_compression ? fs_file_compress(data, len, &payload_len) : NULL;
+    if (compressed != NULL) { payload = compressed; status |= FSSTATUS_COMPRESSED; }
+    else { payload_len = len; }
+    uint32_t sectors = fs_bytes_to_sectors(payload_len);
+
+    // tiny files are kept in the file table and use no block, too small to ever be compressed
+    // small ones share pack extents with other tails instead of each rounding up to whole sectors
+    bool_t inline_data = compressed == NULL && len > 0 && len <= FS_INLINE_MAX;
+    bool_t packed      = compressed == NULL && len > FS_INLINE_MAX && len <= FS_PACK_MAX;
+    if (inline_data) { status |= FSSTATUS_INLINE; }
+    if (packed) { status |= FSSTATUS_PACKED; }
+
+    // existing files are rewritten under a shared path lock, creating a file changes the namespace
+    // as do records created or deleted when a file moves between inline and block storage
+    // the file lock is held throughout either way, readers never see storage that is being replaced or freed
+    uint32_t key    = fslock_file_key(path);
+    bool_t   result = TRUE;
+    fslock_path_read();
+    fslock_file_write(key);
+    int       findex;
+    fs_file_t tryload = fs_path_file(&parsed, &findex);
+    if (tryload.type != FSTYPE_FILE || inline_data != ((tryload.status & FSSTATUS_INLINE) != 0))
+    {
+        fslock_file_unlock(key);
+        fslock_path_unlock();
+        fslock_path_write();
+        fslock_file_write(key);
+        tryload = fs_path_file(&parsed, &findex);
+    }
+
+    // identical content already on disk is shared instead of written again, referenced before the allocator lock is dropped
+    // block indices are stable while the path lock is held, defrag takes it exclusively
+    uint64_t hash   = 0;
+    int      shared = -1;
+    if (dedup_get_enabled() && payload_len > 0 && !inline_data && !packed)
+    {
+        hash = dedup_hash(payload, payload_len, sectors);
+        fslock_alloc();
+        shared = dedup_find(hash, payload, payload_len, sectors);
+        if (shared >= 0) { fs_blktable_addref(shared); }
+        fslock_alloc_unlock();
+    }
 
-    fs_file_t tryload = fs_get_file_byname(path);
     if (tryload.type != FSTYPE_FILE) 
     { 
-        printf("File %s does not exist and will be created\n", path);
-        fs_file_t new_file = fs_file_create(path, len);
-        if (new_file.type != FSTYPE_FILE) { printf("Unable to create new file %s\n", path); return FALSE; }
-        fs_blkentry_t blk = fs_blktable_read(new_file.blk_index);
-
-        uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
-        for (uint32_t i = 0; i < blk.count; i++)
+        LOG(LOG_DEBUG, LOGCAT_PATH, "File %s does not exist and will be created\n", path);
+        fs_file_t new_file = NULL_FILE;
+        if (len == 0) { printf("Cannot create blank file\n"); }
+        else if (inline_data) { new_file = fs_file_create_inline(&parsed, data, len); }
+        else if (packed) { new_file = fs_file_create_packed(&parsed, data, len); }
+        else if (shared >= 0) { new_file = fs_file_create_entry(&parsed, len, shared, status); }
+        else { new_file = fs_file_create_blk(&parsed, len, sectors, status); }
+
+        if (new_file.type != FSTYPE_FILE) 
+        { 
+            if (len > 0) { printf("Unable to create new file %s\n", path); }
+            if (shared >= 0) { fs_blktable_release(shared); }
+            result = FALSE;
+        }
+        else
         {
-            memset(secdata, 0, ATA_SECTOR_SIZE);
-            for (uint32_t j = 0; j < ATA_SECTOR_SIZE; j++)
+            if (shared < 0 && !inline_data && !packed)
             {
-                uint32_t offset = (i * ATA_SECTOR_SIZE) + j;
-                if (offset < len) { secdata[j] = data[offset]; } else { break; }
-            }       
-            ata_write(blk.start + i, 1, secdata);
+                fs_file_write_blk(new_file.blk_index, payload, payload_len, payload == data ? fd : -1);
+                if (dedup_get_enabled()) { dedup_insert(hash, new_file.blk_index); }
+            }
+            LOG(LOG_DEBUG, LOGCAT_IO, "Written file %s to disk, size = %d, stored = %d%s\n", path, new_file.size, payload_len, shared >= 0 ? ", shared" : "");
         }
-
-        printf("Written file %s to disk, size = %d\n", path, new_file.size);
-        free(secdata);
-        return TRUE;
     }
     else 
     { 
-        printf("File %s exists\n", path); 
-        int findex = fs_get_file_index(tryload);
-        fs_blkentry_t blk = fs_blktable_read(tryload.blk_index);
-        fs_blktable_free(blk);
-        blk = fs_blktable_allocate(fs_bytes_to_sectors(len));
-        tryload.blk_index = fs_blktable_get_index(blk);
-        tryload.size = len;
-        fs_filetable_write_file(findex, tryload);
-
-        uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
-        for (uint32_t i = 0; i < blk.count; i++)
+        LOG(LOG_DEBUG, LOGCAT_PATH, "File %s exists\n", path); 
+        if (shared >= 0 && !(tryload.status & (FSSTATUS_INLINE | FSSTATUS_PACKED)) && shared == (int)tryload.blk_index) 
+        { 
+            LOG(LOG_DEBUG, LOGCAT_PATH, "File %s is unchanged\n", path);
+            fs_blktable_release(shared);
+        }
+        else if (inline_data && (tryload.status & FSSTATUS_INLINE))
+        {
+            // record is rewritten in place, readers of the file wait on its lock
+            fs_filetable_write_inline(tryload.blk_index, data, len);
+            tryload.size = len;
+            fs_filetable_write_file(findex, tryload);
+            LOG(LOG_DEBUG, LOGCAT_IO, "Written file %s to disk, size = %d, inline\n", path, tryload.size);
+        }
+        else
         {
-            memset(secdata, 0, ATA_SECTOR_SIZE);
-            for (uint32_t j = 0; j < ATA_SECTOR_SIZE; j++)
+            // old storage is released only once the new one exists, a full table leaves the file as it was
+            fs_file_t old_file = tryload;
+            if (shared >= 0) { tryload.blk_index = shared; }
+            else if (inline_data)
             {
-                uint32_t offset = (i * ATA_SECTOR_SIZE) + j;
-                if (offset < len) { secdata[j] = data[offset]; } else { break; }
-            }       
-            ata_write(blk.start + i, 1, secdata);
-        }  
-
-        printf("Written file %s to disk, size = %d\n", path, tryload.size);
-        return TRUE;      
-    }
-
+                int rec = fs_filetable_create_inline(data, len);
+                if (rec < 0) { result = FALSE; }
+                else { tryload.blk_index = rec; }
+            }
+            else if (packed)
+            {
+                int ref = pack_store(data, len);
+                if (ref < 0) { result = FALSE; }
+                else { tryload.blk_index = ref; }
+            }
+            else
+            {
+                fs_blkentry_t blk = fs_blktable_allocate(sectors);
+                if (blk.count == 0) { result = FALSE; }
+                else
+                {
+                    tryload.blk_index = fs_blktable_get_index(blk);
+                    fs_file_write_blk(tryload.blk_index, payload, payload_len, payload == data ? fd : -1);
+                    if (dedup_get_enabled()) { dedup_insert(hash, tryload.blk_index); }
+                }
+            }
 
+            if (result)
+            {
+                fs_file_release(old_file);
+                tryload.size = len;
+                tryload.status = (tryload.status & ~(FSSTATUS_COMPRESSED | FSSTATUS_INLINE | FSSTATUS_PACKED)) | status;
+                fs_filetable_write_file(findex, tryload);
+                LOG(LOG_DEBUG, LOGCAT_IO, "Written file %s to disk, size = %d, stored = %d%s\n", path, tryload.size, payload_len, shared >= 0 ? ", shared" : "");
+            }
+        }
+    }
 
-    return TRUE;
-}
\ No newline at end of file
+    fslock_file_unlock(key);
+    fslock_path_unlock();
+    if (compressed != NULL) { free(compressed); }
+    if (result) { STAT_ADD(STAT_BYTES_WRITTEN, len); }
+    return result;
+}
@@ -0,0 +1,446 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "fsck.h"
+#include "fs.h"
+#include "ata.h"
+#include "crc32c.h"
+#include "dedup.h"
+#include "pack.h"
+#include "fslock.h"
+#include "nameidx.h"
+#include "btree.h"
+
+// problems found on individual entries, used by repair
+#define FSCK_BAD_EXTENT  0x01
+#define FSCK_DANGLING    0x02
+#define FSCK_ORPHAN      0x04
+#define FSCK_LEAKED      0x08
+#define FSCK_REFS        0x10
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t count;
+    uint32_t index;
+} fsck_extent_t;
+
+typedef struct
+{
+    uint32_t      first;
+    uint32_t      last;
+    fsck_result_t result;
+} fsck_worker_t;
+
+typedef void (*fsck_phase_t)(fsck_worker_t*);
+
+// snapshot of image metadata shared by all workers
+fs_info_t      fsck_info;
+fs_blkentry_t* fsck_blks;
+uint8_t*       fsck_files;
+uint32_t*      fsck_crcs;
+uint32_t*      fsck_refs;
+uint32_t*      fsck_inline_refs;
+uint8_t*       fsck_blk_flags;
+uint8_t*       fsck_file_flags;
+fsck_extent_t* fsck_extents;
+uint32_t       fsck_extent_count;
+fsck_phase_t   fsck_phase;
+
+fs_file_t* fsck_file_at(uint32_t index) { return (fs_file_t*)(fsck_files + index * sizeof(fs_file_t)); }
+
+void* fsck_worker_main(void* arg)
+{
+    fsck_worker_t* worker = (fsck_worker_t*)arg;
+    fsck_phase(worker);
+    return NULL;
+}
+
+// run phase over range split evenly across threads, summing results
+void fsck_parallel(fsck_phase_t phase, uint32_t count, int threads, fsck_result_t* result)
+{
+    fsck_worker_t workers[FSCK_THREADS_MAX];
+    pthread_t     handles[FSCK_THREADS_MAX];
+    uint32_t      per_thread = (count + threads - 1) / threads;
+    fsck_phase = phase;
+
+    for (int i = 0; i < threads; i++)
+    {
+        memset(&workers[i], 0, sizeof(fsck_worker_t));
+        workers[i].first = i * per_thread;
+        workers[i].last  = workers[i].first + per_thread;
+        if (workers[i].first > count) { workers[i].first = count; }
+        if (workers[i].last > count) { workers[i].last = count; }
+        pthread_create(&handles[i], NULL, fsck_worker_main, &workers[i]);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(handles[i], NULL);
+        uint32_t* dest = (uint32_t*)result;
+        uint32_t* src  = (uint32_t*)&workers[i].result;
+        for (uint32_t j = 0; j < sizeof(fsck_result_t) / sizeof(uint32_t); j++) { dest[j] += src[j]; }
+    }
+}
+
+bool_t fsck_blk_empty(fs_blkentry_t* blk) { return blk->start == 0 && blk->count == 0 && blk->state == 0; }
+
+// storage of a file must exist, its extension record when inline, a pack extent holding its tail when packed and otherwise a used block
+bool_t fsck_storage_valid(fs_file_t* file)
+{
+    uint32_t blk = file->blk_index;
+    if (file->status & FSSTATUS_INLINE) { return blk > 0 && blk < fsck_info.file_table_count_max && fsck_file_at(blk)->type == FSTYPE_EXT && file->size <= FS_INLINE_MAX; }
+    if (file->status & FSSTATUS_PACKED)
+    {
+        uint32_t index = PACK_INDEX(blk);
+        return index >= 2 && index < fsck_info.blk_table_count_max && fsck_blks[index].state == FSSTATE_PACK && !(fsck_blk_flags[index] & FSCK_BAD_EXTENT) &&
+               PACK_OFFSET(blk) + file->size <= fsck_blks[index].count * ATA_SECTOR_SIZE;
+    }
+    return blk >= 2 && blk < fsck_info.blk_table_count_max && fsck_blks[blk].state == FSSTATE_USED && !(fsck_blk_flags[blk] & FSCK_BAD_EXTENT);
+}
+
+// block entries must lie inside the data region
+void fsck_phase_blocks(fsck_worker_t* worker)
+{
+    uint32_t data_end = fsck_info.blk_data_start + fsck_info.blk_data_sector_count;
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        fs_blkentry_t* blk = &fsck_blks[i];
+        if (fsck_blk_empty(blk)) { continue; }
+        if (i == 0 && blk->count == 0) { continue; }
+        if (blk->count == 0 || blk->start < fsck_info.blk_data_start || blk->start + blk->count > data_end)
+        {
+            printf("Block 0x%08x outside data region: START = 0x%08x, COUNT = 0x%08x\n", i, blk->start, blk->count);
+            fsck_blk_flags[i] |= FSCK_BAD_EXTENT;
+            worker->result.bad_extents++;
+        }
+    }
+}
+
+// neighbouring extents sorted by start must not overlap
+void fsck_phase_overlaps(fsck_worker_t* worker)
+{
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        if (i == 0) { continue; }
+        fsck_extent_t* prev = &fsck_extents[i - 1];
+        fsck_extent_t* ext  = &fsck_extents[i];
+        if (ext->start >= prev->start + prev->count) { continue; }
+        printf("Blocks 0x%08x and 0x%08x overlap at 0x%08x\n", prev->index, ext->index, ext->start);
+        worker->result.overlaps++;
+    }
+}
+
+// parent and block references of every directory and file
+void fsck_phase_files(fsck_worker_t* worker)
+{
+    uint32_t max = fsck_info.file_table_count_max;
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        fs_file_t* file = fsck_file_at(i);
+        if (file->type == FSTYPE_NULL || file->type == FSTYPE_EXT || i == 0) { continue; }
+
+        uint32_t parent = file->parent_index;
+        if (parent >= max || fsck_file_at(parent)->type != FSTYPE_DIR)
+        {
+            printf("Entry 0x%08x '%s' has dangling parent 0x%08x\n", i, file->name, parent);
+            fsck_file_flags[i] |= FSCK_DANGLING;
+            worker->result.dangling_parent++;
+        }
+        else
+        {
+            // parent chain must reach the root without cycles
+            uint32_t depth = 0;
+            while (parent != 0 && parent < max && fsck_file_at(parent)->type == FSTYPE_DIR && depth < max) { parent = fsck_file_at(parent)->parent_index; depth++; }
+            if (parent != 0)
+            {
+                printf("Entry 0x%08x '%s' is orphaned\n", i, file->name);
+                fsck_file_flags[i] |= FSCK_ORPHAN;
+                worker->result.orphans++;
+            }
+        }
+
+        if (file->type != FSTYPE_FILE) { continue; }
+        bool_t inline_data = (file->status & FSSTATUS_INLINE) != 0;
+        if (!fsck_storage_valid(file))
+        {
+            printf("File 0x%08x '%s' has dangling %s index 0x%08x\n", i, file->name, inline_data ? "inline record" : "block", file->blk_index);
+            fsck_file_flags[i] |= FSCK_DANGLING;
+            worker->result.dangling_blk++;
+            continue;
+        }
+        uint32_t* refs;
+        if (inline_data) { refs = &fsck_inline_refs[file->blk_index]; }
+        else if (file->status & FSSTATUS_PACKED) { refs = &fsck_refs[PACK_INDEX(file->blk_index)]; }
+        else { refs = &fsck_refs[file->blk_index]; }
+        __atomic_fetch_add(refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// every extension record belongs to exactly one inline file
+void fsck_phase_inline(fsck_worker_t* worker)
+{
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        if (fsck_file_at(i)->type != FSTYPE_EXT) { continue; }
+        if (fsck_inline_refs[i] == 0)
+        {
+            printf("Inline record 0x%08x is not referenced by any file\n", i);
+            fsck_file_flags[i] |= FSCK_LEAKED;
+            worker->result.leaked_blocks++;
+        }
+        else if (fsck_inline_refs[i] > 1)
+        {
+            printf("Inline record 0x%08x is referenced by %d files\n", i, fsck_inline_refs[i]);
+            worker->result.bad_refs++;
+        }
+    }
+}
+
+// used blocks must be referenced as often as their reference count says, pack extents count their tails and the name index block is owned by the file system
+void fsck_phase_refs(fsck_worker_t* worker)
+{
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        fs_blkentry_t* blk = &fsck_blks[i];
+        if (i < 2 || blk->state == FSSTATE_FREE || blk->state == FSSTATE_INDEX || (fsck_blk_flags[i] & FSCK_BAD_EXTENT)) { continue; }
+
+        uint32_t expected = blk->refs == 0 ? 1 : blk->refs;
+        if (fsck_refs[i] == 0)
+        {
+            printf("Block 0x%08x is used but not referenced by any file\n", i);
+            fsck_blk_flags[i] |= FSCK_LEAKED;
+            worker->result.leaked_blocks++;
+        }
+        else if (fsck_refs[i] != expected)
+        {
+            printf("Block 0x%08x has %d references, expected %d\n", i, fsck_refs[i], expected);
+            fsck_blk_flags[i] |= FSCK_REFS;
+            worker->result.bad_refs++;
+        }
+    }
+}
+
+// table sectors against checksum table
+void fsck_phase_table_crc(fsck_worker_t* worker)
+{
+    uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    for (uint32_t slot = worker->first; slot < worker->last; slot++)
+    {
+        uint32_t sector = slot < fsck_info.blk_table_sector_count ? fsck_info.blk_table_start + slot : fsck_info.file_table_start + (slot - fsck_info.blk_table_sector_count);
+        ata_read(sector, 1, data);
+        if (crc32c(0, data, ATA_SECTOR_SIZE) == fsck_crcs[slot]) { continue; }
+        printf("Checksum mismatch in table sector 0x%08x\n", sector);
+        worker->result.bad_table_crc++;
+    }
+    free(data);
+}
+
+// scrub data extents against their checksums
+void fsck_phase_data_crc(fsck_worker_t* worker)
+{
+    for (uint32_t i = worker->first; i < worker->last; i++)
+    {
+        fs_blkentry_t* blk = &fsck_blks[i];
+        if (i < 2 || blk->state == FSSTATE_FREE || blk->crc == 0 || (fsck_blk_flags[i] & FSCK_BAD_EXTENT)) { continue; }
+        if (fs_crc_blk(*blk) == blk->crc) { continue; }
+        printf("Checksum mismatch in block 0x%08x\n", i);
+        worker->result.bad_data_crc++;
+    }
+}
+
+int fsck_extent_compare(const void* a, const void* b)
+{
+    const fsck_extent_t* x = (const fsck_extent_t*)a;
+    const fsck_extent_t* y = (const fsck_extent_t*)b;
+    if (x->start < y->start) { return -1; }
+    return x->start > y->start;
+}
+
+// fix what can be fixed without guessing at lost data - overlaps, shared inline records and checksum mismatches are only reported
+void fsck_repair(fsck_result_t* result)
+{
+    for (uint32_t i = 1; i < fsck_info.file_table_count_max; i++)
+    {
+        fs_file_t* file = fsck_file_at(i);
+        if (file->type == FSTYPE_NULL) { continue; }
+        if (file->type == FSTYPE_EXT)
+        {
+            if (fsck_file_flags[i] & FSCK_LEAKED) { memset(file, 0, sizeof(fs_file_t)); printf("Removed inline record 0x%08x\n", i); }
+            continue;
+        }
+        if (file->type == FSTYPE_FILE && (fsck_file_flags[i] & FSCK_DANGLING) && !fsck_storage_valid(file))
+        {
+            printf("Removed file 0x%08x '%s'\n", i, file->name);
+            memset(file, 0, sizeof(fs_file_t));
+            continue;
+        }
+        if (fsck_file_flags[i] & (FSCK_DANGLING | FSCK_ORPHAN)) { file->parent_index = 0; printf("Moved entry 0x%08x '%s' to root\n", i, file->name); }
+    }
+
+    for (uint32_t i = 1; i < fsck_info.blk_table_count_max; i++)
+    {
+        fs_blkentry_t* blk = &fsck_blks[i];
+        if (fsck_blk_flags[i] & FSCK_BAD_EXTENT) { memset(blk, 0, sizeof(fs_blkentry_t)); continue; }
+        if (fsck_blk_flags[i] & FSCK_LEAKED) { blk->state = FSSTATE_FREE; blk->refs = 0; blk->crc = 0; }
+        if (fsck_blk_flags[i] & FSCK_REFS) { blk->refs = fsck_refs[i] > 1 ? fsck_refs[i] : 0; }
+    }
+
+    // recount entries
+    fsck_info.blk_table_count  = 0;
+    fsck_info.file_table_count = 0;
+    for (uint32_t i = 1; i < fsck_info.blk_table_count_max; i++) { if (!fsck_blk_empty(&fsck_blks[i])) { fsck_info.blk_table_count++; } }
+    for (uint32_t i = 1; i < fsck_info.file_table_count_max; i++) { if (fsck_file_at(i)->type != FSTYPE_NULL) { fsck_info.file_table_count++; } }
+
+    fs_set_info(fsck_info);
+    fs_table_write(fsck_info.file_table_start, fsck_info.file_table_sector_count, fsck_files);
+    fs_blktable_store(fsck_blks);
+    fs_blktable_merge_free();
+    fs_crc_rebuild();
+    nameidx_build();
+    pack_build();
+    if (dedup_get_enabled()) { dedup_build(); }
+    printf("Repaired file system\n");
+}
+
+int fsck_index_compare(const void* a, const void* b)
+{
+    int cmp = btree_compare((const btree_entry_t*)a, (const btree_entry_t*)b);
+    if (cmp != 0) { return cmp; }
+    return ((const btree_entry_t*)a)->index < ((const btree_entry_t*)b)->index ? -1 : 1;
+}
+
+// on-disk name index must hold every entry whose parent is a directory and nothing else, walked in key order from the first leaf
+void fsck_check_index(fsck_result_t* result)
+{
+    if (!btree_ready()) { printf("Name index is missing\n"); result->bad_index++; return; }
+
+    btree_entry_t* expected = calloc(fsck_info.file_table_count_max, sizeof(btree_entry_t));
+    uint32_t count = 0;
+    for (uint32_t i = 1; i < fsck_info.file_table_count_max; i++)
+    {
+        fs_file_t* file = fsck_file_at(i);
+        if (file->type == FSTYPE_NULL || file->parent_index >= fsck_info.file_table_count_max || fsck_file_at(file->parent_index)->type != FSTYPE_DIR) { continue; }
+        btree_entry_t* entry = &expected[count++];
+        memcpy(entry->name, file->name, FS_NAME_MAX - 1);
+        entry->parent = file->parent_index;
+        entry->type   = file->type;
+        entry->index  = i;
+    }
+    qsort(expected, count, sizeof(btree_entry_t), fsck_index_compare);
+
+    btree_cursor_t* cursor = malloc(sizeof(btree_cursor_t));
+    uint32_t found = 0, differ = 0;
+    uint32_t epoch = nameidx_read_begin();
+    btree_cursor_seek(cursor, 0);
+    for (const btree_entry_t* entry = btree_cursor_next(cursor); entry != NULL; entry = btree_cursor_next(cursor))
+    {
+        if (found >= count || btree_compare(entry, &expected[found]) != 0 || entry->index != expected[found].index) { differ++; }
+        found++;
+    }
+    nameidx_read_end(epoch);
+    if (found != count || differ > 0) { printf("Name index has %d entries, expected %d, %d differ\n", found, count, differ); result->bad_index++; }
+    result->bad_index += btree_verify();
+    free(cursor);
+    free(expected);
+}
+
+uint32_t fsck_errors(fsck_result_t result)
+{
+    uint32_t errors = 0;
+    uint32_t* fields = (uint32_t*)&result;
+    for (uint32_t i = 0; i < sizeof(fsck_result_t) / sizeof(uint32_t); i++) { errors += fields[i]; }
+    return errors;
+}
+
+void fsck_print(fsck_result_t result)
+{
+    printf("BAD EXTENTS:      %d\n", result.bad_extents);
+    printf("OVERLAPS:         %d\n", result.overlaps);
+    printf("DANGLING BLOCKS:  %d\n", result.dangling_blk);
+    printf("DANGLING PARENTS: %d\n", result.dangling_parent);
+    printf("ORPHANS:          %d\n", result.orphans);
+    printf("LEAKED BLOCKS:    %d\n", result.leaked_blocks);
+    printf("BAD REFERENCES:   %d\n", result.bad_refs);
+    printf("BAD COUNTS:       %d\n", result.bad_counts);
+    printf("TABLE CHECKSUMS:  %d\n", result.bad_table_crc);
+    printf("DATA CHECKSUMS:   %d\n", result.bad_data_crc);
+    printf("BAD INDEX:        %d\n", result.bad_index);
+}
+
+// check every file system invariant in parallel, optionally repairing what was found
+fsck_result_t fsck_run(bool_t repair, int threads)
+{
+    fsck_result_t result;
+    memset(&result, 0, sizeof(fsck_result_t));
+    if (!ata_loaded()) { printf("No disk image loaded\n"); result.bad_counts = 1; return result; }
+    if (threads <= 0) { threads = (int)sysconf(_SC_NPROCESSORS_ONLN); }
+    if (threads <= 0) { threads = 1; }
+    if (threads > FSCK_THREADS_MAX) { threads = FSCK_THREADS_MAX; }
+
+    // snapshot metadata, holding the path lock keeps it consistent until repair is done
+    fslock_path_write();
+    fslock_file_write_all();
+    fsck_info  = fs_get_info();
+    fsck_blks  = fs_blktable_load();
+    fsck_files = malloc(fsck_info.file_table_sector_count * ATA_SECTOR_SIZE);
+    ata_read(fsck_info.file_table_start, fsck_info.file_table_sector_count, fsck_files);
+    fsck_refs        = calloc(fsck_info.blk_table_count_max, sizeof(uint32_t));
+    fsck_inline_refs = calloc(fsck_info.file_table_count_max, sizeof(uint32_t));
+    fsck_blk_flags   = calloc(fsck_info.blk_table_count_max, sizeof(uint8_t));
+    fsck_file_flags  = calloc(fsck_info.file_table_count_max, sizeof(uint8_t));
+    fsck_extents     = malloc(fsck_info.blk_table_count_max * sizeof(fsck_extent_t));
+
+    if (fsck_file_at(0)->type != FSTYPE_DIR || fsck_file_at(0)->parent_index != UINT32_MAX) { printf("Root directory is missing\n"); result.dangling_parent++; }
+
+    fsck_parallel(fsck_phase_blocks, fsck_info.blk_table_count_max, threads, &result);
+
+    fsck_extent_count = 0;
+    for (uint32_t i = 0; i < fsck_info.blk_table_count_max; i++)
+    {
+        fs_blkentry_t* blk = &fsck_blks[i];
+        if (fsck_blk_empty(blk) || blk->count == 0 || (fsck_blk_flags[i] & FSCK_BAD_EXTENT)) { continue; }
+        fsck_extent_t ext = { blk->start, blk->count, i };
+        fsck_extents[fsck_extent_count++] = ext;
+    }
+    qsort(fsck_extents, fsck_extent_count, sizeof(fsck_extent_t), fsck_extent_compare);
+    fsck_parallel(fsck_phase_overlaps, fsck_extent_count, threads, &result);
+
+    fsck_parallel(fsck_phase_files, fsck_info.file_table_count_max, threads, &result);
+    fsck_parallel(fsck_phase_refs, fsck_info.blk_table_count_max, threads, &result);
+    fsck_parallel(fsck_phase_inline, fsck_info.file_table_count_max, threads, &result);
+
+    // entry counts, the mass block and root directory are not counted
+    uint32_t blk_count = 0, file_count = 0;
+    for (uint32_t i = 1; i < fsck_info.blk_table_count_max; i++) { if (!fsck_blk_empty(&fsck_blks[i])) { blk_count++; } }
+    for (uint32_t i = 1; i < fsck_info.file_table_count_max; i++) { if (fsck_file_at(i)->type != FSTYPE_NULL) { file_count++; } }
+    if (blk_count != fsck_info.blk_table_count) { printf("Block table count is %d, found %d entries\n", fsck_info.blk_table_count, blk_count); result.bad_counts++; }
+    if (file_count != fsck_info.file_table_count) { printf("File table count is %d, found %d entries\n", fsck_info.file_table_count, file_count); result.bad_counts++; }
+
+    fsck_crcs = NULL;
+    if (fsck_info.flags & FSFLAG_CHECKSUMS)
+    {
+        fsck_crcs = malloc(fsck_info.crc_sector_count * ATA_SECTOR_SIZE);
+        ata_read(fsck_info.crc_start, fsck_info.crc_sector_count, (uint8_t*)fsck_crcs);
+        fsck_parallel(fsck_phase_table_crc, fsck_info.blk_table_sector_count + fsck_info.file_table_sector_count, threads, &result);
+        fsck_parallel(fsck_phase_data_crc, fsck_info.blk_table_count_max, threads, &result);
+    }
+
+    if (fsck_info.flags & FSFLAG_BTREE) { fsck_check_index(&result); }
+
+    fsck_print(result);
+    uint32_t errors = fsck_errors(result);
+    printf("Checked file system with %d threads, %d problems found\n", threads, errors);
+    if (repair && errors > 0) { fsck_repair(&result); }
+
+    if (fsck_crcs != NULL) { free(fsck_crcs); }
+    free(fsck_extents);
+    free(fsck_file_flags);
+    free(fsck_blk_flags);
+    free(fsck_inline_refs);
+    free(fsck_refs);
+    free(fsck_files);
+    free(fsck_blks);
+    fslock_file_unlock_all();
+    fslock_path_unlock();
+    return result;
+}
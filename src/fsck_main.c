@@ -0,0 +1,30 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "ata.h"
+#include "fs.h"
+#include "fsck.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) { printf("Usage: voy_fsck [image] [-r : repair] [-t threads]\n"); return 2; }
+
+    bool_t repair  = FALSE;
+    int    threads = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-r")) { repair = TRUE; }
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) { threads = atoi(argv[++i]); }
+    }
+
+    ata_init();
+    ata_load_file(argv[1]);
+    if (!ata_loaded()) { return 2; }
+    fs_mount();
+
+    fsck_result_t result = fsck_run(repair, threads);
+    if (fsck_errors(result) == 0) { return 0; }
+    if (!repair) { return 1; }
+
+    ata_save_file(argv[1]);
+    return 1;
+}
@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include "fslock.h"
+
+// namespace lock - shared while rewriting existing files, exclusive for namespace changes and whole disk operations
+// lookups resolve through the name index and do not take it
+pthread_rwlock_t fslock_path_lock = PTHREAD_RWLOCK_INITIALIZER;
+__thread int     fslock_path_depth;
+__thread bool_t  fslock_path_exclusive;
+
+// file contents, striped by file name
+pthread_rwlock_t fslock_files[FSLOCK_STRIPES] = { [0 ... FSLOCK_STRIPES - 1] = PTHREAD_RWLOCK_INITIALIZER };
+
+// block allocator and dedup index, recursive as allocation nests
+pthread_mutex_t  fslock_alloc_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+// block table and file table sectors, striped by sector
+pthread_rwlock_t fslock_sectors[FSLOCK_STRIPES] = { [0 ... FSLOCK_STRIPES - 1] = PTHREAD_RWLOCK_INITIALIZER };
+
+// info block and checksum sectors
+pthread_mutex_t  fslock_meta_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// path lock is reentrant per thread, nested calls share the outermost lock
+void fslock_path_read()
+{
+    if (fslock_path_depth++ > 0) { return; }
+    pthread_rwlock_rdlock(&fslock_path_lock);
+    fslock_path_exclusive = FALSE;
+}
+
+// must not be called while holding a shared path lock
+void fslock_path_write()
+{
+    if (fslock_path_depth++ > 0)
+    {
+        if (!fslock_path_exclusive) { printf("Unable to upgrade shared path lock\n"); abort(); }
+        return;
+    }
+    pthread_rwlock_wrlock(&fslock_path_lock);
+    fslock_path_exclusive = TRUE;
+}
+
+void fslock_path_unlock()
+{
+    if (--fslock_path_depth > 0) { return; }
+    pthread_rwlock_unlock(&fslock_path_lock);
+    fslock_path_exclusive = FALSE;
+}
+
+void fslock_file_read(uint32_t key) { pthread_rwlock_rdlock(&fslock_files[key % FSLOCK_STRIPES]); }
+
+void fslock_file_write(uint32_t key) { pthread_rwlock_wrlock(&fslock_files[key % FSLOCK_STRIPES]); }
+
+void fslock_file_unlock(uint32_t key) { pthread_rwlock_unlock(&fslock_files[key % FSLOCK_STRIPES]); }
+
+// every stripe in order, for whole disk operations that move or rewrite blocks
+void fslock_file_write_all() { for (int i = 0; i < FSLOCK_STRIPES; i++) { pthread_rwlock_wrlock(&fslock_files[i]); } }
+
+void fslock_file_unlock_all() { for (int i = FSLOCK_STRIPES - 1; i >= 0; i--) { pthread_rwlock_unlock(&fslock_files[i]); } }
+
+// stripe key from final path component, so differently spelled paths to one file share a stripe
+uint32_t fslock_file_key(const char* path)
+{
+    const char* name = path;
+    size_t len = strlen(path);
+    while (len > 0 && path[len - 1] == '/') { len--; }
+    for (size_t i = 0; i < len; i++) { if (path[i] == '/') { name = path + i + 1; } }
+
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; c < path + len; c++) { hash = (hash ^ (uint8_t)*c) * 16777619u; }
+    return hash;
+}
+
+void fslock_alloc() { pthread_mutex_lock(&fslock_alloc_lock); }
+
+void fslock_alloc_unlock() { pthread_mutex_unlock(&fslock_alloc_lock); }
+
+void fslock_sector_read(uint32_t sector) { pthread_rwlock_rdlock(&fslock_sectors[sector % FSLOCK_STRIPES]); }
+
+void fslock_sector_write(uint32_t sector) { pthread_rwlock_wrlock(&fslock_sectors[sector % FSLOCK_STRIPES]); }
+
+void fslock_sector_unlock(uint32_t sector) { pthread_rwlock_unlock(&fslock_sectors[sector % FSLOCK_STRIPES]); }
+
+void fslock_meta() { pthread_mutex_lock(&fslock_meta_lock); }
+
+void fslock_meta_unlock() { pthread_mutex_unlock(&fslock_meta_lock); }
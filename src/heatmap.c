@@ -0,0 +1,158 @@
+#include "heatmap.h"
+#include "ata.h"
+
+volatile bool_t heatmap_active = FALSE;
+
+uint32_t*     heatmap_reads   = NULL;
+uint32_t*     heatmap_writes  = NULL;
+uint64_t      heatmap_sectors = 0;
+uint64_t      heatmap_last[2] = { 0, 0 };
+uint32_t      heatmap_bounds[HEATMAP_CAT_COUNT][2];
+heatmap_cat_t heatmap_cats[HEATMAP_CAT_COUNT][2];
+
+const char* HEATMAP_CAT_NAMES[HEATMAP_CAT_COUNT] = { "info", "block table", "checksums", "file table", "data" };
+const char  HEATMAP_CAT_CHARS[HEATMAP_CAT_COUNT] = { 'I', 'B', 'C', 'F', 'D' };
+const char* HEATMAP_LEVELS = " .:-=+*#%@";
+
+// sector ranges are taken from the layout at start, restart the tracer after formatting or resizing
+bool_t heatmap_start(fs_info_t info)
+{
+    if (heatmap_active) { printf("Heatmap is already being recorded\n"); return FALSE; }
+    uint64_t sectors = ata_get_disk_size() / ATA_SECTOR_SIZE;
+    if (sectors == 0) { printf("No disk image loaded\n"); return FALSE; }
+
+    // arrays are kept while stopped so late records of other threads stay in bounds
+    if (sectors != heatmap_sectors)
+    {
+        free(heatmap_reads);
+        free(heatmap_writes);
+        heatmap_reads   = calloc(sectors, sizeof(uint32_t));
+        heatmap_writes  = calloc(sectors, sizeof(uint32_t));
+        heatmap_sectors = sectors;
+    }
+
+    heatmap_bounds[HEATMAP_CAT_INFO][0]      = 0;
+    heatmap_bounds[HEATMAP_CAT_INFO][1]      = info.blk_table_start;
+    heatmap_bounds[HEATMAP_CAT_BLKTABLE][0]  = info.blk_table_start;
+    heatmap_bounds[HEATMAP_CAT_BLKTABLE][1]  = info.blk_table_start + info.blk_table_sector_count;
+    heatmap_bounds[HEATMAP_CAT_CRC][0]       = info.crc_start;
+    heatmap_bounds[HEATMAP_CAT_CRC][1]       = info.crc_start + info.crc_sector_count;
+    heatmap_bounds[HEATMAP_CAT_FILETABLE][0] = info.file_table_start;
+    heatmap_bounds[HEATMAP_CAT_FILETABLE][1] = info.file_table_start + info.file_table_sector_count;
+    heatmap_bounds[HEATMAP_CAT_DATA][0]      = 0;
+    heatmap_bounds[HEATMAP_CAT_DATA][1]      = UINT32_MAX;
+    heatmap_reset();
+    heatmap_active = TRUE;
+    printf("Recording sector heatmap of %llu sectors\n", (unsigned long long)sectors);
+    return TRUE;
+}
+
+void heatmap_stop()
+{
+    if (!heatmap_active) { printf("No heatmap is being recorded\n"); return; }
+    heatmap_active = FALSE;
+    printf("Stopped recording heatmap\n");
+}
+
+void heatmap_reset()
+{
+    if (heatmap_sectors > 0)
+    {
+        memset(heatmap_reads, 0, heatmap_sectors * sizeof(uint32_t));
+        memset(heatmap_writes, 0, heatmap_sectors * sizeof(uint32_t));
+    }
+    memset(heatmap_cats, 0, sizeof(heatmap_cats));
+    heatmap_last[0] = heatmap_last[1] = 0;
+}
+
+// first matching range wins, data is everything outside the tables
+uint8_t heatmap_category(uint64_t sector)
+{
+    for (uint8_t cat = 0; cat < HEATMAP_CAT_DATA; cat++)
+    {
+        if (sector >= heatmap_bounds[cat][0] && sector < heatmap_bounds[cat][1]) { return cat; }
+    }
+    return HEATMAP_CAT_DATA;
+}
+
+void heatmap_record(bool_t write, uint64_t sector, uint32_t count)
+{
+    // per direction, the previous access end is swapped atomically so concurrent callers each see one predecessor
+    uint64_t last = __atomic_exchange_n(&heatmap_last[write ? 1 : 0], sector + count, __ATOMIC_RELAXED);
+    heatmap_cat_t* cat = &heatmap_cats[heatmap_category(sector)][write ? 1 : 0];
+    __atomic_fetch_add(&cat->accesses, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cat->sectors, count, __ATOMIC_RELAXED);
+    if (last == sector) { __atomic_fetch_add(&cat->sequential, 1, __ATOMIC_RELAXED); }
+
+    uint32_t* counts = write ? heatmap_writes : heatmap_reads;
+    for (uint64_t i = sector; i < sector + count && i < heatmap_sectors; i++) { __atomic_fetch_add(&counts[i], 1, __ATOMIC_RELAXED); }
+}
+
+// intensity character on a log scale relative to the hottest column
+char heatmap_level(uint64_t value, uint64_t max)
+{
+    if (value == 0 || max == 0) { return HEATMAP_LEVELS[0]; }
+    int bits = 64 - __builtin_clzll(value);
+    int max_bits = 64 - __builtin_clzll(max);
+    int levels = strlen(HEATMAP_LEVELS) - 1;
+    if (max_bits <= 1) { return HEATMAP_LEVELS[levels]; }
+    return HEATMAP_LEVELS[1 + ((bits - 1) * (levels - 1)) / (max_bits - 1)];
+}
+
+void heatmap_print()
+{
+    if (heatmap_sectors == 0) { printf("No heatmap has been recorded\n"); return; }
+    printf("Heatmap is %s\n", heatmap_active ? "being recorded" : "stopped");
+
+    printf("%-12s %10s %10s %8s %10s %10s %8s\n", "category", "reads", "sectors", "seq %", "writes", "sectors", "seq %");
+    for (int i = 0; i < HEATMAP_CAT_COUNT; i++)
+    {
+        heatmap_cat_t* r = &heatmap_cats[i][0];
+        heatmap_cat_t* w = &heatmap_cats[i][1];
+        printf("%-12s %10llu %10llu %8.1f %10llu %10llu %8.1f\n", HEATMAP_CAT_NAMES[i],
+               (unsigned long long)r->accesses, (unsigned long long)r->sectors, r->accesses ? (100.0 * r->sequential) / r->accesses : 0.0,
+               (unsigned long long)w->accesses, (unsigned long long)w->sectors, w->accesses ? (100.0 * w->sequential) / w->accesses : 0.0);
+    }
+
+    // hottest sectors by total accesses
+    uint64_t top[HEATMAP_TOP];
+    uint64_t top_count[HEATMAP_TOP];
+    int found = 0;
+    for (uint64_t s = 0; s < heatmap_sectors; s++)
+    {
+        uint64_t total = (uint64_t)heatmap_reads[s] + heatmap_writes[s];
+        if (total == 0 || (found == HEATMAP_TOP && total <= top_count[HEATMAP_TOP - 1])) { continue; }
+        int pos = (found < HEATMAP_TOP) ? found++ : HEATMAP_TOP - 1;
+        while (pos > 0 && top_count[pos - 1] < total) { top[pos] = top[pos - 1]; top_count[pos] = top_count[pos - 1]; pos--; }
+        top[pos] = s;
+        top_count[pos] = total;
+    }
+    printf("Hottest sectors:\n");
+    for (int i = 0; i < found; i++)
+    {
+        printf("  0x%08llx %-12s reads %10u writes %10u\n", (unsigned long long)top[i], HEATMAP_CAT_NAMES[heatmap_category(top[i])],
+               heatmap_reads[top[i]], heatmap_writes[top[i]]);
+    }
+
+    // whole disk in columns, one row each for reads and writes plus the category at the start of each column
+    uint64_t per_column = (heatmap_sectors + HEATMAP_COLUMNS - 1) / HEATMAP_COLUMNS;
+    uint64_t columns[2][HEATMAP_COLUMNS];
+    uint64_t max = 0;
+    memset(columns, 0, sizeof(columns));
+    for (uint64_t s = 0; s < heatmap_sectors; s++)
+    {
+        columns[0][s / per_column] += heatmap_reads[s];
+        columns[1][s / per_column] += heatmap_writes[s];
+    }
+    for (int c = 0; c < HEATMAP_COLUMNS; c++) { if (columns[0][c] > max) { max = columns[0][c]; } if (columns[1][c] > max) { max = columns[1][c]; } }
+
+    char row[HEATMAP_COLUMNS + 1];
+    row[HEATMAP_COLUMNS] = 0;
+    printf("Map, %llu sectors per column, scale '%s':\n", (unsigned long long)per_column, HEATMAP_LEVELS);
+    for (int c = 0; c < HEATMAP_COLUMNS; c++) { row[c] = HEATMAP_CAT_CHARS[heatmap_category(c * per_column)]; }
+    printf("  layout |%s|\n", row);
+    for (int c = 0; c < HEATMAP_COLUMNS; c++) { row[c] = heatmap_level(columns[0][c], max); }
+    printf("  reads  |%s|\n", row);
+    for (int c = 0; c < HEATMAP_COLUMNS; c++) { row[c] = heatmap_level(columns[1][c], max); }
+    printf("  writes |%s|\n", row);
+}
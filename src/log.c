@@ -0,0 +1,56 @@
+#include <stdarg.h>
+#include "log.h"
+
+// per operation messages are debug output and off until raised at runtime
+uint8_t  log_level      = LOG_INFO;
+uint32_t log_categories = LOGCAT_ALL;
+
+const char* LOG_LEVEL_NAMES[] = { "error", "warn", "info", "debug", "trace" };
+const char* LOG_CAT_NAMES[]   = { "alloc", "table", "path", "io" };
+
+void log_write(uint8_t level, uint32_t cat, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void log_set_level(uint8_t level) { log_level = level > LOG_TRACE ? LOG_TRACE : level; }
+
+void log_set_categories(uint32_t categories) { log_categories = categories & LOGCAT_ALL; }
+
+// level from name - returns -1 if unknown
+int log_parse_level(const char* str)
+{
+    for (int i = 0; i <= LOG_TRACE; i++) { if (!strcmp(str, LOG_LEVEL_NAMES[i])) { return i; } }
+    return -1;
+}
+
+// category mask from comma separated names - returns -1 if any is unknown
+int log_parse_categories(const char* str)
+{
+    if (!strcmp(str, "all")) { return LOGCAT_ALL; }
+
+    int    count = 0;
+    char** names = strsplit(str, ',', &count);
+    int    mask  = 0;
+    for (int i = 0; i < count && mask >= 0; i++)
+    {
+        int bit = -1;
+        for (int j = 0; j < 4; j++) { if (!strcmp(names[i], LOG_CAT_NAMES[j])) { bit = j; } }
+        mask = bit < 0 ? -1 : mask | (1 << bit);
+    }
+    freearray(names, count);
+    return mask;
+}
+
+const char* log_level_name(uint8_t level) { return level <= LOG_TRACE ? LOG_LEVEL_NAMES[level] : "unknown"; }
+
+void log_print()
+{
+    printf("Log level is %s, categories =", log_level_name(log_level));
+    for (int i = 0; i < 4; i++) { if (log_categories & (1 << i)) { printf(" %s", LOG_CAT_NAMES[i]); } }
+    if (LOG_LEVEL_MAX < LOG_TRACE) { printf(", compiled up to %s", log_level_name(LOG_LEVEL_MAX)); }
+    printf("\n");
+}
@@ -0,0 +1,111 @@
+#include "lz.h"
+
+// worst case output size for input of specified length
+uint32_t lz_bound(uint32_t len)
+{
+    return len + (len / 255) + 16;
+}
+
+uint32_t lz_hash(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// write extended length bytes for lengths that do not fit in a token nibble
+uint8_t* lz_write_length(uint8_t* op, uint32_t len)
+{
+    while (len >= 255) { *op++ = 255; len -= 255; }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// compress data - returns compressed size, or 0 if output would exceed capacity
+uint32_t lz_compress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t cap)
+{
+    if (cap < lz_bound(len)) { return 0; }
+
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t* ip     = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end    = src + len;
+    const uint8_t* limit  = (len > LZ_MIN_MATCH + 8) ? end - (LZ_MIN_MATCH + 8) : src;
+    uint8_t*       op     = dst;
+
+    while (ip < limit)
+    {
+        uint32_t h = lz_hash(ip);
+        const uint8_t* ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || memcmp(ref, ip, LZ_MIN_MATCH)) { ip++; continue; }
+
+        // extend match, leaving the last bytes of the input as literals
+        const uint8_t* mp = ip + LZ_MIN_MATCH;
+        const uint8_t* rp = ref + LZ_MIN_MATCH;
+        while (mp < end - 5 && *mp == *rp) { mp++; rp++; }
+
+        uint32_t lit   = (uint32_t)(ip - anchor);
+        uint32_t match = (uint32_t)(mp - ip) - LZ_MIN_MATCH;
+        uint8_t* token = op++;
+        *token = (uint8_t)(((lit >= 15 ? 15 : lit) << 4) | (match >= 15 ? 15 : match));
+        if (lit >= 15) { op = lz_write_length(op, lit - 15); }
+        memcpy(op, anchor, lit);
+        op += lit;
+
+        uint16_t offset = (uint16_t)(ip - ref);
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if (match >= 15) { op = lz_write_length(op, match - 15); }
+
+        ip = mp;
+        anchor = ip;
+    }
+
+    // final literal run
+    uint32_t lit = (uint32_t)(end - anchor);
+    *op++ = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) { op = lz_write_length(op, lit - 15); }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return (uint32_t)(op - dst);
+}
+
+// decompress data - returns decompressed size, or 0 if input is malformed
+uint32_t lz_decompress(const uint8_t* src, uint32_t len, uint8_t* dst, uint32_t out_len)
+{
+    const uint8_t* ip   = src;
+    const uint8_t* iend = src + len;
+    uint8_t*       op   = dst;
+    uint8_t*       oend = dst + out_len;
+
+    while (ip < iend)
+    {
+        uint8_t  token = *ip++;
+        uint32_t lit   = token >> 4;
+        if (lit == 15) { uint8_t b; do { if (ip >= iend) { return 0; } b = *ip++; lit += b; } while (b == 255); }
+        if (lit > (uint32_t)(iend - ip) || lit > (uint32_t)(oend - op)) { return 0; }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip >= iend || op >= oend) { break; }
+
+        if (iend - ip < 2) { return 0; }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        uint32_t match = token & 0x0F;
+        if (match == 15) { uint8_t b; do { if (ip >= iend) { return 0; } b = *ip++; match += b; } while (b == 255); }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (uint32_t)(op - dst) || match > (uint32_t)(oend - op)) { return 0; }
+
+        // byte copy handles overlapping matches
+        const uint8_t* ref = op - offset;
+        if (offset >= match) { memcpy(op, ref, match); op += match; }
+        else { while (match--) { *op++ = *ref++; } }
+    }
+
+    return (uint32_t)(op - dst);
+}
@@ -0,0 +1,711 @@
+#include <pthread.h>
+#include <sched.h>
+#include "nameidx.h"
+#include "dcache.h"
+#include "ata.h"
+#include "stats.h"
+
+// writers copy the nodes from a directory's tree root down to the changed leaf, publish the new root and free the replaced nodes once no reader can still see them
+typedef struct
+{
+    uint32_t count;
+    uint8_t  padding[60];
+} nameidx_counter_t;
+
+nameidx_table_t*  nameidx_current = NULL;
+uint32_t          nameidx_epoch   = 0;
+nameidx_counter_t nameidx_readers[2][NAMEIDX_STRIPES];
+uint32_t          nameidx_next_stripe = 0;
+__thread uint32_t nameidx_stripe = UINT32_MAX;
+pthread_mutex_t   nameidx_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// nodes replaced while the write lock is held, freed once no reader can still see them
+nameidx_node_t**  nameidx_retired       = NULL;
+uint32_t          nameidx_retired_count = 0;
+uint32_t          nameidx_retired_max   = 0;
+
+// nodes are sized to their entries and never change once published, the child pointers follow the entries
+nameidx_node_t* nameidx_node_create(bool_t leaf, const nameidx_entry_t* entries, nameidx_node_t* const* children, uint32_t count)
+{
+    size_t offset = (sizeof(nameidx_node_t) + (count * sizeof(nameidx_entry_t)) + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    nameidx_node_t* node = malloc(offset + (leaf ? 0 : count * sizeof(nameidx_node_t*)));
+    node->leaf     = leaf;
+    node->count    = count;
+    node->total    = leaf ? count : 0;
+    node->children = leaf ? NULL : (nameidx_node_t**)((uint8_t*)node + offset);
+    if (count > 0) { memcpy(node->entries, entries, count * sizeof(nameidx_entry_t)); }
+    for (uint32_t i = 0; !leaf && i < count; i++)
+    {
+        node->children[i] = children[i];
+        node->total += children[i]->total;
+    }
+    return node;
+}
+
+// nodes for count sorted items, split in two halves when they do not fit one - returns the number of nodes
+uint32_t nameidx_node_emit(bool_t leaf, const nameidx_entry_t* entries, nameidx_node_t* const* children, uint32_t count, nameidx_node_t** out)
+{
+    if (count <= NAMEIDX_NODE_MAX) { out[0] = nameidx_node_create(leaf, entries, children, count); return 1; }
+    uint32_t half = count / 2;
+    out[0] = nameidx_node_create(leaf, entries, children, half);
+    out[1] = nameidx_node_create(leaf, entries + half, leaf ? NULL : children + half, count - half);
+    return 2;
+}
+
+void nameidx_retire(nameidx_node_t* node)
+{
+    if (nameidx_retired_count == nameidx_retired_max)
+    {
+        nameidx_retired_max = (nameidx_retired_max == 0) ? 64 : nameidx_retired_max * 2;
+        nameidx_retired = realloc(nameidx_retired, nameidx_retired_max * sizeof(nameidx_node_t*));
+    }
+    nameidx_retired[nameidx_retired_count++] = node;
+}
+
+void nameidx_retire_tree(nameidx_node_t* node)
+{
+    for (uint32_t i = 0; !node->leaf && i < node->count; i++) { nameidx_retire_tree(node->children[i]); }
+    nameidx_retire(node);
+}
+
+void nameidx_tree_free(nameidx_node_t* node)
+{
+    for (uint32_t i = 0; !node->leaf && i < node->count; i++) { nameidx_tree_free(node->children[i]); }
+    free(node);
+}
+
+nameidx_node_t* nameidx_slot_load(nameidx_table_t* table, uint32_t dir) { return __atomic_load_n(&table->roots[dir], __ATOMIC_ACQUIRE); }
+
+void nameidx_slot_store(nameidx_table_t* table, uint32_t dir, nameidx_node_t* root) { __atomic_store_n(&table->roots[dir], root, __ATOMIC_RELEASE); }
+
+void nameidx_table_free(nameidx_table_t* table)
+{
+    if (table == NULL) { return; }
+    for (uint32_t i = 0; i < table->count; i++) { if (table->roots[i] != NULL) { nameidx_tree_free(table->roots[i]); } }
+    free(table->roots);
+    free(table);
+}
+
+int nameidx_compare(const char* name, uint8_t type, const nameidx_entry_t* entry)
+{
+    int cmp = strncmp(name, entry->name, FS_NAME_MAX);
+    if (cmp != 0) { return cmp; }
+    return (int)type - (int)entry->type;
+}
+
+// compare unterminated name of len characters, a name that is a prefix of the entry sorts first as with strncmp
+int nameidx_compare_span(const char* name, uint32_t len, uint8_t type, const nameidx_entry_t* entry)
+{
+    int cmp = strncmp(name, entry->name, len);
+    if (cmp != 0) { return cmp; }
+    if (len < FS_NAME_MAX && entry->name[len] != 0) { return -1; }
+    return (int)type - (int)entry->type;
+}
+
+int nameidx_entry_compare(const void* a, const void* b)
+{
+    const nameidx_entry_t* x = (const nameidx_entry_t*)a;
+    return nameidx_compare(x->name, x->type, (const nameidx_entry_t*)b);
+}
+
+// first position whose entry is not below name and type
+uint32_t nameidx_lower_bound(const nameidx_node_t* node, const char* name, uint32_t len, uint8_t type)
+{
+    uint32_t low = 0, high = node->count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (nameidx_compare_span(name, len, type, &node->entries[mid]) > 0) { low = mid + 1; }
+        else { high = mid; }
+    }
+    return low;
+}
+
+// child of inner node that holds name and type, the last one whose lowest entry is not above it
+uint32_t nameidx_node_child(const nameidx_node_t* node, const char* name, uint32_t len, uint8_t type)
+{
+    uint32_t low = 0, high = node->count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (nameidx_compare_span(name, len, type, &node->entries[mid]) >= 0) { low = mid + 1; }
+        else { high = mid; }
+    }
+    return (low > 0) ? low - 1 : 0;
+}
+
+// leaf of tree that holds name and type
+const nameidx_node_t* nameidx_node_leaf(const nameidx_node_t* node, const char* name, uint32_t len, uint8_t type)
+{
+    while (!node->leaf) { node = node->children[nameidx_node_child(node, name, len, type)]; }
+    return node;
+}
+
+// enter read side - lookups in between see one consistent version and never wait for writers
+uint32_t nameidx_read_begin()
+{
+    if (nameidx_stripe == UINT32_MAX) { nameidx_stripe = __atomic_fetch_add(&nameidx_next_stripe, 1, __ATOMIC_RELAXED) % NAMEIDX_STRIPES; }
+    while (TRUE)
+    {
+        uint32_t epoch = __atomic_load_n(&nameidx_epoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&nameidx_readers[epoch & 1][nameidx_stripe].count, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&nameidx_epoch, __ATOMIC_SEQ_CST) == epoch) { return epoch; }
+        __atomic_sub_fetch(&nameidx_readers[epoch & 1][nameidx_stripe].count, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void nameidx_read_end(uint32_t epoch) { __atomic_sub_fetch(&nameidx_readers[epoch & 1][nameidx_stripe].count, 1, __ATOMIC_RELEASE); }
+
+// wait until every reader that started before now has left, called by writers after publishing
+void nameidx_synchronize()
+{
+    uint32_t epoch = __atomic_fetch_add(&nameidx_epoch, 1, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < NAMEIDX_STRIPES; i++)
+    {
+        while (__atomic_load_n(&nameidx_readers[epoch & 1][i].count, __ATOMIC_ACQUIRE) != 0) { sched_yield(); }
+    }
+}
+
+void nameidx_publish(nameidx_table_t* table)
+{
+    nameidx_table_t* old = __atomic_exchange_n(&nameidx_current, table, __ATOMIC_SEQ_CST);
+    nameidx_synchronize();
+    nameidx_table_free(old);
+}
+
+// tree over count sorted entries, leaves and inner nodes are filled to NAMEIDX_NODE_FILL so early inserts do not split them
+nameidx_node_t* nameidx_tree_build(const nameidx_entry_t* entries, uint32_t count)
+{
+    if (count <= NAMEIDX_NODE_MAX) { return nameidx_node_create(TRUE, entries, NULL, count); }
+
+    uint32_t         nodes = (count + NAMEIDX_NODE_FILL - 1) / NAMEIDX_NODE_FILL;
+    nameidx_node_t** level = malloc(nodes * sizeof(nameidx_node_t*));
+    nameidx_entry_t* keys  = malloc(nodes * sizeof(nameidx_entry_t));
+    for (uint32_t n = 0; n < nodes; n++)
+    {
+        uint32_t start = (uint32_t)(((uint64_t)n * count) / nodes);
+        uint32_t end   = (uint32_t)(((uint64_t)(n + 1) * count) / nodes);
+        level[n] = nameidx_node_create(TRUE, entries + start, NULL, end - start);
+        keys[n]  = entries[start];
+    }
+
+    // each level groups the one below evenly, written over its front as groups never start before their own slot
+    while (nodes > NAMEIDX_NODE_MAX)
+    {
+        uint32_t groups = (nodes + NAMEIDX_NODE_FILL - 1) / NAMEIDX_NODE_FILL;
+        for (uint32_t n = 0; n < groups; n++)
+        {
+            uint32_t start = (uint32_t)(((uint64_t)n * nodes) / groups);
+            uint32_t end   = (uint32_t)(((uint64_t)(n + 1) * nodes) / groups);
+            nameidx_node_t* node = nameidx_node_create(FALSE, keys + start, level + start, end - start);
+            level[n] = node;
+            keys[n]  = node->entries[0];
+        }
+        nodes = groups;
+    }
+
+    nameidx_node_t* root = nameidx_node_create(FALSE, keys, level, nodes);
+    free(keys);
+    free(level);
+    return root;
+}
+
+int nameidx_disk_compare(const void* a, const void* b) { return btree_compare((const btree_entry_t*)a, (const btree_entry_t*)b); }
+
+// write the on-disk index from file table, entries are kept under the same rules as in memory - returns FALSE when the index block is missing or full
+bool_t nameidx_build_disk(fs_info_t info)
+{
+    uint8_t*       types   = calloc(info.file_table_count_max, sizeof(uint8_t));
+    btree_entry_t* entries = calloc(info.file_table_count_max, sizeof(btree_entry_t));
+    uint8_t*       data    = malloc(ATA_SECTOR_SIZE);
+
+    uint32_t index = 0;
+    for (uint32_t sec = 0; sec < info.file_table_sector_count; sec++)
+    {
+        fs_table_read(info.file_table_start + sec, 1, data);
+        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
+        {
+            fs_file_t* entry = (fs_file_t*)(data + i);
+            types[index] = entry->type;
+            entries[index].parent = entry->parent_index;
+            entries[index].type   = entry->type;
+            entries[index].index  = index;
+            memcpy(entries[index].name, entry->name, FS_NAME_MAX - 1);
+            index++;
+        }
+    }
+
+    // keys are packed to the front in place, entries with dangling parents are left out
+    uint32_t count = 0;
+    for (uint32_t i = 1; i < info.file_table_count_max; i++)
+    {
+        if (types[i] == FSTYPE_NULL || entries[i].parent >= info.file_table_count_max || types[entries[i].parent] != FSTYPE_DIR) { continue; }
+        entries[count++] = entries[i];
+    }
+    qsort(entries, count, sizeof(btree_entry_t), nameidx_disk_compare);
+
+    // readers use neither index while the tree is written, the memory one is dropped once it is in place
+    pthread_mutex_lock(&nameidx_write_lock);
+    btree_stop();
+    nameidx_synchronize();
+    bool_t built = btree_attach() && btree_build(entries, count);
+    if (built)
+    {
+        nameidx_publish(NULL);
+        dcache_clear();
+    }
+    pthread_mutex_unlock(&nameidx_write_lock);
+
+    free(data);
+    free(entries);
+    free(types);
+    return built;
+}
+
+// build index from file table, done when mounting or after the table was rewritten
+void nameidx_build()
+{
+    fs_info_t info = fs_get_info();
+    if (info.flags & FSFLAG_BTREE)
+    {
+        if (nameidx_build_disk(info)) { return; }
+        printf("Unable to build on-disk name index, file table is indexed in memory\n");
+        info.flags &= ~FSFLAG_BTREE;
+        fs_set_info(info);
+    }
+
+    nameidx_table_t* table = malloc(sizeof(nameidx_table_t));
+    table->count = info.file_table_count_max;
+    table->roots = calloc(table->count, sizeof(nameidx_node_t*));
+
+    uint32_t* types    = calloc(table->count, sizeof(uint32_t));
+    uint32_t* parents  = calloc(table->count, sizeof(uint32_t));
+    uint32_t* children = calloc(table->count, sizeof(uint32_t));
+    char*     names    = malloc(table->count * FS_NAME_MAX);
+    uint8_t*  data     = malloc(ATA_SECTOR_SIZE);
+
+    uint32_t index = 0;
+    for (uint32_t sec = 0; sec < info.file_table_sector_count; sec++)
+    {
+        fs_table_read(info.file_table_start + sec, 1, data);
+        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
+        {
+            fs_file_t* entry = (fs_file_t*)(data + i);
+            types[index]   = entry->type;
+            parents[index] = entry->parent_index;
+            memcpy(names + (index * FS_NAME_MAX), entry->name, FS_NAME_MAX);
+            names[(index * FS_NAME_MAX) + FS_NAME_MAX - 1] = 0;
+            index++;
+        }
+    }
+
+    // count children of each directory, entries with dangling parents are left out
+    for (uint32_t i = 1; i < table->count; i++)
+    {
+        if (types[i] == FSTYPE_NULL || parents[i] >= table->count || types[parents[i]] != FSTYPE_DIR) { continue; }
+        children[parents[i]]++;
+    }
+
+    // children of all directories in one array, each directory's run starts at its offset
+    uint32_t* offsets = malloc(table->count * sizeof(uint32_t));
+    uint32_t  total   = 0;
+    for (uint32_t i = 0; i < table->count; i++) { offsets[i] = total; total += children[i]; children[i] = 0; }
+    nameidx_entry_t* entries = malloc((total > 0 ? total : 1) * sizeof(nameidx_entry_t));
+    for (uint32_t i = 1; i < table->count; i++)
+    {
+        if (types[i] == FSTYPE_NULL || parents[i] >= table->count || types[parents[i]] != FSTYPE_DIR) { continue; }
+        nameidx_entry_t* entry = &entries[offsets[parents[i]] + children[parents[i]]++];
+        memcpy(entry->name, names + (i * FS_NAME_MAX), FS_NAME_MAX);
+        entry->type  = types[i];
+        entry->index = i;
+    }
+    for (uint32_t i = 0; i < table->count; i++)
+    {
+        if (types[i] != FSTYPE_DIR) { continue; }
+        qsort(entries + offsets[i], children[i], sizeof(nameidx_entry_t), nameidx_entry_compare);
+        table->roots[i] = nameidx_tree_build(entries + offsets[i], children[i]);
+    }
+
+    free(entries);
+    free(offsets);
+    free(data);
+    free(names);
+    free(children);
+    free(parents);
+    free(types);
+
+    pthread_mutex_lock(&nameidx_write_lock);
+    btree_stop();
+    nameidx_publish(table);
+    dcache_clear();
+    pthread_mutex_unlock(&nameidx_write_lock);
+}
+
+// use the on-disk index as it was left when the table has one, so mounting does not read the whole table - rebuilt when it is damaged
+void nameidx_open()
+{
+    if (!(fs_get_info().flags & FSFLAG_BTREE)) { nameidx_build(); return; }
+
+    pthread_mutex_lock(&nameidx_write_lock);
+    btree_stop();
+    nameidx_synchronize();
+    bool_t opened = btree_open();
+    if (opened)
+    {
+        nameidx_publish(NULL);
+        dcache_clear();
+    }
+    pthread_mutex_unlock(&nameidx_write_lock);
+    if (!opened) { printf("On-disk name index is damaged, rebuilding\n"); nameidx_build(); }
+}
+
+void nameidx_clear()
+{
+    pthread_mutex_lock(&nameidx_write_lock);
+    btree_stop();
+    nameidx_publish(NULL);
+    dcache_clear();
+    pthread_mutex_unlock(&nameidx_write_lock);
+}
+
+bool_t nameidx_ready() { return __atomic_load_n(&nameidx_current, __ATOMIC_ACQUIRE) != NULL || btree_ready(); }
+
+// copy of tree with entry inserted, the copy is split in two when it overflows - returns the number of nodes
+// nodes on the path are retired, the ones beside it are shared with the original
+uint32_t nameidx_node_insert(nameidx_node_t* node, const nameidx_entry_t* entry, nameidx_node_t** out)
+{
+    nameidx_entry_t entries[NAMEIDX_NODE_MAX + 1];
+    nameidx_node_t* children[NAMEIDX_NODE_MAX + 1];
+    uint32_t        len = strnlen(entry->name, FS_NAME_MAX);
+    uint32_t        count;
+
+    if (node->leaf)
+    {
+        uint32_t pos = nameidx_lower_bound(node, entry->name, len, entry->type);
+        memcpy(entries, node->entries, pos * sizeof(nameidx_entry_t));
+        entries[pos] = *entry;
+        memcpy(entries + pos + 1, node->entries + pos, (node->count - pos) * sizeof(nameidx_entry_t));
+        count = node->count + 1;
+    }
+    else
+    {
+        nameidx_node_t* split[2];
+        uint32_t pos = nameidx_node_child(node, entry->name, len, entry->type);
+        uint32_t n   = nameidx_node_insert(node->children[pos], entry, split);
+        memcpy(entries, node->entries, node->count * sizeof(nameidx_entry_t));
+        memcpy(children, node->children, node->count * sizeof(nameidx_node_t*));
+        memmove(entries + pos + n, entries + pos + 1, (node->count - pos - 1) * sizeof(nameidx_entry_t));
+        memmove(children + pos + n, children + pos + 1, (node->count - pos - 1) * sizeof(nameidx_node_t*));
+        for (uint32_t i = 0; i < n; i++) { children[pos + i] = split[i]; entries[pos + i] = split[i]->entries[0]; }
+        count = node->count + n - 1;
+    }
+
+    nameidx_retire(node);
+    return nameidx_node_emit(node->leaf, entries, children, count, out);
+}
+
+// copy of tree without entry for index, out is NULL when nothing is left - returns FALSE when the entry is not in it
+// names are not unique on a damaged table, so every child whose range holds the name is searched
+bool_t nameidx_node_remove(nameidx_node_t* node, const nameidx_entry_t* entry, nameidx_node_t** out)
+{
+    nameidx_entry_t entries[2 * NAMEIDX_NODE_MAX];
+    nameidx_node_t* children[2 * NAMEIDX_NODE_MAX];
+    uint32_t        len = strnlen(entry->name, FS_NAME_MAX);
+    uint32_t        pos = nameidx_lower_bound(node, entry->name, len, entry->type);
+
+    if (node->leaf)
+    {
+        while (pos < node->count && nameidx_compare(entry->name, entry->type, &node->entries[pos]) == 0 && node->entries[pos].index != entry->index) { pos++; }
+        if (pos >= node->count || nameidx_compare(entry->name, entry->type, &node->entries[pos]) != 0) { return FALSE; }
+        memcpy(entries, node->entries, pos * sizeof(nameidx_entry_t));
+        memcpy(entries + pos, node->entries + pos + 1, (node->count - pos - 1) * sizeof(nameidx_entry_t));
+        nameidx_retire(node);
+        *out = (node->count > 1) ? nameidx_node_create(TRUE, entries, NULL, node->count - 1) : NULL;
+        return TRUE;
+    }
+
+    // the child before the first lowest entry not below the name may hold it as well
+    nameidx_node_t* child = NULL;
+    if (pos > 0) { pos--; }
+    for (; pos < node->count && nameidx_compare(entry->name, entry->type, &node->entries[pos]) >= 0; pos++)
+    {
+        if (nameidx_node_remove(node->children[pos], entry, &child)) { break; }
+    }
+    if (pos >= node->count || nameidx_compare(entry->name, entry->type, &node->entries[pos]) < 0) { return FALSE; }
+
+    // an empty child is dropped, a small one is merged with a neighbour and split again if that overflows
+    uint32_t count = 0;
+    memcpy(entries, node->entries, pos * sizeof(nameidx_entry_t));
+    memcpy(children, node->children, pos * sizeof(nameidx_node_t*));
+    count = pos;
+    uint32_t next = pos + 1;
+    if (child != NULL && child->count < NAMEIDX_NODE_MIN && node->count > 1)
+    {
+        nameidx_entry_t merged[NAMEIDX_NODE_MIN + NAMEIDX_NODE_MAX];
+        nameidx_node_t* merged_children[NAMEIDX_NODE_MIN + NAMEIDX_NODE_MAX];
+        nameidx_node_t* left  = child;
+        nameidx_node_t* right = (pos + 1 < node->count) ? node->children[pos + 1] : NULL;
+        if (right == NULL) { left = node->children[pos - 1]; right = child; count--; }
+        else { next++; }
+
+        memcpy(merged, left->entries, left->count * sizeof(nameidx_entry_t));
+        memcpy(merged + left->count, right->entries, right->count * sizeof(nameidx_entry_t));
+        if (!child->leaf)
+        {
+            memcpy(merged_children, left->children, left->count * sizeof(nameidx_node_t*));
+            memcpy(merged_children + left->count, right->children, right->count * sizeof(nameidx_node_t*));
+        }
+        uint32_t n = nameidx_node_emit(child->leaf, merged, merged_children, left->count + right->count, children + count);
+        for (uint32_t i = 0; i < n; i++) { entries[count + i] = children[count + i]->entries[0]; }
+        count += n;
+
+        // the new child was never published, its neighbour was
+        nameidx_retire((left == child) ? right : left);
+        free(child);
+    }
+    else if (child != NULL)
+    {
+        entries[count]  = child->entries[0];
+        children[count] = child;
+        count++;
+    }
+    memcpy(entries + count, node->entries + next, (node->count - next) * sizeof(nameidx_entry_t));
+    memcpy(children + count, node->children + next, (node->count - next) * sizeof(nameidx_node_t*));
+    count += node->count - next;
+
+    nameidx_retire(node);
+    *out = (count > 0) ? nameidx_node_create(FALSE, entries, children, count) : NULL;
+    return TRUE;
+}
+
+void nameidx_disk_key(btree_entry_t* key, uint32_t index, fs_directory_t entry)
+{
+    memset(key, 0, sizeof(btree_entry_t));
+    strncpy(key->name, entry.name, FS_NAME_MAX - 1);
+    key->parent = entry.parent_index;
+    key->type   = entry.type;
+    key->index  = index;
+}
+
+// take the children of a directory that is gone out of the on-disk index, one at a time as every removal can replace a whole path
+void nameidx_drop_disk(uint32_t dir)
+{
+    btree_cursor_t* cursor = malloc(sizeof(btree_cursor_t));
+    btree_entry_t*  keys   = NULL;
+    uint32_t        count  = 0, max = 0;
+    btree_cursor_seek(cursor, dir);
+    for (const btree_entry_t* key = btree_cursor_next(cursor); key != NULL && key->parent == dir; key = btree_cursor_next(cursor))
+    {
+        if (count == max) { max = (max == 0) ? 16 : max * 2; keys = realloc(keys, max * sizeof(btree_entry_t)); }
+        keys[count++] = *key;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        btree_remove(&keys[i]);
+        nameidx_synchronize();
+        btree_release();
+    }
+    free(keys);
+    free(cursor);
+}
+
+// same as below on the on-disk index, called with the write lock held
+void nameidx_update_disk(uint32_t index, fs_directory_t old, fs_directory_t entry)
+{
+    btree_entry_t key;
+    if (old.type != FSTYPE_NULL) { nameidx_disk_key(&key, index, old); btree_remove(&key); }
+    if (entry.type != FSTYPE_NULL) { nameidx_disk_key(&key, index, entry); btree_insert(&key); }
+    nameidx_synchronize();
+    btree_release();
+
+    // a directory that is no longer one loses its children as its tree in memory does
+    if (old.type == FSTYPE_DIR && entry.type != FSTYPE_DIR) { nameidx_drop_disk(index); }
+    dcache_invalidate(old);
+    dcache_invalidate(entry);
+}
+
+// move entry at index from old to new name, parent and type - a NULL type on either side inserts or removes it
+// changed trees are copied along the path to the entry and published, replaced nodes are freed once no reader can still see them
+void nameidx_update(uint32_t index, fs_directory_t old, fs_directory_t entry)
+{
+    pthread_mutex_lock(&nameidx_write_lock);
+    if (btree_ready()) { nameidx_update_disk(index, old, entry); pthread_mutex_unlock(&nameidx_write_lock); return; }
+    nameidx_table_t* table = nameidx_current;
+    if (table == NULL || index >= table->count) { pthread_mutex_unlock(&nameidx_write_lock); return; }
+
+    if (old.type != FSTYPE_NULL && old.parent_index < table->count && table->roots[old.parent_index] != NULL)
+    {
+        nameidx_entry_t key;
+        memset(&key, 0, sizeof(key));
+        strncpy(key.name, old.name, FS_NAME_MAX - 1);
+        key.type  = old.type;
+        key.index = index;
+
+        // a root left with a single child is replaced by it, an empty tree by an empty leaf
+        nameidx_node_t* root;
+        if (nameidx_node_remove(table->roots[old.parent_index], &key, &root))
+        {
+            while (root != NULL && !root->leaf && root->count == 1)
+            {
+                nameidx_node_t* child = root->children[0];
+                nameidx_retire(root);
+                root = child;
+            }
+            if (root == NULL) { root = nameidx_node_create(TRUE, NULL, NULL, 0); }
+            nameidx_slot_store(table, old.parent_index, root);
+        }
+    }
+
+    if (entry.type != FSTYPE_NULL && entry.parent_index < table->count && table->roots[entry.parent_index] != NULL)
+    {
+        nameidx_entry_t key;
+        memset(&key, 0, sizeof(key));
+        strncpy(key.name, entry.name, FS_NAME_MAX - 1);
+        key.type  = entry.type;
+        key.index = index;
+
+        // a split root gets a new root above its two halves
+        nameidx_node_t* split[2];
+        nameidx_node_t* root;
+        if (nameidx_node_insert(table->roots[entry.parent_index], &key, split) == 2)
+        {
+            nameidx_entry_t keys[2] = { split[0]->entries[0], split[1]->entries[0] };
+            root = nameidx_node_create(FALSE, keys, split, 2);
+        }
+        else { root = split[0]; }
+        nameidx_slot_store(table, entry.parent_index, root);
+    }
+
+    // a directory keeps its own tree across renames and moves
+    if (old.type == FSTYPE_DIR && entry.type != FSTYPE_DIR && table->roots[index] != NULL)
+    {
+        nameidx_retire_tree(table->roots[index]);
+        nameidx_slot_store(table, index, NULL);
+    }
+    if (entry.type == FSTYPE_DIR && table->roots[index] == NULL) { nameidx_slot_store(table, index, nameidx_node_create(TRUE, NULL, NULL, 0)); }
+
+    // cached results under both names are dropped once the new trees are visible
+    dcache_invalidate(old);
+    dcache_invalidate(entry);
+
+    if (nameidx_retired_count > 0) { nameidx_synchronize(); }
+    for (uint32_t i = 0; i < nameidx_retired_count; i++) { free(nameidx_retired[i]); }
+    nameidx_retired_count = 0;
+    pthread_mutex_unlock(&nameidx_write_lock);
+}
+
+nameidx_node_t* nameidx_root(uint32_t dir)
+{
+    nameidx_table_t* table = __atomic_load_n(&nameidx_current, __ATOMIC_ACQUIRE);
+    if (table == NULL || dir >= table->count) { return NULL; }
+    return nameidx_slot_load(table, dir);
+}
+
+// start sorted walk over children of directory, only valid between nameidx_read_begin and nameidx_read_end
+// on disk the children are one run of the global tree, read leaf by leaf from the first one
+void nameidx_cursor_begin(nameidx_cursor_t* cursor, uint32_t dir)
+{
+    cursor->depth = 0;
+    cursor->dir   = dir;
+    cursor->disk  = btree_ready();
+    if (cursor->disk) { btree_cursor_seek(&cursor->btree, dir); return; }
+
+    nameidx_node_t* root = nameidx_root(dir);
+    if (root == NULL) { return; }
+    cursor->nodes[0] = root;
+    cursor->pos[0]   = 0;
+    cursor->depth    = 1;
+}
+
+// next child in name and type order - returns NULL after the last one
+const nameidx_entry_t* nameidx_cursor_next(nameidx_cursor_t* cursor)
+{
+    if (cursor->disk)
+    {
+        const btree_entry_t* entry = btree_cursor_next(&cursor->btree);
+        if (entry == NULL || entry->parent != cursor->dir) { cursor->disk = FALSE; return NULL; }
+        memcpy(cursor->entry.name, entry->name, FS_NAME_MAX);
+        cursor->entry.type  = entry->type;
+        cursor->entry.index = entry->index;
+        return &cursor->entry;
+    }
+
+    while (cursor->depth > 0)
+    {
+        uint32_t top = cursor->depth - 1;
+        const nameidx_node_t* node = cursor->nodes[top];
+        if (cursor->pos[top] >= node->count) { cursor->depth--; continue; }
+        uint32_t pos = cursor->pos[top]++;
+        if (node->leaf) { return &node->entries[pos]; }
+        cursor->nodes[cursor->depth] = node->children[pos];
+        cursor->pos[cursor->depth++] = 0;
+    }
+    return NULL;
+}
+
+int nameidx_find_locked(uint32_t parent, const char* name, uint32_t len, uint8_t type)
+{
+    if (btree_ready()) { return btree_find(parent, name, len, type); }
+    const nameidx_node_t* root = nameidx_root(parent);
+    if (root == NULL) { return -1; }
+    const nameidx_node_t* leaf = nameidx_node_leaf(root, name, len, type);
+    uint32_t pos = nameidx_lower_bound(leaf, name, len, type);
+    if (pos >= leaf->count || nameidx_compare_span(name, len, type, &leaf->entries[pos]) != 0) { return -1; }
+    return leaf->entries[pos].index;
+}
+
+// get table index of named child - returns -1 if it does not exist
+int nameidx_find(uint32_t parent, const char* name, uint8_t type)
+{
+    uint32_t epoch = nameidx_read_begin();
+    int index = nameidx_find_locked(parent, name, strnlen(name, FS_NAME_MAX), type);
+    nameidx_read_end(epoch);
+    return index;
+}
+
+// walk first depth components, the last one is looked up as type
+int nameidx_walk(const fs_path_t* path, uint32_t depth, uint8_t type)
+{
+    int dir = 0;
+    for (uint32_t i = 0; i < depth && dir >= 0; i++) { dir = nameidx_find_locked(dir, path->parts[i].str, path->parts[i].len, (i == depth - 1) ? type : FSTYPE_DIR); }
+    return dir;
+}
+
+// resolve first depth components through the path cache, walking the index on a miss
+int nameidx_lookup(const fs_path_t* path, uint32_t depth, uint8_t type)
+{
+    // root, which is only a directory
+    if (depth == 0) { return (type == FSTYPE_DIR) ? 0 : -1; }
+
+    int index;
+    if (!dcache_lookup(path, depth, type, &index))
+    {
+        uint32_t generation = dcache_generation();
+        uint32_t epoch = nameidx_read_begin();
+        index = nameidx_walk(path, depth, type);
+        nameidx_read_end(epoch);
+        dcache_insert(path, depth, type, index, generation);
+    }
+    STAT_ADD(index >= 0 ? STAT_INDEX_HITS : STAT_INDEX_MISSES, 1);
+    return index;
+}
+
+// get table index of parsed path without taking any lock
+int nameidx_resolve_path(const fs_path_t* path, uint8_t type) { return nameidx_lookup(path, path->count, type); }
+
+// get table index of directory containing entry at parsed path, the parent of root is taken to be root itself
+int nameidx_resolve_path_parent(const fs_path_t* path) { return nameidx_lookup(path, path->count > 0 ? path->count - 1 : 0, FSTYPE_DIR); }
+
+int nameidx_resolve(const char* path, uint8_t type)
+{
+    fs_path_t parsed;
+    if (!fs_path_parse(path, &parsed)) { STAT_ADD(STAT_INDEX_MISSES, 1); return -1; }
+    return nameidx_resolve_path(&parsed, type);
+}
+
+int nameidx_resolve_parent(const char* path)
+{
+    fs_path_t parsed;
+    if (!fs_path_parse(path, &parsed)) { STAT_ADD(STAT_INDEX_MISSES, 1); return -1; }
+    return nameidx_resolve_path_parent(&parsed);
+}
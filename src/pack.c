@@ -0,0 +1,221 @@
+#include "pack.h"
+#include "fs.h"
+#include "ata.h"
+#include "fslock.h"
+
+#define PACK_UNITS ((PACK_SECTORS * ATA_SECTOR_SIZE) / PACK_UNIT)
+
+// used units of each pack extent by block index, NULL for blocks that are not pack extents
+uint8_t** pack_maps   = NULL;
+uint16_t* pack_used   = NULL;
+uint32_t* pack_blocks = NULL;
+uint32_t  pack_count  = 0;
+uint32_t  pack_max    = 0;
+
+uint32_t pack_units(uint32_t len) { return (len + PACK_UNIT - 1) / PACK_UNIT; }
+
+bool_t pack_bit(uint8_t* map, uint32_t unit) { return (map[unit / 8] >> (unit % 8)) & 1; }
+
+void pack_mark(uint32_t index, uint32_t unit, uint32_t units, bool_t used)
+{
+    uint8_t* map = pack_maps[index];
+    for (uint32_t u = unit; u < unit + units && u < PACK_UNITS; u++)
+    {
+        if (used) { map[u / 8] |= (uint8_t)(1 << (u % 8)); }
+        else { map[u / 8] &= (uint8_t)~(1 << (u % 8)); }
+    }
+    if (used) { pack_used[index] += units; }
+    else { pack_used[index] -= units; }
+}
+
+void pack_add(uint32_t index)
+{
+    pack_maps[index] = calloc(PACK_UNITS / 8, 1);
+    pack_used[index] = 0;
+    pack_blocks[pack_count++] = index;
+}
+
+void pack_remove(uint32_t index)
+{
+    free(pack_maps[index]);
+    pack_maps[index] = NULL;
+    for (uint32_t i = 0; i < pack_count; i++) { if (pack_blocks[i] == index) { pack_blocks[i] = pack_blocks[--pack_count]; break; } }
+}
+
+void pack_clear()
+{
+    fslock_alloc();
+    for (uint32_t i = 0; i < pack_max && pack_maps != NULL; i++) { if (pack_maps[i] != NULL) { free(pack_maps[i]); } }
+    if (pack_maps != NULL) { free(pack_maps); pack_maps = NULL; }
+    if (pack_used != NULL) { free(pack_used); pack_used = NULL; }
+    if (pack_blocks != NULL) { free(pack_blocks); pack_blocks = NULL; }
+    pack_count = 0;
+    pack_max   = 0;
+    fslock_alloc_unlock();
+}
+
+// find pack extents in the block table and mark the tails of every packed file
+void pack_build()
+{
+    fslock_alloc();
+    pack_clear();
+    fs_info_t info = fs_get_info();
+    pack_max    = info.blk_table_count_max;
+    pack_maps   = calloc(pack_max, sizeof(uint8_t*));
+    pack_used   = calloc(pack_max, sizeof(uint16_t));
+    pack_blocks = malloc(pack_max * sizeof(uint32_t));
+
+    fs_blkentry_t* table = fs_blktable_load();
+    for (uint32_t i = 2; i < pack_max; i++) { if (table[i].start != 0 && table[i].state == FSSTATE_PACK) { pack_add(i); } }
+    free(table);
+
+    uint8_t* data = malloc(ATA_SECTOR_SIZE);
+    for (uint32_t sec = 0; sec < info.file_table_sector_count; sec++)
+    {
+        fs_table_read(info.file_table_start + sec, 1, data);
+        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
+        {
+            fs_file_t* entry = (fs_file_t*)(data + i);
+            if (entry->type != FSTYPE_FILE || !(entry->status & FSSTATUS_PACKED)) { continue; }
+            uint32_t index = PACK_INDEX(entry->blk_index);
+            if (index >= pack_max || pack_maps[index] == NULL) { continue; }
+            pack_mark(index, PACK_OFFSET(entry->blk_index) / PACK_UNIT, pack_units(entry->size), TRUE);
+        }
+    }
+    free(data);
+    fslock_alloc_unlock();
+}
+
+// first run of free units in any pack extent - returns FALSE when none is long enough
+bool_t pack_find(uint32_t units, uint32_t* index, uint32_t* unit)
+{
+    for (uint32_t i = 0; i < pack_count; i++)
+    {
+        uint32_t blk = pack_blocks[i];
+        if (PACK_UNITS - pack_used[blk] < units) { continue; }
+        uint32_t run = 0;
+        for (uint32_t u = 0; u < PACK_UNITS; u++)
+        {
+            run = pack_bit(pack_maps[blk], u) ? 0 : run + 1;
+            if (run == units) { *index = blk; *unit = u + 1 - units; return TRUE; }
+        }
+    }
+    return FALSE;
+}
+
+// copy bytes into sectors of pack extent, sectors shared with other tails are read back first
+void pack_write(fs_blkentry_t blk, uint32_t offset, const uint8_t* data, uint32_t len)
+{
+    uint8_t secdata[ATA_SECTOR_SIZE];
+    uint32_t done = 0;
+    while (done < len)
+    {
+        uint32_t sector = blk.start + (offset + done) / ATA_SECTOR_SIZE;
+        uint32_t pos    = (offset + done) % ATA_SECTOR_SIZE;
+        uint32_t n      = ATA_SECTOR_SIZE - pos;
+        if (n > len - done) { n = len - done; }
+        fslock_sector_write(sector);
+        if (n < ATA_SECTOR_SIZE) { ata_read(sector, 1, secdata); }
+        memcpy(secdata + pos, data + done, n);
+        ata_write(sector, 1, secdata);
+        fslock_sector_unlock(sector);
+        done += n;
+    }
+}
+
+// store tail in a pack extent with room for it, starting a new one when none has - returns reference or -1 when the disk is full
+// the extent checksum covers the whole extent and is updated with every tail
+int pack_store(const uint8_t* data, uint32_t len)
+{
+    if (len == 0 || len > FS_PACK_MAX) { return -1; }
+    fslock_alloc();
+    if (pack_maps == NULL) { fslock_alloc_unlock(); return -1; }
+
+    uint32_t index, unit;
+    uint32_t units = pack_units(len);
+    if (!pack_find(units, &index, &unit))
+    {
+        fs_blkentry_t blk = fs_blktable_allocate(PACK_SECTORS);
+        if (blk.count == 0) { fslock_alloc_unlock(); return -1; }
+        index = fs_blktable_get_index(blk);
+        fs_blktable_fill(blk, 0x00);
+        blk.state = FSSTATE_PACK;
+        blk.refs  = 0;
+        blk.crc   = 0;
+        fs_blktable_write(index, blk);
+        pack_add(index);
+        unit = 0;
+    }
+
+    fs_blkentry_t blk = fs_blktable_read(index);
+    pack_mark(index, unit, units, TRUE);
+    pack_write(blk, unit * PACK_UNIT, data, len);
+    blk.refs++;
+    if (fs_get_info().flags & FSFLAG_CHECKSUMS) { blk.crc = fs_crc_blk(blk); }
+    fs_blktable_write(index, blk);
+    fslock_alloc_unlock();
+    return PACK_REF(index, unit * PACK_UNIT);
+}
+
+// read tail of len bytes, sectors are read under their locks as other tails in them may be written meanwhile
+bool_t pack_load(uint32_t ref, uint32_t len, uint8_t* data)
+{
+    fs_blkentry_t blk = fs_blktable_read(PACK_INDEX(ref));
+    uint32_t offset = PACK_OFFSET(ref);
+    if (blk.state != FSSTATE_PACK || offset + len > blk.count * ATA_SECTOR_SIZE) { return FALSE; }
+
+    uint8_t secdata[ATA_SECTOR_SIZE];
+    uint32_t done = 0;
+    while (done < len)
+    {
+        uint32_t sector = blk.start + (offset + done) / ATA_SECTOR_SIZE;
+        uint32_t pos    = (offset + done) % ATA_SECTOR_SIZE;
+        uint32_t n      = ATA_SECTOR_SIZE - pos;
+        if (n > len - done) { n = len - done; }
+        fslock_sector_read(sector);
+        ata_read(sector, 1, secdata);
+        fslock_sector_unlock(sector);
+        memcpy(data + done, secdata + pos, n);
+        done += n;
+    }
+    return TRUE;
+}
+
+// give up tail, the extent is freed with its last tail - the bytes stay until reused so the checksum holds
+bool_t pack_release(uint32_t ref, uint32_t len)
+{
+    uint32_t index = PACK_INDEX(ref);
+    fslock_alloc();
+    fs_blkentry_t blk = fs_blktable_read(index);
+    if (pack_maps == NULL || index >= pack_max || pack_maps[index] == NULL || blk.state != FSSTATE_PACK) { printf("Unable to release packed tail 0x%08x\n", ref); fslock_alloc_unlock(); return FALSE; }
+
+    pack_mark(index, PACK_OFFSET(ref) / PACK_UNIT, pack_units(len), FALSE);
+    bool_t result = TRUE;
+    if (blk.refs > 1)
+    {
+        blk.refs--;
+        fs_blktable_write(index, blk);
+    }
+    else
+    {
+        pack_remove(index);
+        result = fs_blktable_free(blk);
+    }
+    fslock_alloc_unlock();
+    return result;
+}
+
+void pack_print()
+{
+    fslock_alloc();
+    uint32_t tails = 0, used = 0;
+    for (uint32_t i = 0; i < pack_count; i++)
+    {
+        tails += fs_blktable_read(pack_blocks[i]).refs;
+        used  += pack_used[pack_blocks[i]];
+    }
+    printf("PACK EXTENTS: %d (%d sectors each)\n", pack_count, PACK_SECTORS);
+    printf("TAILS:        %d\n", tails);
+    printf("USED:         %d of %d bytes\n", used * PACK_UNIT, pack_count * PACK_UNITS * PACK_UNIT);
+    fslock_alloc_unlock();
+}
@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <time.h>
+#include "stats.h"
+
+// counters of one thread, only written by that thread
+typedef struct stats_thread
+{
+    uint64_t             counters[STAT_COUNT];
+    uint64_t             calls[STATS_OP_COUNT];
+    uint64_t             total_ns[STATS_OP_COUNT];
+    uint64_t             buckets[STATS_OP_COUNT][STATS_BUCKETS];
+    struct stats_thread* next;
+} stats_thread_t;
+
+__thread stats_thread_t* stats_local = NULL;
+
+stats_thread_t* stats_threads = NULL;
+stats_thread_t  stats_base;
+char*           stats_exit_path = NULL;
+pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+const char* STAT_NAMES[STAT_COUNT] =
+{
+    "bytes_read", "bytes_written", "sectors_read", "sectors_written", "table_sectors_scanned",
+    "index_hits", "index_misses", "allocs", "alloc_sectors", "frees", "dcache_hits", "dcache_misses",
+};
+
+const char* STATS_OP_NAMES[STATS_OP_COUNT] =
+{
+    "dir_exists", "file_exists", "dir_info", "file_info", "count_dirs", "count_files", "get_dirs", "get_files",
+    "read", "write", "create_dir", "rename_dir", "rename_file", "delete_dir", "delete_file", "copy_dir", "copy_file",
+    "fs_read", "fs_write", "fs_alloc", "fs_free", "ata_read", "ata_write",
+};
+
+uint64_t stats_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+const char* stats_name(uint8_t stat) { return stat < STAT_COUNT ? STAT_NAMES[stat] : "unknown"; }
+
+const char* stats_op_name(uint8_t op) { return op < STATS_OP_COUNT ? STATS_OP_NAMES[op] : "unknown"; }
+
+// counters of calling thread, registered on first use and kept after the thread exits
+stats_thread_t* stats_thread()
+{
+    if (stats_local != NULL) { return stats_local; }
+    stats_local = calloc(1, sizeof(stats_thread_t));
+    pthread_mutex_lock(&stats_mutex);
+    stats_local->next = stats_threads;
+    stats_threads = stats_local;
+    pthread_mutex_unlock(&stats_mutex);
+    return stats_local;
+}
+
+// single writer per counter, relaxed accesses keep totals readable from other threads without locked instructions
+void stats_bump(uint64_t* value, uint64_t n)
+{
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void stats_add(uint8_t stat, uint64_t n)
+{
+    stats_bump(&stats_thread()->counters[stat], n);
+}
+
+stats_scope_t stats_scope_begin(uint8_t op)
+{
+    stats_scope_t scope = { op, stats_now() };
+    return scope;
+}
+
+void stats_scope_end(stats_scope_t* scope)
+{
+    uint64_t elapsed = stats_now() - scope->started;
+    int bucket = (elapsed == 0) ? 0 : 64 - __builtin_clzll(elapsed);
+    if (bucket >= STATS_BUCKETS) { bucket = STATS_BUCKETS - 1; }
+
+    stats_thread_t* local = stats_thread();
+    stats_bump(&local->calls[scope->op], 1);
+    stats_bump(&local->total_ns[scope->op], elapsed);
+    stats_bump(&local->buckets[scope->op][bucket], 1);
+}
+
+// sum counters of all threads since last reset
+void stats_collect(stats_thread_t* out)
+{
+    memset(out, 0, sizeof(stats_thread_t));
+    pthread_mutex_lock(&stats_mutex);
+    for (stats_thread_t* t = stats_threads; t != NULL; t = t->next)
+    {
+        for (int i = 0; i < STAT_COUNT; i++) { out->counters[i] += __atomic_load_n(&t->counters[i], __ATOMIC_RELAXED); }
+        for (int op = 0; op < STATS_OP_COUNT; op++)
+        {
+            out->calls[op]    += __atomic_load_n(&t->calls[op], __ATOMIC_RELAXED);
+            out->total_ns[op] += __atomic_load_n(&t->total_ns[op], __ATOMIC_RELAXED);
+            for (int b = 0; b < STATS_BUCKETS; b++) { out->buckets[op][b] += __atomic_load_n(&t->buckets[op][b], __ATOMIC_RELAXED); }
+        }
+    }
+
+    for (int i = 0; i < STAT_COUNT; i++) { out->counters[i] -= stats_base.counters[i]; }
+    for (int op = 0; op < STATS_OP_COUNT; op++)
+    {
+        out->calls[op]    -= stats_base.calls[op];
+        out->total_ns[op] -= stats_base.total_ns[op];
+        for (int b = 0; b < STATS_BUCKETS; b++) { out->buckets[op][b] -= stats_base.buckets[op][b]; }
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+// counters of other threads are not cleared, the current totals become the new baseline
+void stats_reset()
+{
+    stats_thread_t totals;
+    stats_collect(&totals);
+    pthread_mutex_lock(&stats_mutex);
+    for (int i = 0; i < STAT_COUNT; i++) { stats_base.counters[i] += totals.counters[i]; }
+    for (int op = 0; op < STATS_OP_COUNT; op++)
+    {
+        stats_base.calls[op]    += totals.calls[op];
+        stats_base.total_ns[op] += totals.total_ns[op];
+        for (int b = 0; b < STATS_BUCKETS; b++) { stats_base.buckets[op][b] += totals.buckets[op][b]; }
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+// upper bound in nanoseconds of bucket holding given fraction of calls
+uint64_t stats_percentile(stats_thread_t* totals, int op, uint32_t percent)
+{
+    uint64_t target = (totals->calls[op] * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++)
+    {
+        seen += totals->buckets[op][b];
+        if (seen >= target) { return 1ull << b; }
+    }
+    return 1ull << (STATS_BUCKETS - 1);
+}
+
+void stats_print()
+{
+    stats_thread_t totals;
+    stats_collect(&totals);
+
+    printf("Counters:\n");
+    for (int i = 0; i < STAT_COUNT; i++) { printf("  %-22s %llu\n", STAT_NAMES[i], (unsigned long long)totals.counters[i]); }
+
+    printf("%-12s %10s %12s %10s %10s %10s\n", "operation", "calls", "total ms", "mean us", "p50 us <=", "p99 us <=");
+    for (int op = 0; op < STATS_OP_COUNT; op++)
+    {
+        if (totals.calls[op] == 0) { continue; }
+        printf("%-12s %10llu %12.3f %10.2f %10.2f %10.2f\n", STATS_OP_NAMES[op], (unsigned long long)totals.calls[op], totals.total_ns[op] / 1e6,
+               (totals.total_ns[op] / (double)totals.calls[op]) / 1000.0, stats_percentile(&totals, op, 50) / 1000.0, stats_percentile(&totals, op, 99) / 1000.0);
+    }
+}
+
+bool_t stats_write_json(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) { printf("Unable to create stats file '%s'\n", path); return FALSE; }
+
+    stats_thread_t totals;
+    stats_collect(&totals);
+    fprintf(file, "{\n  \"counters\": {");
+    for (int i = 0; i < STAT_COUNT; i++) { fprintf(file, "%s\n    \"%s\": %llu", i ? "," : "", STAT_NAMES[i], (unsigned long long)totals.counters[i]); }
+    fprintf(file, "\n  },\n  \"bucket_bounds_ns\": \"bucket b holds latencies below 2^b ns\",\n  \"operations\": {");
+    bool_t first = TRUE;
+    for (int op = 0; op < STATS_OP_COUNT; op++)
+    {
+        if (totals.calls[op] == 0) { continue; }
+        fprintf(file, "%s\n    \"%s\": { \"calls\": %llu, \"total_ns\": %llu, \"buckets\": [", first ? "" : ",", STATS_OP_NAMES[op],
+                (unsigned long long)totals.calls[op], (unsigned long long)totals.total_ns[op]);
+        for (int b = 0; b < STATS_BUCKETS; b++) { fprintf(file, "%s%llu", b ? ", " : "", (unsigned long long)totals.buckets[op][b]); }
+        fprintf(file, "] }");
+        first = FALSE;
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+    return TRUE;
+}
+
+void stats_exit_handler()
+{
+    if (stats_exit_path != NULL) { stats_write_json(stats_exit_path); }
+}
+
+// write json dump when the program exits, later calls replace the path
+void stats_write_on_exit(const char* path)
+{
+    if (stats_exit_path == NULL) { atexit(stats_exit_handler); }
+    else { free(stats_exit_path); }
+    stats_exit_path = malloc(strlen(path) + 1);
+    strcpy(stats_exit_path, path);
+}
@@ -1,6 +1,11 @@
+#include <unistd.h>
 #include "tests.h"
+#include "ata.h"
 #include "fs.h"
 #include "vfs.h"
+#include "fsck.h"
+#include "dedup.h"
+#include "btree.h"
 
 #define FSTEST_DIRS_COUNT 9
 const char* fstest_dirs[] = { "/sys/", "/sys/resources/", "/sys/resources/fonts/", "/sys/bin/", "/sys/lib/", 
@@ -39,12 +44,41 @@ void fstest_done(const char* msg, ...)
     va_end(args);
 }
 
+// fill buffer with pattern unique to seed, so contents moved to the wrong place do not read back as the right file
+void fstest_fill(uint8_t* data, uint32_t size, uint32_t seed)
+{
+    for (uint32_t i = 0; i < size; i++) { data[i] = (uint8_t)((i * 7) + seed); }
+}
+
+// check size and contents of file written with fstest_fill
+bool_t fstest_matches(const char* path, uint32_t size, uint32_t seed)
+{
+    if (fs_get_file_byname(path).size != size) { return FALSE; }
+    uint8_t* data = vfs_read_bytes(path);
+    if (data == NULL) { return FALSE; }
+
+    bool_t result = TRUE;
+    for (uint32_t i = 0; i < size && result; i++) { result = data[i] == (uint8_t)((i * 7) + seed); }
+    free(data);
+    return result;
+}
+
 void fstest_run_all()
 {
     fstest_dirs_create();
     fstest_files_create();
 
     fstest_files_rename();
+    fstest_files_compress();
+    fstest_files_inline();
+    fstest_files_pack();
+    fstest_resize();
+    fstest_defrag();
+    fstest_dedup();
+    fstest_checksums();
+    fstest_snapshot();
+    fstest_overlay();
+    fstest_index();
 
     fstest_files_delete();
     fstest_dirs_delete();
@@ -135,4 +169,335 @@ void fstest_files_rename()
     }
 
     fstest_done("RENAMED FILES");
-}
\ No newline at end of file
+}
+
+void fstest_files_compress()
+{
+    const char* path = "/compressed.txt";
+    uint32_t size = 8192;
+    char* text = malloc(size + 1);
+    for (uint32_t i = 0; i < size; i++) { text[i] = "voyageur "[i % 9]; }
+    text[size] = 0;
+
+    bool_t was_enabled = fs_get_compression();
+    fs_set_compression(TRUE);
+    bool_t written = vfs_write_text(path, text);
+    fs_set_compression(was_enabled);
+    if (!written) { fstest_fail("Unable to write compressed file '%s'", path); free(text); return; }
+
+    fs_file_t file = fs_get_file_byname(path);
+    if (!(file.status & FSSTATUS_COMPRESSED)) { fstest_fail("File '%s' was not stored compressed", path); free(text); return; }
+
+    char* data = vfs_read_text(path);
+    if (data == NULL || memcmp(data, text, size)) { fstest_fail("Contents of compressed file '%s' do not match", path); free(text); return; }
+    else { fstest_ok("Read back compressed file '%s'", path); }
+    free(data);
+
+    vfs_delete_file(path);
+    free(text);
+    fstest_done("COMPRESSED FILES");
+}
+
+void fstest_files_inline()
+{
+    const char* path = "/test.theme";
+    const char* text = "dark=true";
+
+    uint32_t blks = fs_get_info().blk_table_count;
+    if (!vfs_write_text(path, (char*)text)) { fstest_fail("Unable to write inline file '%s'", path); return; }
+
+    fs_file_t file = fs_get_file_byname(path);
+    if (!(file.status & FSSTATUS_INLINE)) { fstest_fail("File '%s' was not stored inline", path); return; }
+    if (fs_get_info().blk_table_count != blks) { fstest_fail("Inline file '%s' used a block entry", path); return; }
+
+    char* data = vfs_read_text(path);
+    if (data == NULL || strcmp(data, text)) { fstest_fail("Contents of inline file '%s' do not match", path); free(data); return; }
+    else { fstest_ok("Read back inline file '%s'", path); }
+    free(data);
+
+    vfs_delete_file(path);
+    fstest_done("INLINE FILES");
+}
+
+void fstest_files_pack()
+{
+    const char* paths[3] = { "/pack0.ini", "/pack1.ini", "/pack2.ini" };
+    char text[301];
+    memset(text, 'v', 300);
+    text[300] = 0;
+
+    uint32_t blks = fs_get_info().blk_table_count;
+    for (int i = 0; i < 3; i++)
+    {
+        text[0] = '0' + i;
+        if (!vfs_write_text(paths[i], text)) { fstest_fail("Unable to write packed file '%s'", paths[i]); return; }
+        if (!(fs_get_file_byname(paths[i]).status & FSSTATUS_PACKED)) { fstest_fail("File '%s' was not stored packed", paths[i]); return; }
+    }
+    if (fs_get_info().blk_table_count > blks + 1) { fstest_fail("Packed files did not share one block entry"); return; }
+
+    for (int i = 0; i < 3; i++)
+    {
+        text[0] = '0' + i;
+        char* data = vfs_read_text(paths[i]);
+        if (data == NULL || strcmp(data, text)) { fstest_fail("Contents of packed file '%s' do not match", paths[i]); free(data); return; }
+        else { fstest_ok("Read back packed file '%s'", paths[i]); }
+        free(data);
+        vfs_delete_file(paths[i]);
+    }
+    fstest_done("PACKED FILES");
+}
+
+void fstest_resize()
+{
+    const char* paths[6] = { "/resize0.bin", "/resize1.bin", "/resize2.bin", "/resize3.bin", "/resize4.bin", "/resize5.bin" };
+    uint32_t size  = fs_get_info().sector_count * ATA_SECTOR_SIZE;
+    uint32_t chunk = size / 8;
+    uint8_t* data  = malloc(chunk + (6 * 4096));
+
+    if (!fs_resize(size + chunk)) { fstest_fail("Unable to grow disk to %d bytes", size + chunk); free(data); return; }
+    for (int i = 0; i < 6; i++)
+    {
+        fstest_fill(data, chunk + (i * 4096), i);
+        if (!vfs_write_bytes(paths[i], data, chunk + (i * 4096))) { fstest_fail("Unable to write file '%s'", paths[i]); free(data); return; }
+    }
+    free(data);
+
+    // holes left behind are each smaller than the files past the new end, so shrinking has to compact
+    vfs_delete_file(paths[0]);
+    vfs_delete_file(paths[2]);
+    if (!fs_resize(chunk * 5)) { fstest_fail("Unable to shrink disk to %d bytes", chunk * 5); return; }
+    for (int i = 1; i < 6; i++)
+    {
+        if (i == 2) { continue; }
+        if (!fstest_matches(paths[i], chunk + (i * 4096), i)) { fstest_fail("Contents of file '%s' do not match after shrinking", paths[i]); return; }
+        else { fstest_ok("Read back file '%s' after shrinking", paths[i]); }
+    }
+    if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems after shrinking"); return; }
+
+    for (int i = 1; i < 6; i++) { if (i != 2) { vfs_delete_file(paths[i]); } }
+    if (!fs_resize(size)) { fstest_fail("Unable to restore disk to %d bytes", size); return; }
+    fstest_done("RESIZED DISK");
+}
+
+void fstest_defrag()
+{
+    const char* paths[4] = { "/defrag0.bin", "/defrag1.bin", "/defrag2.bin", "/defrag3.bin" };
+    const char* packed   = "/defrag.ini";
+    const char* small    = "/defrag.theme";
+    char text[301];
+    memset(text, 'd', 300);
+    text[300] = 0;
+
+    // small files are written between the blocks so the pack block ends up in the middle of the data region
+    uint8_t* data = malloc(65536 + (4 * ATA_SECTOR_SIZE));
+    for (int i = 0; i < 4; i++)
+    {
+        fstest_fill(data, 65536 + (i * ATA_SECTOR_SIZE), 10 + i);
+        if (!vfs_write_bytes(paths[i], data, 65536 + (i * ATA_SECTOR_SIZE))) { fstest_fail("Unable to write file '%s'", paths[i]); free(data); return; }
+        if (i == 0 && !vfs_write_text(packed, text)) { fstest_fail("Unable to write packed file '%s'", packed); free(data); return; }
+        if (i == 1 && !vfs_write_text(small, "dark=false")) { fstest_fail("Unable to write inline file '%s'", small); free(data); return; }
+    }
+    free(data);
+    vfs_delete_file(paths[0]);
+    vfs_delete_file(paths[2]);
+
+    if (!fs_defrag(FALSE)) { fstest_fail("Unable to defragment disk"); return; }
+    for (int i = 1; i < 4; i += 2)
+    {
+        if (!fstest_matches(paths[i], 65536 + (i * ATA_SECTOR_SIZE), 10 + i)) { fstest_fail("Contents of file '%s' do not match after defragmenting", paths[i]); return; }
+        else { fstest_ok("Read back file '%s' after defragmenting", paths[i]); }
+    }
+
+    char* read = vfs_read_text(packed);
+    if (read == NULL || strcmp(read, text)) { fstest_fail("Contents of packed file '%s' do not match after defragmenting", packed); free(read); return; }
+    free(read);
+    read = vfs_read_text(small);
+    if (read == NULL || strcmp(read, "dark=false")) { fstest_fail("Contents of inline file '%s' do not match after defragmenting", small); free(read); return; }
+    free(read);
+    fstest_ok("Read back small files after defragmenting");
+    if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems after defragmenting"); return; }
+
+    vfs_delete_file(paths[1]);
+    vfs_delete_file(paths[3]);
+    vfs_delete_file(packed);
+    vfs_delete_file(small);
+    fstest_done("DEFRAGMENTED DISK");
+}
+
+void fstest_dedup()
+{
+    const char* paths[3] = { "/dedup0.bin", "/dedup1.bin", "/dedup2.bin" };
+    uint8_t* data = malloc(16384);
+    fstest_fill(data, 16384, 20);
+
+    bool_t was_enabled = dedup_get_enabled();
+    dedup_set_enabled(TRUE);
+    bool_t written = vfs_write_bytes(paths[0], data, 16384) && vfs_write_bytes(paths[1], data, 16384) && vfs_copy_file(paths[2], paths[0]);
+    dedup_set_enabled(was_enabled);
+    free(data);
+    if (!written) { fstest_fail("Unable to write deduplicated files"); return; }
+
+    uint32_t blk_index = fs_get_file_byname(paths[0]).blk_index;
+    for (int i = 1; i < 3; i++)
+    {
+        if (fs_get_file_byname(paths[i]).blk_index != blk_index) { fstest_fail("File '%s' does not share its block with '%s'", paths[i], paths[0]); return; }
+    }
+
+    // the shared block stays until the last file referencing it is deleted
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = i; j < 3; j++)
+        {
+            if (!fstest_matches(paths[j], 16384, 20)) { fstest_fail("Contents of deduplicated file '%s' do not match", paths[j]); return; }
+        }
+        fstest_ok("Read back deduplicated files from '%s'", paths[i]);
+        if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems with shared block"); return; }
+        vfs_delete_file(paths[i]);
+    }
+    fstest_done("DEDUPLICATED FILES");
+}
+
+void fstest_checksums()
+{
+    const char* path = "/checksum.bin";
+    if (!(fs_get_info().flags & FSFLAG_CHECKSUMS)) { fstest_done("CHECKSUMS NOT ENABLED"); return; }
+
+    uint8_t* data = malloc(8192);
+    fstest_fill(data, 8192, 30);
+    bool_t written = vfs_write_bytes(path, data, 8192);
+    free(data);
+    if (!written) { fstest_fail("Unable to write file '%s'", path); return; }
+    if (!fstest_matches(path, 8192, 30)) { fstest_fail("Contents of file '%s' do not match", path); return; }
+    if (!fs_verify()) { fstest_fail("Table checksums do not match"); return; }
+
+    // damage one byte behind the back of the file system, reads and fsck must both notice
+    fs_blkentry_t blk = fs_blktable_read(fs_get_file_byname(path).blk_index);
+    uint8_t sector[ATA_SECTOR_SIZE];
+    ata_read(blk.start, 1, sector);
+    sector[0] ^= 0xFF;
+    ata_write(blk.start, 1, sector);
+    uint8_t* damaged = vfs_read_bytes(path);
+    if (damaged != NULL) { fstest_fail("Damaged file '%s' was read without checksum mismatch", path); free(damaged); return; }
+    if (fsck_run(FALSE, 1).bad_data_crc != 1) { fstest_fail("Damaged file '%s' was not found by fsck", path); return; }
+    fstest_ok("Found checksum mismatch in damaged file '%s'", path);
+
+    sector[0] ^= 0xFF;
+    ata_write(blk.start, 1, sector);
+    if (!fstest_matches(path, 8192, 30)) { fstest_fail("Contents of restored file '%s' do not match", path); return; }
+    if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems after restoring '%s'", path); return; }
+    fstest_ok("Read back restored file '%s'", path);
+
+    vfs_delete_file(path);
+    fstest_done("CHECKSUMS");
+}
+
+void fstest_snapshot()
+{
+    const char* path  = "/snapshot.bin";
+    const char* added = "/snapshot.txt";
+    uint8_t* data = malloc(16384);
+    fstest_fill(data, 16384, 40);
+    if (!vfs_write_bytes(path, data, 16384)) { fstest_fail("Unable to write file '%s'", path); free(data); return; }
+
+    if (!ata_snapshot_take()) { fstest_fail("Unable to take snapshot"); free(data); return; }
+    fstest_fill(data, 16384, 41);
+    bool_t written = vfs_write_bytes(path, data, 16384) && vfs_write_text(added, "snapshot");
+    free(data);
+    if (!written) { fstest_fail("Unable to write files after snapshot"); ata_snapshot_drop(); return; }
+    if (!fstest_matches(path, 16384, 41)) { fstest_fail("Contents of file '%s' do not match after snapshot", path); ata_snapshot_drop(); return; }
+
+    // cached tables describe the discarded changes, mount again like the rollback command
+    if (!ata_snapshot_rollback()) { fstest_fail("Unable to roll back snapshot"); return; }
+    fs_mount();
+    if (!fstest_matches(path, 16384, 40)) { fstest_fail("Contents of file '%s' do not match after rollback", path); return; }
+    if (vfs_file_exists(added)) { fstest_fail("File '%s' still exists after rollback", added); return; }
+    if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems after rollback"); return; }
+    fstest_ok("Read back file '%s' after rollback", path);
+
+    // dropping keeps every change made since
+    if (!ata_snapshot_take()) { fstest_fail("Unable to take snapshot"); return; }
+    if (!vfs_write_text(added, "snapshot")) { fstest_fail("Unable to write file '%s'", added); ata_snapshot_drop(); return; }
+    ata_snapshot_drop();
+    char* text = vfs_read_text(added);
+    if (text == NULL || strcmp(text, "snapshot")) { fstest_fail("Contents of file '%s' do not match after dropping snapshot", added); free(text); return; }
+    free(text);
+    fstest_ok("Read back file '%s' after dropping snapshot", added);
+
+    vfs_delete_file(path);
+    vfs_delete_file(added);
+    fstest_done("SNAPSHOTS");
+}
+
+void fstest_overlay()
+{
+    const char* path  = "/overlay.bin";
+    const char* base  = "fstest_base.img";
+    const char* delta = "fstest_delta.img";
+    uint8_t* data = malloc(16384);
+    fstest_fill(data, 16384, 50);
+    if (!vfs_write_bytes(path, data, 16384)) { fstest_fail("Unable to write file '%s'", path); free(data); return; }
+
+    ata_save_file(base);
+    if (!ata_overlay_create(delta, base)) { fstest_fail("Unable to create overlay '%s'", delta); free(data); unlink(base); return; }
+    fs_mount();
+
+    // writes land in the delta, the base keeps the contents it was saved with
+    fstest_fill(data, 16384, 51);
+    bool_t written = vfs_write_bytes(path, data, 16384);
+    free(data);
+    bool_t result = TRUE;
+    if (!written || !fstest_matches(path, 16384, 51)) { fstest_fail("Contents of file '%s' do not match in overlay", path); result = FALSE; }
+    else if (ata_overlay_count() == 0) { fstest_fail("Overlay '%s' has no changed sectors", delta); result = FALSE; }
+    else if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems in overlay"); result = FALSE; }
+    else { fstest_ok("Read back file '%s' from overlay", path); }
+
+    // loading the base also leaves the overlay for the tests after this one
+    ata_load_file(base);
+    fs_mount();
+    unlink(delta);
+    unlink(base);
+    if (!result) { return; }
+    if (!fstest_matches(path, 16384, 50)) { fstest_fail("Contents of file '%s' changed in base image", path); return; }
+    fstest_ok("Read back file '%s' from base image", path);
+
+    vfs_delete_file(path);
+    fstest_done("OVERLAYS");
+}
+
+void fstest_index()
+{
+    // enough entries to split nodes of the on-disk index, fsck checks it against the file table on formats with FSFLAG_BTREE
+    const char* dir = "/index/";
+    uint32_t count  = BTREE_NODE_MAX * 3;
+    char path[64];
+    if (!vfs_create_dir(dir)) { fstest_fail("Unable to create directory '%s'", dir); return; }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sprintf(path, "%sentry%d.txt", dir, i);
+        if (!vfs_write_text(path, path)) { fstest_fail("Unable to write file '%s'", path); return; }
+    }
+
+    // mounting again reads the index back from disk instead of the one built up by the writes
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1) { fs_mount(); }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            sprintf(path, "%sentry%d.txt", dir, i);
+            char* text = vfs_read_text(path);
+            if (text == NULL || strcmp(text, path)) { fstest_fail("Contents of file '%s' do not match", path); free(text); return; }
+            free(text);
+        }
+        if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems with %d files in '%s'", count, dir); return; }
+        fstest_ok("Read back %d files in '%s'%s", count, dir, pass == 1 ? " after mounting" : "");
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sprintf(path, "%sentry%d.txt", dir, i);
+        if (!vfs_delete_file(path)) { fstest_fail("Unable to delete file '%s'", path); return; }
+    }
+    vfs_delete_dir(dir, FALSE);
+    if (fsck_errors(fsck_run(FALSE, 1)) > 0) { fstest_fail("File system has problems after deleting '%s'", dir); return; }
+    fstest_done("INDEXED FILES");
+}
@@ -0,0 +1,256 @@
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+#include "vfs.h"
+#include "stats.h"
+
+volatile bool_t trace_active = FALSE;
+
+FILE*           trace_file = NULL;
+uint64_t        trace_last = 0;
+pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+const char* TRACE_OP_NAMES[TRACE_OP_COUNT] =
+{
+    "dir_exists", "file_exists", "dir_info", "file_info", "count_dirs", "count_files", "get_dirs", "get_files",
+    "read", "write", "create_dir", "rename_dir", "rename_file", "delete_dir", "delete_file", "copy_dir", "copy_file",
+};
+
+const char* trace_op_name(uint8_t op)
+{
+    if (op >= TRACE_OP_COUNT) { return "unknown"; }
+    return TRACE_OP_NAMES[op];
+}
+
+bool_t trace_start(const char* filename)
+{
+    if (trace_active) { printf("Trace is already being recorded\n"); return FALSE; }
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) { printf("Unable to create trace file '%s'\n", filename); return FALSE; }
+
+    trace_header_t header;
+    header.magic    = TRACE_MAGIC;
+    header.version  = TRACE_VERSION;
+    header.reserved = 0;
+    header.started  = (uint64_t)time(NULL);
+    fwrite(&header, sizeof(trace_header_t), 1, file);
+
+    pthread_mutex_lock(&trace_mutex);
+    trace_file = file;
+    trace_last = stats_now();
+    pthread_mutex_unlock(&trace_mutex);
+    trace_active = TRUE;
+    printf("Recording trace to '%s'\n", filename);
+    return TRUE;
+}
+
+bool_t trace_stop()
+{
+    if (!trace_active) { printf("No trace is being recorded\n"); return FALSE; }
+    trace_active = FALSE;
+
+    // operations that passed the check before it was cleared finish their record first
+    pthread_mutex_lock(&trace_mutex);
+    fclose(trace_file);
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_mutex);
+    printf("Stopped recording trace\n");
+    return TRUE;
+}
+
+// append record for operation being entered, records are ordered by time
+void trace_record(uint8_t op, uint8_t flags, const char* path, const char* arg, uint32_t size)
+{
+    trace_record_t record;
+    record.op       = op;
+    record.flags    = flags;
+    record.path_len = (path == NULL) ? 0 : strnlen(path, UINT16_MAX);
+    record.arg_len  = (arg == NULL) ? 0 : strnlen(arg, UINT16_MAX);
+    record.size     = size;
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file == NULL) { pthread_mutex_unlock(&trace_mutex); return; }
+    uint64_t now = stats_now();
+    uint64_t delta = (now - trace_last) / 1000;
+    record.delta_us = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t)delta;
+    trace_last = now;
+    fwrite(&record, sizeof(trace_record_t), 1, trace_file);
+    if (record.path_len > 0) { fwrite(path, record.path_len, 1, trace_file); }
+    if (record.arg_len > 0) { fwrite(arg, record.arg_len, 1, trace_file); }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+// latency samples of one operation type
+typedef struct
+{
+    uint64_t* samples;
+    uint32_t  count;
+    uint32_t  max;
+    uint32_t  failed;
+    uint64_t  total_ns;
+} trace_stat_t;
+
+void trace_stat_add(trace_stat_t* stat, uint64_t elapsed, bool_t success)
+{
+    if (stat->count == stat->max)
+    {
+        stat->max = (stat->max == 0) ? 256 : stat->max * 2;
+        stat->samples = realloc(stat->samples, stat->max * sizeof(uint64_t));
+    }
+    stat->samples[stat->count++] = elapsed;
+    stat->total_ns += elapsed;
+    if (!success) { stat->failed++; }
+}
+
+int trace_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    if (x < y) { return -1; }
+    return x > y;
+}
+
+// execute one record, returns whether the operation succeeded
+bool_t trace_execute(trace_record_t* record, const char* path, const char* arg, uint8_t** buffer, uint32_t* buffer_size)
+{
+    int count = 0;
+    switch (record->op)
+    {
+        case TRACE_OP_DIR_EXISTS:  { return vfs_dir_exists(path); }
+        case TRACE_OP_FILE_EXISTS: { return vfs_file_exists(path); }
+        case TRACE_OP_DIR_INFO:
+        {
+            vfs_directory_t dir = vfs_dir_info(path);
+            if (dir.name == VFS_NULL_DIR.name) { return FALSE; }
+            free(dir.name);
+            free(dir.path);
+            return TRUE;
+        }
+        case TRACE_OP_FILE_INFO:
+        {
+            vfs_file_t file = vfs_file_info(path);
+            if (file.name == VFS_NULL_FILE.name) { return FALSE; }
+            free(file.name);
+            free(file.path);
+            return TRUE;
+        }
+        case TRACE_OP_COUNT_DIRS:  { vfs_count_dirs(path); return TRUE; }
+        case TRACE_OP_COUNT_FILES: { vfs_count_files(path); return TRUE; }
+        case TRACE_OP_GET_DIRS:
+        {
+            char** names = vfs_get_dirs(path, &count);
+            freearray(names, count);
+            return names != NULL;
+        }
+        case TRACE_OP_GET_FILES:
+        {
+            char** names = vfs_get_files(path, &count);
+            freearray(names, count);
+            return names != NULL;
+        }
+        case TRACE_OP_READ:
+        {
+            uint8_t* data = vfs_read_bytes(path);
+            if (data == NULL) { return FALSE; }
+            free(data);
+            return TRUE;
+        }
+        case TRACE_OP_WRITE:
+        {
+            // contents are not recorded, a buffer of the original size is written instead
+            if (record->size > *buffer_size)
+            {
+                *buffer = realloc(*buffer, record->size);
+                for (uint32_t i = *buffer_size; i < record->size; i++) { (*buffer)[i] = (uint8_t)(i * 31); }
+                *buffer_size = record->size;
+            }
+            return vfs_write_bytes(path, *buffer, record->size);
+        }
+        case TRACE_OP_CREATE_DIR:  { return vfs_create_dir(path); }
+        case TRACE_OP_RENAME_DIR:  { return vfs_rename_dir(path, arg); }
+        case TRACE_OP_RENAME_FILE: { return vfs_rename_file(path, arg); }
+        case TRACE_OP_DELETE_DIR:  { return vfs_delete_dir(path, record->flags & TRACE_FLAG_RECURSIVE); }
+        case TRACE_OP_DELETE_FILE: { return vfs_delete_file(path); }
+        case TRACE_OP_COPY_DIR:    { return vfs_copy_dir(path, arg, record->flags & TRACE_FLAG_RECURSIVE); }
+        case TRACE_OP_COPY_FILE:   { return vfs_copy_file(path, arg); }
+        default: { return FALSE; }
+    }
+}
+
+// replay recorded operations against current disk, as fast as possible or at their original pacing
+bool_t trace_replay(const char* filename, bool_t paced)
+{
+    if (trace_active) { printf("Unable to replay while a trace is being recorded\n"); return FALSE; }
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) { printf("Unable to locate trace file '%s'\n", filename); return FALSE; }
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(size + 1);
+    size_t read = fread(data, 1, size, file);
+    fclose(file);
+    trace_header_t* header = (trace_header_t*)data;
+    if (read != size || size < sizeof(trace_header_t) || header->magic != TRACE_MAGIC || header->version != TRACE_VERSION)
+    {
+        printf("Invalid trace file '%s'\n", filename);
+        free(data);
+        return FALSE;
+    }
+
+    trace_stat_t stats[TRACE_OP_COUNT];
+    memset(stats, 0, sizeof(stats));
+    uint8_t* buffer = NULL;
+    uint32_t buffer_size = 0;
+    char*    path = malloc(UINT16_MAX + 1);
+    char*    arg  = malloc(UINT16_MAX + 1);
+    uint32_t ops = 0;
+    uint64_t offset = 0;
+    uint64_t started = stats_now();
+
+    size_t pos = sizeof(trace_header_t);
+    while (pos + sizeof(trace_record_t) <= size)
+    {
+        trace_record_t* record = (trace_record_t*)(data + pos);
+        size_t next = pos + sizeof(trace_record_t) + record->path_len + record->arg_len;
+        if (next > size || record->op >= TRACE_OP_COUNT) { printf("Trace file '%s' is truncated at offset %zu\n", filename, pos); break; }
+        memcpy(path, data + pos + sizeof(trace_record_t), record->path_len);
+        path[record->path_len] = 0;
+        memcpy(arg, data + pos + sizeof(trace_record_t) + record->path_len, record->arg_len);
+        arg[record->arg_len] = 0;
+        pos = next;
+
+        offset += (uint64_t)record->delta_us * 1000;
+        if (paced)
+        {
+            uint64_t due = started + offset;
+            struct timespec ts = { (time_t)(due / 1000000000ull), (long)(due % 1000000000ull) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+
+        uint64_t begin = stats_now();
+        bool_t success = trace_execute(record, path, arg, &buffer, &buffer_size);
+        trace_stat_add(&stats[record->op], stats_now() - begin, success);
+        ops++;
+    }
+    uint64_t elapsed = stats_now() - started;
+
+    printf("Replayed %u operations from '%s' in %llu ms, %.0f ops/s\n", ops, filename, (unsigned long long)(elapsed / 1000000),
+           (elapsed > 0) ? ops / (elapsed / 1e9) : 0.0);
+    printf("%-12s %8s %8s %12s %12s %12s\n", "operation", "count", "failed", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < TRACE_OP_COUNT; i++)
+    {
+        trace_stat_t* stat = &stats[i];
+        if (stat->count == 0) { continue; }
+        qsort(stat->samples, stat->count, sizeof(uint64_t), trace_compare);
+        printf("%-12s %8u %8u %12.1f %12.1f %12.1f\n", trace_op_name(i), stat->count, stat->failed,
+               stat->samples[stat->count / 2] / 1000.0, stat->samples[((uint64_t)stat->count * 99) / 100] / 1000.0,
+               stat->samples[stat->count - 1] / 1000.0);
+        free(stat->samples);
+    }
+
+    free(path);
+    free(arg);
+    free(buffer);
+    free(data);
+    return TRUE;
+}
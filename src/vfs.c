@@ -1,12 +1,21 @@
+#include <sys/stat.h>
 #include "vfs.h"
 #include "fs.h"
 #include "ata.h"
+#include "dedup.h"
+#include "pack.h"
+#include "fslock.h"
+#include "nameidx.h"
+#include "trace.h"
+#include "stats.h"
 
 vfs_directory_t VFS_NULL_DIR  = { "", "", 0, 0, 0, 0 };
 vfs_file_t      VFS_NULL_FILE = { "", "", 0, 0, 0 };
 
 bool_t vfs_dir_exists(const char* path)
 {
+    TRACE(TRACE_OP_DIR_EXISTS, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_DIR_EXISTS);
     fs_directory_t dir = fs_get_dir_byname(path);
     if (dir.type != FSTYPE_DIR) { return FALSE; }
     return TRUE;
@@ -14,6 +23,8 @@ bool_t vfs_dir_exists(const char* path)
 
 bool_t vfs_file_exists(const char* path)
 {
+    TRACE(TRACE_OP_FILE_EXISTS, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_FILE_EXISTS);
     fs_file_t dir = fs_get_file_byname(path);
     if (dir.type != FSTYPE_FILE) { return FALSE; }
     return TRUE;
@@ -21,23 +32,19 @@ bool_t vfs_file_exists(const char* path)
 
 vfs_directory_t vfs_dir_info(const char* path)
 {
-    fs_directory_t dir = fs_get_dir_byname(path);
+    TRACE(TRACE_OP_DIR_INFO, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_DIR_INFO);
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return VFS_NULL_DIR; }
+    fs_directory_t dir = fs_path_dir(&parsed, NULL);
     if (dir.type != FSTYPE_DIR) { return VFS_NULL_DIR; }
-    char* name = fs_get_name_from_path(path);
-    char* dir_name = fs_get_parent_path_from_path(path);
-    if (name == NULL) { return VFS_NULL_DIR; }
 
-    vfs_directory_t out_dir;
-    out_dir.name = malloc(strlen(name) + 1);
-    strcpy(out_dir.name, name);
-    
     // copy name and path
-    if (dir_name != NULL)
-    {
-        out_dir.path = malloc(strlen(dir_name) + 1);
-        strcpy(out_dir.path, dir_name);
-    }
-    else { out_dir.path = malloc(1); out_dir.path[0] = 0; }
+    vfs_directory_t out_dir;
+    out_dir.name = malloc(FS_NAME_MAX);
+    fs_path_name(&parsed, out_dir.name);
+    out_dir.path = fs_path_dirname(&parsed);
+    if (out_dir.path == NULL) { out_dir.path = malloc(1); out_dir.path[0] = 0; }
 
     out_dir.status = (VFSSTATUS)dir.status;
 
@@ -51,23 +58,21 @@ vfs_directory_t vfs_dir_info(const char* path)
 
 vfs_file_t vfs_file_info(const char* path)
 {
-    fs_file_t file = fs_get_file_byname(path);
+    TRACE(TRACE_OP_FILE_INFO, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_FILE_INFO);
+    fs_path_t parsed;
+    if (path == NULL || strlen(path) == 0 || !fs_path_parse(path, &parsed)) { return VFS_NULL_FILE; }
+    fslock_path_read();
+    fs_file_t file = fs_path_file(&parsed, NULL);
+    fslock_path_unlock();
     if (file.type != FSTYPE_FILE) { return VFS_NULL_FILE; }
-    char* name = fs_get_name_from_path(path);
-    char* dir_name = fs_get_parent_path_from_path(path);
-    if (name == NULL) { return VFS_NULL_FILE; }
 
-    vfs_file_t out_file;
-    out_file.name = malloc(strlen(name) + 1);
-    strcpy(out_file.name, name);
-    
     // copy name and path
-    if (dir_name != NULL)
-    {
-        out_file.path = malloc(strlen(dir_name) + 1);
-        strcpy(out_file.path, dir_name);
-    }
-    else { out_file.path = malloc(1); out_file.path[0] = 0; }
+    vfs_file_t out_file;
+    out_file.name = malloc(FS_NAME_MAX);
+    fs_path_name(&parsed, out_file.name);
+    out_file.path = fs_path_dirname(&parsed);
+    if (out_file.path == NULL) { out_file.path = malloc(1); out_file.path[0] = 0; }
 
     out_file.status = (VFSSTATUS)file.status;
     out_file.size = file.size;
@@ -75,119 +80,80 @@ vfs_file_t vfs_file_info(const char* path)
     return out_file;
 }
 
-uint32_t vfs_count_dirs(const char* path)
+// count children of type in directory at path, taken from the name index without locking
+uint32_t vfs_count_type(const char* path, uint8_t type)
 {
-    if (!vfs_dir_exists(path)) { printf("Unable to count directories in '%s'\n", path); return 0; }
-
-    fs_directory_t dir = fs_get_dir_byname(path);
-    if (dir.type != FSTYPE_DIR) { printf("Error while counting directories in '%s'\n", path); return 0; }
-    int index = fs_get_dir_index(dir);
+    int index = nameidx_resolve(path, FSTYPE_DIR);
+    if (index < 0) { return 0; }
+
+    uint32_t count = 0;
+    uint32_t epoch = nameidx_read_begin();
+    nameidx_cursor_t cursor;
+    nameidx_cursor_begin(&cursor, index);
+    for (const nameidx_entry_t* entry = nameidx_cursor_next(&cursor); entry != NULL; entry = nameidx_cursor_next(&cursor)) { if (entry->type == type) { count++; } }
+    nameidx_read_end(epoch);
+    return count;
+}
 
-    uint32_t dirs_count = 0;
-    uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
-    for (uint32_t sec = 0; sec < fs_get_info().file_table_sector_count; sec++)
+// copy names of children of type in directory at path, one consistent version of the listing is used
+char** vfs_get_type(const char* path, uint8_t type, int* count)
+{
+    int index = nameidx_resolve(path, FSTYPE_DIR);
+    if (index < 0) { return NULL; }
+
+    // the on-disk index does not know how many children a directory has, so the output grows as they are walked
+    uint32_t epoch = nameidx_read_begin();
+    nameidx_cursor_t cursor;
+    nameidx_cursor_begin(&cursor, index);
+
+    int    output_max   = 16;
+    char** output       = (char**)malloc(sizeof(char*) * output_max);
+    int    output_index = 0;
+    for (const nameidx_entry_t* entry = nameidx_cursor_next(&cursor); entry != NULL; entry = nameidx_cursor_next(&cursor))
     {
-        ata_read(fs_get_info().file_table_start + sec, 1, secdata);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-        {
-            fs_directory_t* tempdir = (fs_directory_t*)(secdata + i);
-            if (tempdir->type == FSTYPE_DIR && tempdir->parent_index == index) { dirs_count++; }
-        }
+        if (entry->type != type) { continue; }
+        if (output_index == output_max) { output_max *= 2; output = (char**)realloc(output, sizeof(char*) * output_max); }
+        char* name = malloc(strlen(entry->name) + 1);
+        strcpy(name, entry->name);
+        output[output_index] = name;
+        output_index++;
     }
-    free(secdata);
-    return dirs_count;
+    nameidx_read_end(epoch);
+    *count = output_index;
+    return output;
 }
 
-uint32_t vfs_count_files(const char* path)
+uint32_t vfs_count_dirs(const char* path)
 {
-    if (!vfs_dir_exists(path)) { printf("Unable to count files in '%s'\n", path); return 0; }
-
-    fs_directory_t dir = fs_get_dir_byname(path);
-    if (dir.type != FSTYPE_DIR) { printf("Error while counting files in '%s'\n", path); return 0; }
-    int index = fs_get_dir_index(dir);
-
-    uint32_t dirs_count = 0;
-    uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
-    for (uint32_t sec = 0; sec < fs_get_info().file_table_sector_count; sec++)
-    {
-        ata_read(fs_get_info().file_table_start + sec, 1, secdata);
+    TRACE(TRACE_OP_COUNT_DIRS, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_COUNT_DIRS);
+    if (fs_get_dir_byname(path).type != FSTYPE_DIR) { printf("Unable to count directories in '%s'\n", path); return 0; }
+    return vfs_count_type(path, FSTYPE_DIR);
+}
 
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_file_t))
-        {
-            fs_file_t* tempfile = (fs_file_t*)(secdata + i);
-            if (tempfile->type == FSTYPE_FILE && tempfile->parent_index == index) { dirs_count++; }
-        }
-    }
-    free(secdata);
-    return dirs_count;
+uint32_t vfs_count_files(const char* path)
+{
+    TRACE(TRACE_OP_COUNT_FILES, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_COUNT_FILES);
+    if (fs_get_dir_byname(path).type != FSTYPE_DIR) { printf("Unable to count files in '%s'\n", path); return 0; }
+    return vfs_count_type(path, FSTYPE_FILE);
 }
 
 char** vfs_get_dirs(const char* path, int* count)
 {
-    if (!vfs_dir_exists(path)) { printf("Unable to locate directory '%s'\n", path); return NULL; }
-
-    fs_directory_t dir = fs_get_dir_byname(path);
-    if (dir.type != FSTYPE_DIR) { printf("Error while locating directory '%s'\n", path); return NULL; }
-    int index = fs_get_dir_index(dir);
-
-    uint32_t dir_count = vfs_count_dirs(path);
-    char** output = (char**)malloc(sizeof(char*) * dir_count);
-    int output_index = 0;
-
-    uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
-    for (uint32_t sec = 0; sec < fs_get_info().file_table_sector_count; sec++)
-    {
-        ata_read(fs_get_info().file_table_start + sec, 1, secdata);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-        {
-            fs_directory_t* tempdir = (fs_directory_t*)(secdata + i);
-            if (tempdir->type == FSTYPE_DIR && tempdir->parent_index == index)
-            {
-                char* dirname = malloc(strlen(tempdir->name) + 1);
-                strcpy(dirname, tempdir->name);
-                output[output_index] = dirname;
-                output_index++;
-            }
-        }
-    }
-    free(secdata);
-    *count = output_index;
+    TRACE(TRACE_OP_GET_DIRS, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_GET_DIRS);
+    char** output = vfs_get_type(path, FSTYPE_DIR, count);
+    if (output == NULL) { printf("Unable to locate directory '%s'\n", path); }
     return output;
 }
 
 char** vfs_get_files(const char* path, int* count)
 {
-    if (!vfs_dir_exists(path)) { printf("Unable to locate directory '%s'\n", path); return NULL; }
-
-    fs_directory_t dir = fs_get_dir_byname(path);
-    if (dir.type != FSTYPE_DIR) { printf("Error while locating directory '%s'\n", path); return NULL; }
-    int index = fs_get_dir_index(dir);
-
-    uint32_t file_count = vfs_count_files(path);
-    char** output = (char**)malloc(sizeof(char*) * file_count);
-    int output_index = 0;
-
-    uint8_t* secdata = malloc(ATA_SECTOR_SIZE);
-    for (uint32_t sec = 0; sec < fs_get_info().file_table_sector_count; sec++)
-    {
-        ata_read(fs_get_info().file_table_start + sec, 1, secdata);
-
-        for (uint32_t i = 0; i < ATA_SECTOR_SIZE; i += sizeof(fs_directory_t))
-        {
-            fs_directory_t* tempfile = (fs_directory_t*)(secdata + i);
-            if (tempfile->type == FSTYPE_FILE && tempfile->parent_index == index)
-            {
-                char* fname = malloc(strlen(tempfile->name) + 1);
-                strcpy(fname, tempfile->name);
-                output[output_index] = fname;
-                output_index++;
-            }
-        }
-    }
-    free(secdata);
-    *count = output_index;
+    TRACE(TRACE_OP_GET_FILES, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_GET_FILES);
+    char** output = vfs_get_type(path, FSTYPE_FILE, count);
+    if (output == NULL) { printf("Unable to locate directory '%s'\n", path); }
     return output;
 }
 
@@ -198,6 +164,8 @@ char** vfs_read_lines(const char* path)
 
 char* vfs_read_text(const char* path)
 {
+    TRACE(TRACE_OP_READ, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_READ);
     fs_file_t file = fs_file_read(path);
     if (file.type != FSTYPE_FILE) { return NULL; }
     return (char*)file.data;
@@ -205,6 +173,8 @@ char* vfs_read_text(const char* path)
 
 uint8_t* vfs_read_bytes(const char* path)
 {
+    TRACE(TRACE_OP_READ, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_READ);
     fs_file_t file = fs_file_read(path);
     if (file.type != FSTYPE_FILE) { return NULL; }
     return file.data;
@@ -217,117 +187,211 @@ bool_t vfs_write_lines(const char* path, char** lines, int line_count)
 
 bool_t vfs_write_text(const char* path, char* text)
 {
+    TRACE(TRACE_OP_WRITE, 0, path, NULL, strlen(text));
+    STATS_SCOPE(STATS_OP_WRITE);
     return fs_file_write(path, (uint8_t*)text, strlen(text));
 }
 
 bool_t vfs_write_bytes(const char* path, uint8_t* data, uint32_t size)
 {
+    TRACE(TRACE_OP_WRITE, 0, path, NULL, size);
+    STATS_SCOPE(STATS_OP_WRITE);
     return fs_file_write(path, data, size);
 }
 
+// import host file without reading it into memory first
+bool_t vfs_import_file(const char* path, int fd)
+{
+    struct stat st;
+    TRACE(TRACE_OP_WRITE, 0, path, NULL, fstat(fd, &st) == 0 ? st.st_size : 0);
+    STATS_SCOPE(STATS_OP_WRITE);
+    return fs_file_import(path, fd);
+}
+
 bool_t vfs_create_dir(const char* path)
 {
-    fs_directory_t parent = fs_parent_from_path(path);
-    if (parent.type != FSTYPE_DIR) { return FALSE; }
+    TRACE(TRACE_OP_CREATE_DIR, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_CREATE_DIR);
+    fs_path_t parsed;
+    if (path == NULL || !fs_path_parse(path, &parsed) || parsed.count == 0) { return FALSE; }
+    fslock_path_write();
+    int parent_index;
+    fs_directory_t parent = fs_path_parent(&parsed, &parent_index);
+    if (parent.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
 
     fs_directory_t new_dir;
-    char* name = fs_get_name_from_path(path);
-    strcpy(new_dir.name, name);
-    free(name);
-    new_dir.parent_index = fs_get_dir_index(parent);
+    fs_path_name(&parsed, new_dir.name);
+    new_dir.parent_index = parent_index;
     new_dir.status = 0x00;
     new_dir.type   = FSTYPE_DIR;
     memset(new_dir.padding, 0, sizeof(new_dir.padding));
     fs_directory_t created = fs_filetable_create_dir(new_dir);
-    if (created.type != FSTYPE_DIR) { return FALSE; }
+    if (created.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
+    fslock_path_unlock();
     return TRUE;
     
 }
 
 bool_t vfs_rename_dir(const char* path, const char* name)
 {
-    fs_directory_t dir = fs_get_dir_byname(path);
-    if (dir.type != FSTYPE_DIR) { return FALSE; }
-    int index = fs_get_dir_index(dir);
+    TRACE(TRACE_OP_RENAME_DIR, 0, path, name, 0);
+    STATS_SCOPE(STATS_OP_RENAME_DIR);
+    fs_path_t parsed;
+    if (path == NULL || !fs_path_parse(path, &parsed)) { return FALSE; }
+    fslock_path_write();
+    int index;
+    fs_directory_t dir = fs_path_dir(&parsed, &index);
+    if (dir.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
 
     strcpy(dir.name, name);
     fs_filetable_write_dir(index, dir);
+    fslock_path_unlock();
     return TRUE;
 }
 
 bool_t vfs_rename_file(const char* path, const char* name)
 {
-    fs_file_t file = fs_get_file_byname(path);
-    if (file.type != FSTYPE_FILE) { return FALSE; }
-    int index = fs_get_file_index(file);
+    TRACE(TRACE_OP_RENAME_FILE, 0, path, name, 0);
+    STATS_SCOPE(STATS_OP_RENAME_FILE);
+    fs_path_t parsed;
+    if (path == NULL || !fs_path_parse(path, &parsed)) { return FALSE; }
+
+    // file lock waits for readers under the old name, a writer under the new one takes another stripe
+    uint32_t key = fslock_file_key(path);
+    fslock_path_write();
+    fslock_file_write(key);
+    int index;
+    fs_file_t file = fs_path_file(&parsed, &index);
+    if (file.type != FSTYPE_FILE) { fslock_file_unlock(key); fslock_path_unlock(); return FALSE; }
 
     strcpy(file.name, name);
     fs_filetable_write_file(index, file);
+    fslock_file_unlock(key);
+    fslock_path_unlock();
     return TRUE;
 }
 
 bool_t vfs_delete_dir(const char* path, bool_t recursive)
 {
+    TRACE(TRACE_OP_DELETE_DIR, recursive ? TRACE_FLAG_RECURSIVE : 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_DELETE_DIR);
+    fslock_path_write();
     fs_directory_t dir = fs_get_dir_byname(path);
-    if (dir.type != FSTYPE_DIR) { return FALSE; }
+    if (dir.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
 
-    if (!recursive) { fs_filetable_delete_dir(dir); return TRUE; }
+    if (!recursive) { fs_filetable_delete_dir(dir); fslock_path_unlock(); return TRUE; }
     else
     {
         printf("Recursive delete not yet implemented\n");
+        fslock_path_unlock();
         return FALSE;
     }
 }
 
 bool_t vfs_delete_file(const char* path)
 {
+    TRACE(TRACE_OP_DELETE_FILE, 0, path, NULL, 0);
+    STATS_SCOPE(STATS_OP_DELETE_FILE);
+    // file lock waits for readers of the block, which do not take the path lock
+    uint32_t key = fslock_file_key(path);
+    fslock_path_write();
+    fslock_file_write(key);
     fs_file_t file = fs_get_file_byname(path);
-    if (file.type != FSTYPE_FILE) { return FALSE; }
+    if (file.type != FSTYPE_FILE) { fslock_file_unlock(key); fslock_path_unlock(); return FALSE; }
 
-    if (!fs_blktable_free(fs_blktable_at_index(file.blk_index))) { return FALSE; }
-    return fs_filetable_delete_file(file);
+    bool_t result = fs_file_release(file) && fs_filetable_delete_file(file);
+    fslock_file_unlock(key);
+    fslock_path_unlock();
+    return result;
 }
 
 bool_t vfs_copy_dir(const char* dest, const char* src, bool_t recursive)
 {
-    if (recursive) { printf("Recursive copy not yet implemented\n"); return FALSE; }
+    TRACE(TRACE_OP_COPY_DIR, recursive ? TRACE_FLAG_RECURSIVE : 0, dest, src, 0);
+    STATS_SCOPE(STATS_OP_COPY_DIR);
+    fslock_path_write();
+    if (recursive) { printf("Recursive copy not yet implemented\n"); fslock_path_unlock(); return FALSE; }
 
     fs_directory_t dir_src = fs_get_dir_byname(src);
-    if (dir_src.type != FSTYPE_DIR) { return FALSE; }
+    if (dir_src.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
 
-    fs_directory_t dir_dest_parent = fs_parent_from_path(dest);
-    if (dir_dest_parent.type != FSTYPE_DIR) { return FALSE; }
+    fs_path_t parsed;
+    int       parent_index;
+    if (!fs_path_parse(dest, &parsed) || parsed.count == 0) { fslock_path_unlock(); return FALSE; }
+    fs_directory_t dir_dest_parent = fs_path_parent(&parsed, &parent_index);
+    if (dir_dest_parent.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
 
-    char* name = fs_get_name_from_path(dest);
     fs_directory_t dir_dest;
-    strcpy(dir_dest.name, name);
-    dir_dest.parent_index = fs_get_dir_index(dir_dest_parent);
+    fs_path_name(&parsed, dir_dest.name);
+    dir_dest.parent_index = parent_index;
     dir_dest.status = 0x00;
     dir_dest.type = FSTYPE_DIR;
-    return fs_filetable_create_dir(dir_dest).type == FSTYPE_DIR;
+    bool_t result = fs_filetable_create_dir(dir_dest).type == FSTYPE_DIR;
+    fslock_path_unlock();
+    return result;
 }
 
 bool_t vfs_copy_file(const char* dest, const char* src)
 {
-    fs_file_t file_src = fs_file_read(src);
-    if (file_src.type != FSTYPE_FILE) { return FALSE; }
+    TRACE(TRACE_OP_COPY_FILE, 0, dest, src, 0);
+    STATS_SCOPE(STATS_OP_COPY_FILE);
+    fslock_path_write();
+    fs_file_t file_src = fs_get_file_byname(src);
+    if (file_src.type != FSTYPE_FILE) { fslock_path_unlock(); return FALSE; }
+
+    fs_path_t parsed;
+    int       parent_index;
+    if (!fs_path_parse(dest, &parsed) || parsed.count == 0) { fslock_path_unlock(); return FALSE; }
+    fs_directory_t file_dest_parent = fs_path_parent(&parsed, &parent_index);
+    if (file_dest_parent.type != FSTYPE_DIR) { fslock_path_unlock(); return FALSE; }
 
-    fs_directory_t file_dest_parent = fs_parent_from_path(dest);
-    if (file_dest_parent.type != FSTYPE_DIR) { return FALSE; }
-
-    char* name = fs_get_name_from_path(dest);
     fs_file_t file_dest;
-    strcpy(file_dest.name, name);
-    file_dest.parent_index = fs_get_dir_index(file_dest_parent);
-    file_dest.status = 0x00;
+    fs_path_name(&parsed, file_dest.name);
+    file_dest.parent_index = parent_index;
+    file_dest.status = file_src.status;
     file_dest.type = FSTYPE_FILE;
     file_dest.size = file_src.size;
+
+    // inline and packed contents get a record or tail of their own
+    if (file_src.status & (FSSTATUS_INLINE | FSSTATUS_PACKED))
+    {
+        uint8_t data[FS_PACK_MAX];
+        bool_t  packed = (file_src.status & FSSTATUS_PACKED) != 0;
+        bool_t  loaded = packed ? pack_load(file_src.blk_index, file_src.size, data) : fs_filetable_read_inline(file_src.blk_index, data, file_src.size);
+        int     ref    = !loaded ? -1 : packed ? pack_store(data, file_src.size) : fs_filetable_create_inline(data, file_src.size);
+        if (ref < 0) { fslock_path_unlock(); return FALSE; }
+        file_dest.blk_index = ref;
+        bool_t result = fs_filetable_create_file(file_dest).type == FSTYPE_FILE;
+        if (!result) { fs_file_release(file_dest); }
+        fslock_path_unlock();
+        return result;
+    }
     
-    fs_blkentry_t new_blk = fs_blktable_allocate(fs_bytes_to_sectors(file_dest.size));
-    fs_blktable_copy(new_blk, fs_blktable_at_index(file_src.blk_index));
+    // share block when deduplicating
+    if (dedup_get_enabled())
+    {
+        fs_blktable_addref(file_src.blk_index);
+        file_dest.blk_index = file_src.blk_index;
+        if (fs_filetable_create_file(file_dest).type == FSTYPE_FILE) { fslock_path_unlock(); return TRUE; }
+        fs_blktable_release(file_src.blk_index);
+        fslock_path_unlock();
+        return FALSE;
+    }
 
-    file_dest.blk_index = fs_blktable_get_index(new_blk);
-    return fs_filetable_create_file(file_dest).type == FSTYPE_FILE;
+    // copy stored block as is, compressed files stay compressed
+    fs_blkentry_t blk_src = fs_blktable_at_index(file_src.blk_index);
+    fs_blkentry_t new_blk = fs_blktable_allocate(blk_src.count);
+    if (new_blk.count == 0) { fslock_path_unlock(); return FALSE; }
+    fs_blktable_copy(new_blk, blk_src);
+    int new_index = fs_blktable_get_index(new_blk);
+    new_blk.crc = blk_src.crc;
+    fs_blktable_write(new_index, new_blk);
+
+    file_dest.blk_index = new_index;
+    bool_t result = fs_filetable_create_file(file_dest).type == FSTYPE_FILE;
+    if (!result) { fs_file_release(file_dest); }
+    fslock_path_unlock();
+    return result;
 }
 
 bool_t vfs_move_dir(const char* dest, const char* src)